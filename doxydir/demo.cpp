@@ -64,13 +64,13 @@ void push_temperature(japi_pushsrv_context *psc)
 	jmsg = json_object_new_object();
 	while (psc->enabled) {
 
-		for (i = 0.0; i <= 3.14; i += 0.1) {
+		for (i = 0.0; i <= 3.14 && psc->enabled; i += 0.1) {
 			/* Create JSON response string */
 			json_object_object_add(jmsg,"temperature",json_object_new_double(sensor_values->temperature+10*sin(i)));
 
 			/* Push message */
 			japi_pushsrv_sendmsg(psc,jmsg);
-			sleep(1);
+			japi_pushsrv_wait(psc, 1000);
 		}
 
 	}
@@ -96,7 +96,7 @@ void push_counter(japi_pushsrv_context *psc)
 		japi_pushsrv_sendmsg(psc,jmsg);
 
 		i++;
-		sleep(1);
+		japi_pushsrv_wait(psc, 1000);
 	}
 	json_object_put(jmsg);
 }
@@ -35,6 +35,8 @@
 #ifndef __CREADLINE_H__
 #define __CREADLINE_H__
 
+#include <stddef.h>
+
 /*! Override the maximum line size here (default: 64 MiB) */
 //#define CREADLINE_MAX_LINE_SIZE 10*1024*1024
 
@@ -57,6 +59,18 @@ typedef struct __creadline_buffer {
 	int nbytes;                     /*!< number of bytes stored in the buffer */
 } creadline_buf_t;
 
+/*!
+ * \brief Buffer type for lines read without blocking.
+ *
+ * Holds the received bytes of incomplete lines between calls. Initialize all
+ * fields to zero and free buf when the buffer is not used anymore.
+ */
+typedef struct __creadline_nbuffer {
+	char *buf;     /*!< buffer for storing received bytes */
+	size_t nbytes; /*!< number of bytes stored in the buffer */
+	size_t size;   /*!< allocated size of the buffer */
+} creadline_nbuf_t;
+
 /*!
  * \brief Read a single line from a file descriptor (reentrant version).
  *
@@ -86,6 +100,25 @@ typedef struct __creadline_buffer {
  */
 int creadline_r(int fd, void **dst, creadline_buf_t *buffer);
 
+/*!
+ * \brief Read a single line from a socket without blocking.
+ *
+ * creadline_nb_r behaves like creadline_r except that it never waits for data.
+ * The socket is read with MSG_DONTWAIT until a newline character is found or no
+ * more data is available. Bytes of an incomplete line are kept in the buffer,
+ * so the line is completed by later calls.
+ *
+ * \param fd		Socket
+ * \param dst		Pointer to a pointer to the read line
+ * \param buffer	creadline buffer for storing received characters
+ *
+ * \returns  -1 on error,
+ *           -2 if no complete line was received yet,
+ *            0 on EOF or when a zero-length line was read (check dst),
+ *            length of the read line otherwise
+ */
+int creadline_nb_r(int fd, void **dst, creadline_nbuf_t *buffer);
+
 /*!
  * \brief Read a single line from a file descriptor.
  *
@@ -37,6 +37,7 @@
 #include <json-c/json.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "creadline.h"
 
@@ -44,6 +45,39 @@
 extern "C" {
 #endif
 
+/*!
+ * \brief Event notification mechanism of the JAPI server loop.
+ */
+typedef enum {
+	JAPI_BACKEND_SELECT = 0, /*!< Portable select() loop (default) */
+	JAPI_BACKEND_EPOLL, /*!< epoll based loop for many clients, Linux only */
+	JAPI_BACKEND_IO_URING, /*!< io_uring based loop with batched system calls, Linux only */
+} japi_backend;
+
+/*!
+ * \brief Priority class of a request.
+ */
+typedef enum {
+	JAPI_PRIORITY_NORMAL = 0, /*!< Answered in order of arrival (default) */
+	JAPI_PRIORITY_HIGH, /*!< Answered before normal requests of other clients */
+} japi_priority;
+
+/*!
+ * \brief Options applied to accepted client sockets.
+ *
+ * Zero values keep the system defaults.
+ */
+typedef struct __japi_socket_options {
+	bool tcp_nodelay; /*!< Send small responses without delay (TCP_NODELAY) */
+	int sndbuf; /*!< Send buffer size in bytes (SO_SNDBUF) */
+	int rcvbuf; /*!< Receive buffer size in bytes (SO_RCVBUF) */
+	bool keepalive; /*!< Detect dead peers by keepalive probes (SO_KEEPALIVE) */
+	int keepalive_idle; /*!< Idle time in seconds before the first probe */
+	int keepalive_interval; /*!< Time in seconds between probes */
+	int keepalive_count; /*!< Number of unanswered probes until the connection is dropped */
+	unsigned int user_timeout_ms; /*!< Time unacknowledged data may remain (TCP_USER_TIMEOUT) */
+} japi_socket_options;
+
 /*!
  * \brief JAPI context struct.
  *
@@ -57,7 +91,43 @@ typedef struct __japi_context {
 	struct __japi_request *requests; /*!< Pointer to the JAPI request list */
 	struct __japi_pushsrv_context
 		*push_services; /*!< Pointer to the JAPI push service list */
+	struct __japi_pushsrv_context *
+		*pushsrv_index; /*!< Hash buckets indexing push services by name */
+	size_t pushsrv_index_size; /*!< Number of buckets in pushsrv_index */
+	size_t num_push_services; /*!< Number of registered push services */
+	pthread_mutex_t pushsrv_lock; /*!< Lock for push service list and index */
+	struct __japi_pushsrv_sched
+		*pushsrv_sched; /*!< Scheduler of periodic push services or NULL */
+	int pushsrv_pending; /*!< Number of subscribers with pending push messages */
+	unsigned int pushsrv_coalesce_us; /*!< Smallest coalescing window of push services */
+	struct __japi_pushsrv_trie
+		*pushsrv_trie; /*!< Push service names split into '/' separated segments */
+	struct __japi_pushsrv_pattern
+		*pushsrv_patterns; /*!< Wildcard subscriptions of clients */
 	struct __japi_client *clients; /*!< Pointer to the JAPI client context */
+	struct __japi_listener *listeners; /*!< Additional sockets the server accepts on */
+	int listen_backlog; /*!< Backlog of pending connections of the server sockets */
+	uint64_t accept_resume_us; /*!< Time accepting resumes after running out of resources or 0 */
+	japi_socket_options socket_options; /*!< Options of accepted client sockets */
+	unsigned int idle_timeout_ms; /*!< Time after which silent clients are dropped */
+	unsigned int request_timeout_ms; /*!< Time a client may stall within a request line */
+	struct __japi_client *idle_head; /*!< Least recently active client */
+	struct __japi_client *idle_tail; /*!< Most recently active client */
+	struct __japi_client *line_head; /*!< Client with the oldest incomplete line */
+	struct __japi_client *line_tail; /*!< Client with the newest incomplete line */
+	japi_backend backend; /*!< Event notification mechanism of the server loop */
+	int epoll_fd; /*!< epoll instance of the running server or -1 */
+	struct __japi_uring *uring; /*!< io_uring instance of the running server or NULL */
+	struct __japi_cache_entry **cache; /*!< Hash buckets of cached responses or NULL */
+	pthread_mutex_t cache_lock; /*!< Lock for the response cache */
+	unsigned long cache_generation; /*!< Generation of coalesced responses, see japi_set_request_coalesce() */
+	double client_rate; /*!< Requests per second allowed per client or 0 */
+	double client_burst; /*!< Requests a client may send at once */
+	unsigned int client_budget; /*!< Lines served per client and loop iteration or 0 */
+	unsigned int num_high_priority; /*!< Number of requests with high priority */
+	struct __japi_queued *queue_head; /*!< First normal request waiting for high priority ones */
+	struct __japi_queued *queue_tail; /*!< Last normal request waiting for high priority ones */
+	bool lines_pending; /*!< Flag marking clients with buffered lines left over */
 	bool include_args_in_response; /*!< Flag to include request args in response */
 	bool shutdown; /*!< Flag to shutdown the JAPI server */
 	bool init; /*!< Flag to mark finished initialization */
@@ -70,10 +140,33 @@ typedef struct __japi_context {
  */
 typedef struct __japi_client {
 	int socket; /*!< Socket to connect */
-	creadline_buf_t crl_buffer; /*!< Buffer used by creadline_r() */
+	creadline_nbuf_t crl_buffer; /*!< Buffer used by creadline_nb_r() */
+	uint64_t last_active_us; /*!< Time the client last sent data */
+	struct __japi_client *idle_prev; /*!< Previous client in the idle timeout queue */
+	struct __japi_client *idle_next; /*!< Next client in the idle timeout queue */
+	uint64_t line_start_us; /*!< Time an incomplete request line started, 0 if none */
+	struct __japi_client *line_prev; /*!< Previous client in the request timeout queue */
+	struct __japi_client *line_next; /*!< Next client in the request timeout queue */
+	bool ready; /*!< Flag marking pending data in the current server loop iteration */
+	bool pending; /*!< Flag marking buffered lines left over for the next iteration */
+	unsigned int queued; /*!< Number of requests waiting for high priority ones */
+	struct __japi_uring_client *uring; /*!< io_uring state of the client or NULL */
+	double tokens; /*!< Tokens left in the rate limit bucket */
+	uint64_t tokens_us; /*!< Time the bucket was last refilled */
 	struct __japi_client *next; /*!< Pointer to the next client struct or NULL */
 } japi_client;
 
+/*!
+ * \brief JAPI listener.
+ *
+ * Stores an additional server socket, the JAPI server accepts clients on.
+ */
+typedef struct __japi_listener {
+	int socket; /*!< Bound server socket */
+	char *path; /*!< File system path of a Unix domain socket or NULL */
+	struct __japi_listener *next; /*!< Pointer to the next listener or NULL */
+} japi_listener;
+
 /*!
  * \brief JAPI request handler type.
  */
@@ -89,6 +182,13 @@ typedef void (*japi_req_handler)(japi_context *ctx, json_object *request,
 typedef struct __japi_request {
 	const char *name; /*!< Printable name of the request */
 	japi_req_handler func; /*!< Function to call */
+	unsigned int cache_ttl_ms; /*!< Time responses are served from the cache or 0 */
+	bool coalesce; /*!< Flag to answer identical requests of an iteration at once */
+	japi_priority priority; /*!< Priority class of the request */
+	double rate; /*!< Requests per second allowed for all clients or 0 */
+	double burst; /*!< Requests allowed at once */
+	double tokens; /*!< Tokens left in the bucket */
+	uint64_t tokens_us; /*!< Time the bucket was last refilled */
 	struct __japi_request *next; /*!< Pointer to the next request struct or NULL */
 } japi_request;
 
@@ -136,22 +236,343 @@ int japi_destroy(japi_context *ctx);
 int japi_register_request(japi_context *ctx, const char *req_name,
 						  japi_req_handler req_handler);
 
+/*!
+ * \brief Cache the responses of a request
+ *
+ * For read-only requests returning the same result for the same arguments,
+ * like device information or capability lists, the serialized response data
+ * is kept for the given time. Requests with the same name and arguments, in
+ * any order of keys, are answered from the cache without calling the handler.
+ * The request name, request number and arguments of the response are still
+ * set per request.
+ *
+ * \param ctx		JAPI context
+ * \param req_name	Name of a registered request
+ * \param ttl_ms	Time in milliseconds a response is served from the cache.
+ * 0 disables caching and drops the cached responses of the request.
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context,
+ * -2 for empty request name and -3 if the request is not registered is
+ * returned.
+ */
+int japi_set_request_cache(japi_context *ctx, const char *req_name, unsigned int ttl_ms);
+
+/*!
+ * \brief Coalesce identical requests
+ *
+ * When many clients send the same expensive request at the same time, like
+ * dashboards polling a status, the handler is called only once for all
+ * identical requests (same name and arguments) handled in the same iteration
+ * of the server loop. The response data is shared, while each client receives
+ * its own request name and request number. A request that is neither cached nor
+ * coalesced ends the sharing, as it may have changed the state, so a client
+ * pipelining "status; set; status" gets a fresh second status. Only suitable
+ * for requests without side effects.
+ *
+ * \param ctx		JAPI context
+ * \param req_name	Name of a registered request
+ * \param coalesce	Flag to enable coalescing
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context,
+ * -2 for empty request name and -3 if the request is not registered is
+ * returned.
+ */
+int japi_set_request_coalesce(japi_context *ctx, const char *req_name, bool coalesce);
+
+/*!
+ * \brief Drop cached responses
+ *
+ * To be called when the data behind a cached request changed.
+ *
+ * \param ctx		JAPI context
+ * \param req_name	Name of the request or NULL to drop all cached responses
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context is
+ * returned.
+ */
+int japi_cache_invalidate(japi_context *ctx, const char *req_name);
+
+/*!
+ * \brief Set the priority class of a request
+ *
+ * Requests with high priority, like an emergency stop, are answered before all
+ * normal requests read in the same iteration of the server loop, so they don't
+ * wait behind bulk requests of other clients. Each client is still answered in
+ * the order of its requests: a high priority request waits for normal requests
+ * of the same client read before it. As long as no request has a high
+ * priority, requests are answered in order of arrival without any queueing.
+ *
+ * \param ctx		JAPI context
+ * \param req_name	Name of a registered request
+ * \param priority	Priority class
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context,
+ * -2 for empty request name, -3 if the request is not registered and -4 for an
+ * invalid priority is returned.
+ */
+int japi_set_request_priority(japi_context *ctx, const char *req_name,
+							  japi_priority priority);
+
+/*!
+ * \brief Limit the request rate of each client
+ *
+ * Every client may send burst requests at once and rate requests per second
+ * on average (token bucket). Requests beyond the limit are not passed to the
+ * handler but answered with the error "rate limit exceeded" and the time in
+ * retry_after_ms after which the next request is accepted.
+ *
+ * \param ctx	JAPI context
+ * \param rate	Requests per second, 0 disables the limit
+ * \param burst	Requests allowed at once
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context and
+ * -2 for a negative rate or a burst below 1 is returned.
+ */
+int japi_set_client_rate_limit(japi_context *ctx, double rate, unsigned int burst);
+
+/*!
+ * \brief Limit the rate of a request
+ *
+ * Like japi_set_client_rate_limit(), but the limit applies to the calls of a
+ * request by all clients together, e.g. to protect expensive handlers.
+ *
+ * \param ctx		JAPI context
+ * \param req_name	Name of a registered request
+ * \param rate		Requests per second, 0 disables the limit
+ * \param burst		Requests allowed at once
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context,
+ * -2 for empty request name, -3 if the request is not registered and -4 for a
+ * negative rate or a burst below 1 is returned.
+ */
+int japi_set_request_rate_limit(japi_context *ctx, const char *req_name, double rate,
+								unsigned int burst);
+
+/*!
+ * \brief Call a request handler in-process
+ *
+ * Dispatches a request directly to the registered handler, without a socket
+ * and without serializing the request and response to JSON text. Allows
+ * plugins in the same process and tests to reuse the handlers at the cost of
+ * a function call. Unlike requests received from clients, unknown requests
+ * are not passed to the fallback handler.
+ *
+ * \param ctx		JAPI context
+ * \param req_name	Request name
+ * \param args		Request arguments or NULL
+ * \param response	JSON object the handler adds its response data to
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context,
+ * -2 for empty request name or response object and -3 if no handler is
+ * registered for the request is returned.
+ */
+int japi_call(japi_context *ctx, const char *req_name, json_object *args,
+			  json_object *response);
+
 /*!
  * \brief Start a JAPI server
  *
- * Start a JAPI server on the given port.
+ * Start a JAPI server on the given port. Clients are accepted on the TCP port
+ * and on all listeners added by japi_add_tcp_listener() and
+ * japi_add_unix_listener() in the same loop.
  *
  * \param ctx	JAPI context
- * \param port	Port to be used by the JAPI server
+ * \param port	Port to be used by the JAPI server or NULL to use the added
+ * listeners only
  *
  * \returns	Only returns in case of an error.
  */
 int japi_start_server(japi_context *ctx, const char *port);
 
+/*!
+ * \brief Get the file descriptor to watch for JAPI events
+ *
+ * Instead of running japi_start_server(), the sockets of a JAPI context can be
+ * served from the application's own event loop (epoll, libuv, GLib, ...). The
+ * returned descriptor becomes readable when there are events to process; then
+ * japi_process_events() is to be called. Listeners added before the first call
+ * start listening. Not to be combined with japi_start_server().
+ *
+ * Only supported on Linux.
+ *
+ * \param ctx	JAPI context
+ *
+ * \returns	On success, the file descriptor is returned. On error, -1 for empty
+ * JAPI context, -2 if not supported on this platform and -3 if the listeners or
+ * the epoll instance couldn't be set up is returned.
+ */
+int japi_get_fd(japi_context *ctx);
+
+/*!
+ * \brief Get the time until japi_process_events() should be called again
+ *
+ * Pending push messages and idle timeouts have to be handled even if the file
+ * descriptor of japi_get_fd() doesn't become readable. The application's loop
+ * should wait no longer than the returned time.
+ *
+ * \param ctx	JAPI context
+ *
+ * \returns	On success, the timeout in milliseconds is returned. On error, -1 for
+ * empty JAPI context is returned.
+ */
+int japi_get_timeout(japi_context *ctx);
+
+/*!
+ * \brief Process pending JAPI events
+ *
+ * Accepts new clients, answers requests, delivers pending push messages and
+ * disconnects idle clients, like a single iteration of japi_start_server().
+ *
+ * Only supported on Linux.
+ *
+ * \param ctx		JAPI context
+ * \param timeout_ms	Time in milliseconds to wait for events. 0 returns
+ * immediately, -1 waits until an event arrives.
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context, -2
+ * if not supported on this platform, -3 if the listeners or the epoll instance
+ * couldn't be set up and -4 if waiting for events failed is returned.
+ */
+int japi_process_events(japi_context *ctx, int timeout_ms);
+
+/*!
+ * \brief Accept clients on a Unix domain socket
+ *
+ * Bind a Unix domain socket the JAPI server accepts clients on in addition to
+ * its TCP port. Local clients thereby avoid the TCP/IP stack. On Linux, a path
+ * starting with '@' selects the abstract namespace, which has no file system
+ * entry. A socket file is removed again by japi_destroy().
+ *
+ * \param ctx	JAPI context
+ * \param path	Path of the Unix domain socket
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context, -2
+ * for empty path, -3 if the socket couldn't be bound and -4 for failed memory
+ * allocation is returned.
+ */
+int japi_add_unix_listener(japi_context *ctx, const char *path);
+
+/*!
+ * \brief Accept clients on an additional TCP address
+ *
+ * Bind a TCP socket the JAPI server accepts clients on in addition to its
+ * port. Several endpoints, e.g. IPv4, IPv6 and a loopback-only admin port, are
+ * thereby served by one server loop.
+ *
+ * \param ctx	JAPI context
+ * \param host	Address to listen on, e.g. "127.0.0.1" or "::1". NULL for all
+ * addresses.
+ * \param port	Port to listen on
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context, -2
+ * for empty port, -3 if the socket couldn't be bound and -4 for failed memory
+ * allocation is returned.
+ */
+int japi_add_tcp_listener(japi_context *ctx, const char *host, const char *port);
+
+/*!
+ * \brief Set the listen backlog of the JAPI server
+ *
+ * Set the number of pending connections the kernel queues for each server
+ * socket until they are accepted. A larger backlog avoids dropped connection
+ * attempts when many clients reconnect at once. Defaults to SOMAXCONN. Must be
+ * called before japi_start_server().
+ *
+ * \param ctx		JAPI context
+ * \param backlog	Number of pending connections
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context and
+ * -2 for a backlog smaller than 1 is returned.
+ */
+int japi_set_listen_backlog(japi_context *ctx, int backlog);
+
+/*!
+ * \brief Set options of accepted client sockets
+ *
+ * The options are applied to every client socket accepted by
+ * japi_start_server(). TCP options are skipped for Unix domain sockets, and
+ * options not supported by the platform are ignored. An option that can't be
+ * set is reported, but the client is accepted anyway.
+ *
+ * \param ctx	JAPI context
+ * \param opts	Socket options
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context or
+ * options and -2 for negative values is returned.
+ */
+int japi_set_socket_options(japi_context *ctx, const japi_socket_options *opts);
+
+/*!
+ * \brief Select the event notification mechanism of the server loop
+ *
+ * select() is portable, but rebuilds its descriptor set on every iteration and
+ * can't handle descriptors beyond FD_SETSIZE. The epoll backend registers
+ * clients once and scales to many connections. The io_uring backend (Linux 6.0
+ * and newer) additionally batches receiving and sending, so an iteration
+ * needs a single system call. Must be called before japi_start_server().
+ *
+ * \param ctx		JAPI context
+ * \param backend	Event notification mechanism
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context and
+ * -2 for a backend not supported on this platform is returned.
+ */
+int japi_set_backend(japi_context *ctx, japi_backend backend);
+
+/*!
+ * \brief Set the idle timeout of clients
+ *
+ * Clients that sent no data within the timeout are disconnected, so abandoned
+ * connections don't hold slots under the maximal number of allowed clients.
+ * Clients that only receive push messages have to send requests regularly to
+ * stay connected.
+ *
+ * \param ctx		JAPI context
+ * \param timeout_ms	Idle timeout in milliseconds. 0 disables the timeout.
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context is
+ * returned.
+ */
+int japi_set_idle_timeout(japi_context *ctx, unsigned int timeout_ms);
+
+/*!
+ * \brief Set the timeout for completing a request line
+ *
+ * A client that doesn't complete a request line within the timeout is
+ * disconnected, so slow or stalled clients can't hold the memory of an
+ * incomplete line. The timeout starts with the first byte of the line.
+ *
+ * \param ctx		JAPI context
+ * \param timeout_ms	Request timeout in milliseconds. 0 disables the timeout.
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context is
+ * returned.
+ */
+int japi_set_request_timeout(japi_context *ctx, unsigned int timeout_ms);
+
+/*!
+ * \brief Set the number of request lines served per client and iteration
+ *
+ * By default all buffered request lines of a client are answered before the
+ * next client is served, so a client pipelining many requests delays all
+ * others. With a budget, the server moves on to the next client after the
+ * given number of lines and resumes the remaining lines in the next server
+ * loop iteration.
+ *
+ * \param ctx		JAPI context
+ * \param lines	Request lines per client and iteration. 0 disables the budget.
+ *
+ * \returns	On success, zero is returned. On error, -1 for empty JAPI context is
+ * returned.
+ */
+int japi_set_client_budget(japi_context *ctx, unsigned int lines);
+
 /*!
  * \brief Set the number of allowed clients
  *
- * Set the maximal number of allowed clients.
+ * Set the maximal number of allowed clients. Further clients receive the line
+ * {"error": "too many clients"} and are disconnected, so they can back off
+ * before reconnecting.
  *
  * \param ctx	JAPI context
  * \param num	Number of clients to be allowed. 0 stands for unlimited.
@@ -36,6 +36,7 @@
 
 #include <json-c/json.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #include "japi.h"
@@ -44,6 +45,11 @@
 extern "C" {
 #endif
 
+/*! Number of worker threads executing periodic push service callbacks */
+#ifndef JAPI_PUSHSRV_WORKERS
+#define JAPI_PUSHSRV_WORKERS 2
+#endif
+
 struct __japi_pushsrv_context; /* Tell routine there is a struct to be defined */
 
 /*!
@@ -51,6 +57,41 @@ struct __japi_pushsrv_context; /* Tell routine there is a struct to be defined *
  */
 typedef void (*japi_pushsrv_routine)(struct __japi_pushsrv_context *psc);
 
+/*!
+ * \brief JAPI push service snapshot callback.
+ *
+ * Fills jdata with the current state of the push service for a new subscriber.
+ * Returns 0 to send jdata, any other value to send nothing.
+ */
+typedef int (*japi_pushsrv_snapshot)(struct __japi_pushsrv_context *psc,
+									 json_object *jdata);
+
+/*!
+ * \brief JAPI push service subscriber
+ *
+ * Stores a client subscribed to a push service.
+ */
+typedef struct __japi_pushsrv_client {
+	int socket; /*!< Socket of the subscribed client */
+	char *pending; /*!< Conflated message that couldn't be sent yet or NULL */
+	unsigned int decimation; /*!< Deliver only every n-th message */
+	unsigned int decimation_count; /*!< Messages since the last delivered one */
+	uint64_t min_interval_us; /*!< Minimal time between two messages or 0 */
+	uint64_t last_sent_us; /*!< Time of the last delivered message */
+	char *filter_key; /*!< Canonical form of filter and fields or NULL */
+	json_object *filter; /*!< Required values of message fields or NULL */
+	json_object *fields; /*!< Message fields to deliver or NULL */
+	uint64_t last_seq; /*!< Sequence number of the last delivered message */
+	char *outbox; /*!< Coalesced messages not yet sent */
+	size_t outbox_len; /*!< Length of the coalesced messages */
+	size_t outbox_size; /*!< Allocated size of outbox */
+	uint64_t outbox_since_us; /*!< Time the first coalesced message was queued */
+	struct __japi_shm_producer *shm; /*!< Shared memory ring messages are written to or NULL */
+	bool by_name; /*!< Subscribed by the exact push service name */
+	unsigned int patterns; /*!< Number of wildcard subscriptions covering the subscriber */
+	struct __japi_pushsrv_client *next; /*!< Pointer to the next subscriber or NULL */
+} japi_pushsrv_client;
+
 /*!
  * \brief JAPI push service context
  *
@@ -62,10 +103,33 @@ typedef struct __japi_pushsrv_context {
 	pthread_t thread_id; /*!< ID of the thread */
 	japi_pushsrv_routine routine; /*!< Function to call */
 	volatile bool enabled; /*!< Flag to end routine */
+	bool joinable; /*!< Thread was started and not yet joined */
 	pthread_mutex_t lock; /*!< Mutual access lock */
-	struct __japi_client *clients; /*!< Pointer to the JAPI client context */
+	pthread_mutex_t wait_lock; /*!< Lock for wait_cond */
+	pthread_cond_t wait_cond; /*!< Signalled when the push service is stopped */
+	japi_pushsrv_client *clients; /*!< Pointer to the subscribed clients */
+	bool conflate; /*!< Replace unsent messages instead of blocking */
+	uint64_t seq; /*!< Sequence number of the last sent message */
+	struct __japi_pushsrv_replay *replay; /*!< Ring of recently sent messages or NULL */
+	unsigned int replay_size; /*!< Number of messages kept in the replay ring */
+	japi_pushsrv_snapshot snapshot; /*!< Snapshot callback for new subscribers or NULL */
+	struct __japi_pushsrv_replay *last_msg; /*!< Last sent message, if it is cached */
+	unsigned int delta_interval; /*!< Messages per keyframe in delta mode, 0 otherwise */
+	unsigned int delta_count; /*!< Delta messages since the last keyframe */
+	json_object *delta_prev; /*!< Copy of the previous message data in delta mode */
+	unsigned int coalesce_us; /*!< Coalescing window for messages, 0 otherwise */
 	struct __japi_pushsrv_context *next; /*!< Pointer to the next push service or NULL */
+	struct __japi_pushsrv_context *index_next; /*!< Next push service in hash bucket */
+	unsigned long index_hash; /*!< Hash of the case-folded push service name */
+	struct __japi_pushsrv_context *trie_next; /*!< Next push service of the same name trie node */
 	void *userptr; /*!< Pointer to user data */
+	japi_context *ctx; /*!< JAPI context the push service is registered to */
+	unsigned int interval_ms; /*!< Period of a periodic push service, 0 otherwise */
+	uint64_t sched_deadline; /*!< Next due time of a periodic push service in ms */
+	size_t sched_pos; /*!< Position in the scheduler heap */
+	bool sched_queued; /*!< Periodic callback is waiting for a worker */
+	bool sched_running; /*!< Periodic callback is executed by a worker */
+	struct __japi_pushsrv_context *sched_next; /*!< Next entry in the worker queue */
 } japi_pushsrv_context;
 
 /*!
@@ -107,6 +171,101 @@ int japi_pushsrv_destroy(japi_context *ctx, japi_pushsrv_context *psc);
  */
 int japi_pushsrv_sendmsg(japi_pushsrv_context *psc, json_object *jmsg);
 
+/*!
+ * \brief Enable latest-value mode of a push service
+ *
+ * In latest-value (conflated) mode, japi_pushsrv_sendmsg() doesn't block on
+ * subscribers that can't receive a message at the moment. Instead, the message
+ * is kept for the subscriber and replaced by any newer message sent before it
+ * could be delivered. A slow subscriber thereby always receives the newest
+ * message at its own pace and at most one message per subscriber is buffered.
+ * Pending messages are delivered by the server loop.
+ *
+ * \param psc		JAPI push service context
+ * \param conflate	Enable latest-value mode
+ *
+ * \returns	On success, 0 is returned. On error, -1 is returned.
+ */
+int japi_pushsrv_set_conflate(japi_pushsrv_context *psc, bool conflate);
+
+/*!
+ * \brief Keep recent messages of a push service for reconnecting clients
+ *
+ * Every push message carries a sequence number in "japi_pushsrv_seq". With a
+ * replay ring, the last 'size' serialized messages are kept, and a client
+ * subscribing with "since_seq" receives the messages it missed before any new
+ * message. Changing the size discards the kept messages.
+ *
+ * \param psc		JAPI push service context
+ * \param size		Number of messages to keep, 0 to disable the replay ring
+ *
+ * \returns	On success, 0 is returned. On error, -1 is returned if psc is NULL
+ * and -2 if memory allocation failed.
+ */
+int japi_pushsrv_set_replay(japi_pushsrv_context *psc, unsigned int size);
+
+/*!
+ * \brief Send the current state to new subscribers
+ *
+ * The snapshot callback is called on every subscription and the data it
+ * provides is sent to the new subscriber before any new message. The callback
+ * is called with the push service locked, so it must not call
+ * japi_pushsrv_sendmsg() for the same push service.
+ *
+ * \param psc		JAPI push service context
+ * \param snapshot	Snapshot callback, NULL to disable
+ *
+ * \returns	On success, 0 is returned. On error, -1 is returned.
+ */
+int japi_pushsrv_set_snapshot(japi_pushsrv_context *psc, japi_pushsrv_snapshot snapshot);
+
+/*!
+ * \brief Send the last message to new subscribers
+ *
+ * Keep the last message sent by japi_pushsrv_sendmsg() and send it to every
+ * new subscriber. A snapshot callback set by japi_pushsrv_set_snapshot() takes
+ * precedence.
+ *
+ * \param psc		JAPI push service context
+ * \param enable	Keep and send the last message
+ *
+ * \returns	On success, 0 is returned. On error, -1 is returned if psc is NULL
+ * and -2 if memory allocation failed.
+ */
+int japi_pushsrv_set_snapshot_cache(japi_pushsrv_context *psc, bool enable);
+
+/*!
+ * \brief Send changes against the previous message instead of full messages
+ *
+ * In delta mode, a subscriber that received the previous message gets a JSON
+ * merge patch (RFC 7396) in "delta" instead of the full message in "data".
+ * Every keyframe_interval-th message is sent in full to all subscribers.
+ * Subscribers with a filter and push services in latest-value mode always get
+ * full messages.
+ *
+ * \param psc		JAPI push service context
+ * \param keyframe_interval	Send every n-th message in full, 0 to disable delta mode
+ *
+ * \returns	On success, 0 is returned. On error, -1 is returned.
+ */
+int japi_pushsrv_set_delta(japi_pushsrv_context *psc, unsigned int keyframe_interval);
+
+/*!
+ * \brief Coalesce push messages into fewer writes
+ *
+ * Messages sent within window_us microseconds after the first unsent message
+ * of a subscriber are collected and written to the subscriber at once. The
+ * collected messages are sent by the first japi_pushsrv_sendmsg() after the
+ * window has passed, or by the server loop. Not used in latest-value mode.
+ *
+ * \param psc		JAPI push service context
+ * \param window_us	Coalescing window in microseconds, 0 to send every message
+ * immediately
+ *
+ * \returns	On success, 0 is returned. On error, -1 is returned.
+ */
+int japi_pushsrv_set_coalesce(japi_pushsrv_context *psc, unsigned int window_us);
+
 /*!
  * \brief Start push service routine
  *
@@ -119,10 +278,53 @@ int japi_pushsrv_sendmsg(japi_pushsrv_context *psc, json_object *jmsg);
  */
 int japi_pushsrv_start(japi_pushsrv_context *psc, japi_pushsrv_routine routine);
 
+/*!
+ * \brief Start periodic push service callback
+ *
+ * Call the push service callback every interval_ms milliseconds. Instead of
+ * creating a thread per push service, all periodic push services of a JAPI
+ * context share a single scheduler thread and a small pool of
+ * JAPI_PUSHSRV_WORKERS worker threads. The callback is expected to return after
+ * sending a message and must not block. A callback that is still running when
+ * it is due again skips that period.
+ *
+ * \param psc		JAPI push service context
+ * \param interval_ms	Period in milliseconds
+ * \param callback	Push service callback
+ *
+ * \returns	On success, 0 is returned. On error, -1 is returned if psc is NULL,
+ * -2 if callback is NULL or interval_ms is 0, -3 if the scheduler can't be started
+ * and -4 if the push service is already running.
+ */
+int japi_pushsrv_start_periodic(japi_pushsrv_context *psc, unsigned int interval_ms,
+								japi_pushsrv_routine callback);
+
+/*!
+ * \brief Wait within a push service routine
+ *
+ * Sleep for timeout_ms milliseconds or until the push service is stopped,
+ * whatever happens first. Push service routines should use it instead of
+ * sleep() so that japi_pushsrv_stop() doesn't have to wait for the sleep to end:
+ * \code
+ * while (japi_pushsrv_wait(psc, 1000)) {
+ *	japi_pushsrv_sendmsg(psc, jmsg);
+ * }
+ * \endcode
+ *
+ * \param psc		JAPI push service context
+ * \param timeout_ms	Maximal time to wait in milliseconds
+ *
+ * \returns	true if the push service is still enabled, false if it was stopped
+ * or psc is NULL.
+ */
+bool japi_pushsrv_wait(japi_pushsrv_context *psc, unsigned int timeout_ms);
+
 /*!
  * \brief Stop push service routine
  *
- * Wait for thread to end and close it.
+ * Wait for thread to end and close it. For a periodic push service the callback
+ * is unscheduled and a running callback is waited for. Must not be called from
+ * within the periodic callback itself.
  *
  * \param psc	JAPI push service context
  *
@@ -0,0 +1,165 @@
+/*!
+ * \file
+ * \date 2026-10-18
+ * \version 0.1
+ *
+ * \brief Shared memory transport for push messages.
+ *
+ * \details
+ * Push messages for subscribers on the same host can be written to a ring
+ * buffer in shared memory instead of the socket. The subscriber receives the
+ * file descriptor of the ring over its Unix domain socket and reads the
+ * messages from its own mapping.
+ *
+ *\copyright
+ * Copyright (c) 2023 Fraunhofer IIS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __JAPI_SHM_H__
+#define __JAPI_SHM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * \brief Magic number at the start of a shared memory ring ("JAPI")
+ */
+#define JAPI_SHM_MAGIC 0x4a415049
+
+/*!
+ * \brief Minimal data size of a shared memory ring in bytes
+ */
+#define JAPI_SHM_MIN_SIZE 4096
+
+/*!
+ * \brief Maximal data size of a shared memory ring in bytes
+ */
+#define JAPI_SHM_MAX_SIZE (1UL << 30)
+
+/*!
+ * \brief Header of a shared memory ring.
+ *
+ * The data area follows the header at data_offset. Each message is stored as
+ * a 32 bit length in host byte order followed by the serialized message
+ * including the terminating newline, wrapping around at the end of the data
+ * area. head and tail count the bytes written and read since creation; the
+ * producer only writes head and the consumer only writes tail. Producer and
+ * consumer positions are kept on separate cache lines.
+ */
+typedef struct __japi_shm_ring {
+	uint32_t magic; /*!< JAPI_SHM_MAGIC */
+	uint32_t data_offset; /*!< Offset of the data area from the start of the header */
+	uint64_t size; /*!< Size of the data area in bytes, a power of two */
+	uint64_t dropped; /*!< Number of messages dropped because the ring was full */
+	char pad0[40];
+	uint64_t head; /*!< Bytes written by the producer */
+	char pad1[56];
+	uint64_t tail; /*!< Bytes read by the consumer */
+	char pad2[56];
+} japi_shm_ring;
+
+/*!
+ * \brief Producer side of a shared memory ring.
+ *
+ * The consumer maps the ring writable, so the producer keeps the layout and its
+ * own position in private memory and never reads them back from the header.
+ */
+typedef struct __japi_shm_producer {
+	japi_shm_ring *ring; /*!< Mapped ring */
+	char *data; /*!< Start of the data area */
+	uint64_t size; /*!< Size of the data area in bytes, a power of two */
+	uint64_t head; /*!< Bytes written */
+	size_t map_size; /*!< Size of the mapping in bytes */
+} japi_shm_producer;
+
+/*!
+ * \brief Create a shared memory ring
+ *
+ * \param size	Size of the data area in bytes, rounded up to a power of two
+ * \param fd	Returns the file descriptor of the shared memory
+ *
+ * \returns	On success, the producer side of the ring is returned. On error,
+ * NULL is returned.
+ */
+japi_shm_producer *japi_shm_create(size_t size, int *fd);
+
+/*!
+ * \brief Unmap a shared memory ring created with japi_shm_create() and free
+ * the producer
+ *
+ * \param shm	Producer side of the ring
+ */
+void japi_shm_destroy(japi_shm_producer *shm);
+
+/*!
+ * \brief Map a shared memory ring received from the server
+ *
+ * \param fd	File descriptor of the shared memory
+ *
+ * \returns	On success, the mapped ring is returned. On error, NULL is returned.
+ */
+japi_shm_ring *japi_shm_attach(int fd);
+
+/*!
+ * \brief Unmap a shared memory ring mapped with japi_shm_attach()
+ *
+ * \param ring	Shared memory ring
+ */
+void japi_shm_detach(japi_shm_ring *ring);
+
+/*!
+ * \brief Write a message to a shared memory ring
+ *
+ * Must only be called by a single producer. A message that doesn't fit into
+ * the free space is dropped and counted. The tail written by the consumer is
+ * not trusted; if it is out of range, all messages are dropped.
+ *
+ * \param shm	Producer side of the ring
+ * \param msg	Message
+ * \param len	Length of the message
+ *
+ * \returns	1 if the message was written, 0 if it was dropped.
+ */
+int japi_shm_write(japi_shm_producer *shm, const char *msg, size_t len);
+
+/*!
+ * \brief Read the next message from a shared memory ring
+ *
+ * Must only be called by a single consumer.
+ *
+ * \param ring	Shared memory ring
+ * \param buf	Buffer for the message
+ * \param size	Size of the buffer
+ *
+ * \returns	The length of the message, or 0 if the ring is empty. -1 if the
+ * buffer is too small, the message is kept then.
+ */
+int japi_shm_read(japi_shm_ring *ring, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __JAPI_SHM_H__ */
@@ -77,6 +77,36 @@ int tcp4_start_server(const char* port);
  */
 int tcp6_start_server(const char* port);
 
+/*!
+ * \brief Start a new TCP server on a given address.
+ *
+ * A new TCP server is started on a user specified address and port, e.g. to
+ * listen on the loopback interface only. An IPv6 address doesn't accept IPv4
+ * connections, so it can be combined with an IPv4 server on the same port.
+ *
+ * \param host Address or host name to listen on. NULL listens on all
+ *             addresses like tcp_start_server().
+ * \param port Port to listen on for incoming TCP connections.
+ *
+ * \returns On success, a file descriptor for the new socket is returned. On
+ *          error, -1 is returned and errno ist set appropriately.
+ */
+int tcp_start_server_on_host(const char* host, const char* port);
+
+/*!
+ * \brief Start a new Unix domain socket server.
+ *
+ * A new stream socket is created and bound to a Unix domain socket path. A
+ * stale socket file at the path is removed. On Linux, a path starting with
+ * '@' binds to the abstract namespace instead, without a file system entry.
+ *
+ * \param path Path of the Unix domain socket.
+ *
+ * \returns On success, a file descriptor for the new socket is returned. On
+ *          error, -1 is returned and errno ist set appropriately.
+ */
+int unix_start_server(const char* path);
+
 #ifdef __cplusplus
 }
 #endif
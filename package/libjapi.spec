@@ -37,7 +37,7 @@ install -d %{buildroot}/%{_libdir}/libjapi/
 install -d %{buildroot}/%{_docdir}/libjapi/
 install -d %{buildroot}/%{_includedir}/libjapi/
 cp -ra %{_builddir}/libjapi/build/*.so %{buildroot}/%{_libdir}/
-cp -ra %{_builddir}/libjapi/build/*.so.1 %{buildroot}/%{_libdir}/
+cp -ra %{_builddir}/libjapi/build/*.so.2 %{buildroot}/%{_libdir}/
 cp -ra %{_builddir}/libjapi/build/doc/ %{buildroot}/%{_docdir}/libjapi/
 cp -ra %{_builddir}/libjapi/README.md %{buildroot}/%{_docdir}/libjapi/
 cp -ra %{_builddir}/libjapi/include/* %{buildroot}/%{_includedir}/libjapi/
@@ -47,7 +47,7 @@ cp -ra %{_builddir}/libjapi/include/* %{buildroot}/%{_includedir}/libjapi/
 
 %files
 %{_libdir}/libjapi.so
-%{_libdir}/libjapi.so.1
+%{_libdir}/libjapi.so.2
 %{_includedir}/libjapi
 
 %changelog
@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include "creadline.h"
 
@@ -191,6 +192,97 @@ error_ret:
 	return -1;
 }
 
+int creadline_nb_r(int fd, void **dst, creadline_nbuf_t *buffer)
+{
+	char *linebuf;
+	char *nl;
+	size_t scanned;
+	int readret;
+	int nl_pos;
+
+	*dst = NULL;
+
+	/* Check if the buffer already contains a newline character */
+	nl = (buffer->nbytes > 0) ? memchr(buffer->buf, '\n', buffer->nbytes) : NULL;
+
+	while (nl == NULL) {
+
+		scanned = buffer->nbytes;
+
+		/* Grow the buffer like creadline_r() grows its line buffer */
+		if (buffer->nbytes + CREADLINE_BLOCK_SIZE > buffer->size) {
+
+			char* new_buf = NULL;
+			size_t new_size = (buffer->size > 0) ? 2*buffer->size : CREADLINE_BLOCK_SIZE;
+
+			if (new_size > __MAX_LINEBUF_SIZE__) {
+				fprintf(stderr, "ERROR: Maximum line size of %i bytes exceeded!\n", __MAX_LINEBUF_SIZE__);
+				return -1;
+			}
+
+			new_buf = realloc(buffer->buf, new_size);
+			if (new_buf == NULL) {
+				perror("realloc() failed");
+				return -1;
+			}
+			buffer->buf = new_buf;
+			buffer->size = new_size;
+		}
+
+		/* Read the bytes available right now... */
+		readret = recv(fd, buffer->buf+buffer->nbytes, CREADLINE_BLOCK_SIZE, MSG_DONTWAIT);
+		if (readret < 0) {
+
+			if (errno == EINTR) { /* EINTR is not an error */
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) { /* Rest of the line is missing */
+				return -2;
+			}
+
+			perror("recv() failed");
+			return -1;
+
+		} else if (readret == 0) { /* EOF */
+
+			if (buffer->nbytes == 0) {
+				return 0;
+			}
+
+			fprintf(stderr, "ERROR: Received EOF while line buffer is not empty\n");
+			return -1;
+		}
+
+		buffer->nbytes += readret;
+		nl = memchr(buffer->buf+scanned, '\n', readret);
+	}
+
+	/* Found newline character */
+	nl_pos = nl - buffer->buf;
+
+	linebuf = malloc(nl_pos + 1);
+	if (linebuf == NULL) {
+		perror("malloc() failed");
+		return -1;
+	}
+	memcpy(linebuf, buffer->buf, nl_pos);
+
+	/* Keep the characters located after the newline */
+	buffer->nbytes -= nl_pos + 1;
+	memmove(buffer->buf, nl + 1, buffer->nbytes);
+
+	/* Ignore '\r' before '\n' to handle also "\r\n" sequences */
+	if ( (nl_pos > 0) && (linebuf[nl_pos-1] == '\r') ) {
+		nl_pos--;
+	}
+	linebuf[nl_pos] = '\0';
+
+	/* Set dst pointer and return string length */
+	*dst = linebuf;
+	return nl_pos;
+}
+
 int creadline(int fd, void **dst)
 {
 	static int fd_last = -1;
@@ -31,14 +31,27 @@
  * THE SOFTWARE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* accept4() */
+#endif
+
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h> /* strcmp */
 #include <strings.h> /* strcasecmp */
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include <unistd.h>
 
 #include "japi.h"
@@ -47,16 +60,157 @@
 #include "japi_intern.h"
 #include "japi_pushsrv.h"
 #include "japi_pushsrv_intern.h"
+#include "japi_uring.h"
 #include "japi_utils.h"
 #include "networking.h"
 #include "prntdbg.h"
 #include "rw_n.h"
 
-/* Look for a request handler matching the name 'name'.
+/* Select timeout in microseconds while push messages are pending */
+#define JAPI_PUSHSRV_FLUSH_INTERVAL_US 10000
+
+/* Time in microseconds accepting pauses after running out of descriptors */
+#define JAPI_ACCEPT_BACKOFF_US 100000
+
+/* Time in microseconds the io_uring loop sends queued responses when stopping */
+#define JAPI_URING_FLUSH_TIMEOUT_US 1000000
+
+/* Current time of the monotonic clock in microseconds */
+static uint64_t japi_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+#ifdef __linux__
+/* Register a client at the epoll instance of the running server */
+static void japi_epoll_add(japi_context *ctx, japi_client *client)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = client;
+	if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, client->socket, &ev) != 0) {
+		fprintf(stderr, "ERROR: Failed to register client %i at epoll\n",
+				client->socket);
+	}
+}
+
+/* Add (EPOLL_CTL_ADD) or remove (EPOLL_CTL_DEL) the server sockets at the epoll
+ * instance */
+static int japi_epoll_servers(japi_context *ctx, int server_socket, int op)
+{
+	struct epoll_event ev;
+	japi_listener *listener;
+
+	/* Server sockets are registered without client pointer */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (server_socket >= 0 && epoll_ctl(ctx->epoll_fd, op, server_socket, &ev) != 0) {
+		perror("ERROR: epoll_ctl() failed\n");
+		return -1;
+	}
+	for (listener = ctx->listeners; listener != NULL; listener = listener->next) {
+		if (epoll_ctl(ctx->epoll_fd, op, listener->socket, &ev) != 0) {
+			perror("ERROR: epoll_ctl() failed\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+/* Unlink a client from the idle timeout queue. Called with ctx->lock held. */
+static void japi_idle_unlink(japi_context *ctx, japi_client *client)
+{
+	if (client->idle_prev != NULL) {
+		client->idle_prev->idle_next = client->idle_next;
+	} else {
+		ctx->idle_head = client->idle_next;
+	}
+	if (client->idle_next != NULL) {
+		client->idle_next->idle_prev = client->idle_prev;
+	} else {
+		ctx->idle_tail = client->idle_prev;
+	}
+	client->idle_prev = NULL;
+	client->idle_next = NULL;
+	client->ready = false;
+}
+
+/* Mark a client as active by moving it to the end of the idle timeout queue.
+ * All clients share the same timeout, so the queue stays ordered by deadline.
+ * Called with ctx->lock held. */
+static void japi_idle_touch(japi_context *ctx, japi_client *client)
+{
+	if (ctx->idle_tail != client) {
+		if (client->idle_prev != NULL || ctx->idle_head == client) {
+			japi_idle_unlink(ctx, client);
+		}
+		client->idle_prev = ctx->idle_tail;
+		client->idle_next = NULL;
+		if (ctx->idle_tail != NULL) {
+			ctx->idle_tail->idle_next = client;
+		} else {
+			ctx->idle_head = client;
+		}
+		ctx->idle_tail = client;
+	}
+	client->last_active_us = japi_now_us();
+}
+
+/* Track the start of an incomplete request line by appending the client to the
+ * request timeout queue. Like the idle timeout queue, the queue stays ordered by
+ * deadline. Called with ctx->lock held. */
+static void japi_line_start(japi_context *ctx, japi_client *client)
+{
+	if (client->line_start_us != 0) {
+		return;
+	}
+	client->line_prev = ctx->line_tail;
+	client->line_next = NULL;
+	if (ctx->line_tail != NULL) {
+		ctx->line_tail->line_next = client;
+	} else {
+		ctx->line_head = client;
+	}
+	ctx->line_tail = client;
+	client->line_start_us = japi_now_us();
+}
+
+/* Unlink a client that completed its request line from the request timeout
+ * queue. Called with ctx->lock held. */
+static void japi_line_end(japi_context *ctx, japi_client *client)
+{
+	if (client->line_start_us == 0) {
+		return;
+	}
+	if (client->line_prev != NULL) {
+		client->line_prev->line_next = client->line_next;
+	} else {
+		ctx->line_head = client->line_next;
+	}
+	if (client->line_next != NULL) {
+		client->line_next->line_prev = client->line_prev;
+	} else {
+		ctx->line_tail = client->line_prev;
+	}
+	client->line_prev = NULL;
+	client->line_next = NULL;
+	client->line_start_us = 0;
+}
+
+/* Look for a request matching the name 'name'.
  *
- * NULL is returned if no suitable handler was found.
+ * NULL is returned if no such request was registered.
  */
-static japi_req_handler japi_get_request_handler(japi_context *ctx, const char *name)
+static japi_request *japi_get_request(japi_context *ctx, const char *name)
 {
 	japi_request *req;
 
@@ -64,7 +218,7 @@ static japi_req_handler japi_get_request_handler(japi_context *ctx, const char *
 	while (req != NULL) {
 
 		if (strcasecmp(name, req->name) == 0) {
-			return req->func;
+			return req;
 		}
 		req = req->next;
 	}
@@ -72,556 +226,2228 @@ static japi_req_handler japi_get_request_handler(japi_context *ctx, const char *
 	return NULL;
 }
 
-/* Steps performed while processing a JSON request:
- * - Convert the received message into a JSON object
- * - Extract the request name
- * - Search a suitable request handler
- * - Call the request handler
- * - Prepare the JSON response
- * - Free memory
+/* Look for a request handler matching the name 'name'.
+ *
+ * NULL is returned if no suitable handler was found.
  */
-int japi_process_message(japi_context *ctx, const char *request, char **response,
-						 int socket)
+static japi_req_handler japi_get_request_handler(japi_context *ctx, const char *name)
 {
-	const char *req_name;
-	json_object *jreq;
-	json_object *jreq_no;
-	json_object *jresp;
-	json_object *jresp_data;
-	json_object *jargs;
-	japi_req_handler req_handler;
-	int ret;
-	bool args;
+	japi_request *req;
 
-	assert(ctx != NULL);
-	assert(response != NULL);
-	assert(socket >= 0);
+	req = japi_get_request(ctx, name);
 
-	ret = -1;
-	*response = NULL;
+	return (req != NULL) ? req->func : NULL;
+}
 
-	/* Create JSON object from received message */
-	jreq = json_tokener_parse(request);
-	if (jreq == NULL) {
-		fprintf(stderr, "ERROR: json_tokener_parse() failed. Received message: %s\n",
-				request);
-		return -1;
-	}
+/* Number of hash buckets of the response cache */
+#define JAPI_CACHE_BUCKETS 64
+
+/* Cached response data of a request */
+typedef struct __japi_cache_entry {
+	japi_request *req; /* Request the response belongs to */
+	char *key; /* Canonical arguments */
+	unsigned long hash; /* Hash of request name and key */
+	json_object *data; /* Response data, only used with the cache lock held */
+	uint64_t expires_us; /* Time the entry becomes invalid or 0 if coalesced */
+	unsigned long generation; /* Server loop iteration of a coalesced response */
+	struct __japi_cache_entry *next;
+} japi_cache_entry;
+
+/* Cache key of the arguments of a request */
+static char *japi_cache_key(json_object *jargs)
+{
+	json_object *jcanon;
+	char *key;
 
-	/* Only create new JSON objects after a valid JSON request was parsed. */
-	jresp = json_object_new_object(); /* Response object */
-	jresp_data = json_object_new_object();
+	jcanon = japi_canonical(jargs);
+	key = strdup(json_object_to_json_string_ext(jcanon, JSON_C_TO_STRING_PLAIN));
+	json_object_put(jcanon);
 
-	if ((japi_get_value_as_str(jreq, "japi_request", &req_name)) == 0) {
+	return key;
+}
 
-		/* Prepare response */
-		json_object_object_add(jresp, "japi_response",
-							   json_object_new_string(req_name));
+/* Hash request name and cache key (djb2) */
+static unsigned long japi_cache_hash(const char *name, const char *key)
+{
+	unsigned long hash = 5381;
 
-		/* Include japi_request_no in response, if included with request */
-		if (json_object_object_get_ex(jreq, "japi_request_no", &jreq_no)) {
-			json_object_get(jreq_no);
-			json_object_object_add(jresp, "japi_request_no", jreq_no);
-		}
+	for (; *name != '\0'; name++) {
+		hash = hash * 33 + (unsigned char)tolower((unsigned char)*name);
+	}
+	for (; *key != '\0'; key++) {
+		hash = hash * 33 + (unsigned char)*key;
+	}
 
-		/* Get arguments as an JSON object */
-		args = json_object_object_get_ex(jreq, "args", &jargs);
+	return hash;
+}
 
-		/* Add an empty args JSON object if no args were given
-		   Otherwise, include args with response, if configured. */
-		if (!args) {
-			json_object_object_add(jreq, "args", NULL);
-			json_object_object_get_ex(jreq, "args", &jargs);
-		} else {
-			if (ctx->include_args_in_response) {
-				json_object_get(jargs);
-				json_object_object_add(jresp, "args", jargs);
-			}
-		}
+/* Check whether a cached response may still be served. Coalesced responses
+ * are only shared within the server loop iteration that created them and
+ * until a request that is neither cached nor coalesced is handled. */
+static bool japi_cache_valid(japi_context *ctx, japi_cache_entry *entry, uint64_t now)
+{
+	if (entry->expires_us == 0) {
+		return entry->generation == ctx->cache_generation;
+	}
 
-		/* Subscribe/unsubscribe service needs client socket */
-		if (strcasecmp(req_name, "japi_pushsrv_subscribe") == 0 ||
-			strcasecmp(req_name, "japi_pushsrv_unsubscribe") == 0) {
-			json_object_object_add(jargs, "socket", json_object_new_int(socket));
-		}
+	return entry->expires_us > now;
+}
 
-		/* Try to find a suitable handler for the given request */
-		req_handler = japi_get_request_handler(ctx, req_name);
-		if (req_handler == NULL) {
+static void japi_cache_free_entry(japi_cache_entry *entry)
+{
+	free(entry->key);
+	json_object_put(entry->data);
+	free(entry);
+}
 
-			/* No request handler found? Check if a fallback handler was registered. */
-			req_handler = japi_get_request_handler(ctx, "request_not_found_handler");
+/* Build the response from the cached data of a request. The data is added to
+ * the response object as last member and serialized like any other response.
+ * The data is shared between threads, so its reference is only taken and
+ * dropped with the cache lock held. Returns NULL if there is no valid entry. */
+static char *japi_cache_response(japi_context *ctx, japi_request *req, const char *key,
+								 json_object *jresp)
+{
+	japi_cache_entry *entry;
+	unsigned long hash;
+	char *response;
+	uint64_t now;
 
-			if (req_handler == NULL) {
-				fprintf(stderr,
-						"ERROR: No suitable request handler found. Falling back to "
-						"default fallback handler. Request was: %s\n",
-						req_name);
-				req_handler =
-					japi_get_request_handler(ctx, "japi_request_not_found_handler");
-			} else {
-				fprintf(stderr,
-						"WARNING: No suitable request handler found. Falling back to "
-						"user registered fallback handler. Request was: %s\n",
-						req_name);
-			}
-		}
+	if (ctx->cache == NULL) {
+		return NULL;
+	}
 
-		/* Call request handler */
-		req_handler(ctx, jargs, jresp_data);
+	hash = japi_cache_hash(req->name, key);
+	now = japi_now_us();
+	response = NULL;
 
-	} else {
-		/* Get request name */
-		if (req_name == NULL) {
-			fprintf(stderr, "ERROR: No keyword found!\n");
-			goto out_free;
+	pthread_mutex_lock(&(ctx->cache_lock));
+	for (entry = ctx->cache[hash % JAPI_CACHE_BUCKETS]; entry != NULL;
+		 entry = entry->next) {
+		if (entry->req == req && entry->hash == hash && strcmp(entry->key, key) == 0) {
+			break;
 		}
 	}
+	if (entry != NULL && japi_cache_valid(ctx, entry, now)) {
+		json_object_object_add(jresp, "data", json_object_get(entry->data));
+		response = japi_get_jobj_as_ndstr(jresp);
+		json_object_object_del(jresp, "data");
+	}
+	pthread_mutex_unlock(&(ctx->cache_lock));
 
-	/* Add response arguments */
-	json_object_object_add(jresp, "data", jresp_data);
-
-	/* Stringify response */
-	*response = japi_get_jobj_as_ndstr(jresp);
-	json_object_put(jresp);
+	return response;
+}
 
-	ret = 0;
+/* Store the response data of a request in the cache. Takes over the key and
+ * the last reference to the data. */
+static void japi_cache_store(japi_context *ctx, japi_request *req, char *key,
+							 json_object *jresp_data)
+{
+	japi_cache_entry *entry, **pentry;
+	unsigned long hash;
+	uint64_t now;
+
+	pthread_mutex_lock(&(ctx->cache_lock));
+	if (ctx->cache == NULL) {
+		ctx->cache = (japi_cache_entry **)calloc(JAPI_CACHE_BUCKETS,
+												 sizeof(japi_cache_entry *));
+		if (ctx->cache == NULL) {
+			pthread_mutex_unlock(&(ctx->cache_lock));
+			free(key);
+			json_object_put(jresp_data);
+			return;
+		}
+	}
 
-out_free:
-	/* Free JSON request object */
-	json_object_put(jreq);
+	hash = japi_cache_hash(req->name, key);
+	now = japi_now_us();
+
+	/* Drop the outdated entry and expired entries of the bucket */
+	pentry = &(ctx->cache[hash % JAPI_CACHE_BUCKETS]);
+	while (*pentry != NULL) {
+		entry = *pentry;
+		if (!japi_cache_valid(ctx, entry, now) ||
+			(entry->req == req && entry->hash == hash && strcmp(entry->key, key) == 0)) {
+			*pentry = entry->next;
+			japi_cache_free_entry(entry);
+		} else {
+			pentry = &(entry->next);
+		}
+	}
 
-	return ret;
+	entry = (japi_cache_entry *)malloc(sizeof(japi_cache_entry));
+	if (entry == NULL) {
+		free(key);
+		json_object_put(jresp_data);
+		pthread_mutex_unlock(&(ctx->cache_lock));
+		return;
+	}
+	entry->req = req;
+	entry->key = key;
+	entry->hash = hash;
+	entry->data = jresp_data;
+	entry->expires_us = 0;
+	entry->generation = ctx->cache_generation;
+	if (req->cache_ttl_ms > 0) {
+		entry->expires_us = now + (uint64_t)req->cache_ttl_ms * 1000;
+	}
+	entry->next = ctx->cache[hash % JAPI_CACHE_BUCKETS];
+	ctx->cache[hash % JAPI_CACHE_BUCKETS] = entry;
+	pthread_mutex_unlock(&(ctx->cache_lock));
 }
 
-int japi_shutdown(japi_context *ctx)
+int japi_cache_invalidate(japi_context *ctx, const char *req_name)
 {
+	japi_cache_entry *entry, **pentry;
+	japi_request *req;
+	size_t i;
+
 	if (ctx == NULL) {
 		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
 		return -1;
 	}
 
-	ctx->shutdown = true;
+	req = (req_name != NULL) ? japi_get_request(ctx, req_name) : NULL;
+	if (req_name != NULL && req == NULL) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&(ctx->cache_lock));
+	for (i = 0; ctx->cache != NULL && i < JAPI_CACHE_BUCKETS; i++) {
+		pentry = &(ctx->cache[i]);
+		while (*pentry != NULL) {
+			entry = *pentry;
+			if (req == NULL || entry->req == req) {
+				*pentry = entry->next;
+				japi_cache_free_entry(entry);
+			} else {
+				pentry = &(entry->next);
+			}
+		}
+	}
+	pthread_mutex_unlock(&(ctx->cache_lock));
 
 	return 0;
 }
 
-int japi_destroy(japi_context *ctx)
+int japi_set_request_coalesce(japi_context *ctx, const char *req_name, bool coalesce)
 {
-	japi_request *req, *req_next;
-	japi_pushsrv_context *psc, *psc_next;
+	japi_request *req;
 
 	if (ctx == NULL) {
 		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
 		return -1;
 	}
 
-	req = ctx->requests;
-	while (req != NULL) {
-		req_next = req->next;
-		free(req);
-		req = req_next;
+	if (req_name == NULL) {
+		fprintf(stderr, "ERROR: Request name is NULL.\n");
+		return -2;
 	}
 
-	psc = ctx->push_services;
-	while (psc != NULL) {
-		psc_next = psc->next;
-		japi_pushsrv_destroy(ctx, psc);
-		psc = psc_next;
+	req = japi_get_request(ctx, req_name);
+	if (req == NULL) {
+		fprintf(stderr, "ERROR: Request '%s' is not registered.\n", req_name);
+		return -3;
 	}
 
-	pthread_mutex_destroy(&(ctx->lock));
-	free(ctx);
+	req->coalesce = coalesce;
 
 	return 0;
 }
 
-int japi_register_request(japi_context *ctx, const char *req_name,
-						  japi_req_handler req_handler)
+int japi_set_request_priority(japi_context *ctx, const char *req_name,
+							  japi_priority priority)
 {
 	japi_request *req;
-	char *bad_req_name = "japi_";
 
-	/* Error handling */
 	if (ctx == NULL) {
 		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
 		return -1;
 	}
 
-	if ((req_name == NULL) || (strcmp(req_name, "") == 0)) {
-		fprintf(stderr, "ERROR: Request name is NULL or empty.\n");
+	if (req_name == NULL) {
+		fprintf(stderr, "ERROR: Request name is NULL.\n");
 		return -2;
 	}
 
-	if (req_handler == NULL) {
-		fprintf(stderr, "ERROR: Request handler is NULL.\n");
+	req = japi_get_request(ctx, req_name);
+	if (req == NULL) {
+		fprintf(stderr, "ERROR: Request '%s' is not registered.\n", req_name);
 		return -3;
 	}
 
-	if (japi_get_request_handler(ctx, req_name) != NULL) {
-		fprintf(stderr,
-				"ERROR: A request handler called '%s' was already registered.\n",
-				req_name);
+	if (priority != JAPI_PRIORITY_NORMAL && priority != JAPI_PRIORITY_HIGH) {
+		fprintf(stderr, "ERROR: Invalid priority %i.\n", (int)priority);
 		return -4;
 	}
 
-	if (ctx->init && strncmp(req_name, bad_req_name, strlen(bad_req_name)) == 0) {
-		fprintf(stderr, "ERROR: Request name is not allowed.\n");
-		return -6;
+	/* Requests are only queued while a request has high priority */
+	if (req->priority == JAPI_PRIORITY_HIGH) {
+		ctx->num_high_priority--;
 	}
+	if (priority == JAPI_PRIORITY_HIGH) {
+		ctx->num_high_priority++;
+	}
+	req->priority = priority;
 
-	req = (japi_request *)malloc(sizeof(japi_request));
-	if (req == NULL) {
-		perror("ERROR: malloc() failed");
-		return -5;
+	return 0;
+}
+
+int japi_set_request_cache(japi_context *ctx, const char *req_name, unsigned int ttl_ms)
+{
+	japi_request *req;
+
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
 	}
 
-	req->name = req_name;
-	req->func = req_handler;
-	req->next = ctx->requests;
+	if (req_name == NULL) {
+		fprintf(stderr, "ERROR: Request name is NULL.\n");
+		return -2;
+	}
 
-	ctx->requests = req;
+	req = japi_get_request(ctx, req_name);
+	if (req == NULL) {
+		fprintf(stderr, "ERROR: Request '%s' is not registered.\n", req_name);
+		return -3;
+	}
+
+	req->cache_ttl_ms = ttl_ms;
+	if (ttl_ms == 0) {
+		japi_cache_invalidate(ctx, req_name);
+	}
 
 	return 0;
 }
 
-japi_context *japi_init(void *userptr)
+/* Take a token from a bucket refilled with rate tokens per second up to burst.
+ * Returns 0 on success, otherwise the time in milliseconds until the next
+ * token is available. */
+static unsigned int japi_take_token(double *tokens, uint64_t *stamp_us, double rate,
+									double burst, uint64_t now)
 {
-	japi_context *ctx;
+	*tokens += (double)(now - *stamp_us) * rate / 1000000.0;
+	if (*tokens > burst) {
+		*tokens = burst;
+	}
+	*stamp_us = now;
 
-	ctx = (japi_context *)malloc(sizeof(japi_context));
-	if (ctx == NULL) {
-		perror("ERROR: malloc() failed");
-		return NULL;
+	if (*tokens < 1.0) {
+		return (unsigned int)((1.0 - *tokens) * 1000.0 / rate) + 1;
+	}
+	*tokens -= 1.0;
+
+	return 0;
+}
+
+/* Check the rate limits of the client and the request. If one is exceeded, an
+ * error is added to the response data. */
+static bool japi_rate_limited(japi_context *ctx, japi_client *client, japi_request *req,
+							  json_object *jresp_data)
+{
+	unsigned int retry_ms;
+	uint64_t now;
+
+	if ((client == NULL || ctx->client_rate <= 0) && (req == NULL || req->rate <= 0)) {
+		return false;
+	}
+
+	now = japi_now_us();
+	retry_ms = 0;
+	if (client != NULL && ctx->client_rate > 0) {
+		retry_ms = japi_take_token(&(client->tokens), &(client->tokens_us),
+								   ctx->client_rate, ctx->client_burst, now);
+	}
+	if (retry_ms == 0 && req != NULL && req->rate > 0) {
+		retry_ms = japi_take_token(&(req->tokens), &(req->tokens_us), req->rate,
+								   req->burst, now);
+	}
+	if (retry_ms == 0) {
+		return false;
+	}
+
+	json_object_object_add(jresp_data, "error",
+						   json_object_new_string("rate limit exceeded"));
+	json_object_object_add(jresp_data, "retry_after_ms", json_object_new_int(retry_ms));
+
+	return true;
+}
+
+int japi_set_client_rate_limit(japi_context *ctx, double rate, unsigned int burst)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	if (rate < 0 || (rate > 0 && burst < 1)) {
+		fprintf(stderr, "ERROR: Invalid rate limit.\n");
+		return -2;
+	}
+
+	ctx->client_rate = rate;
+	ctx->client_burst = burst;
+
+	return 0;
+}
+
+int japi_set_request_rate_limit(japi_context *ctx, const char *req_name, double rate,
+								unsigned int burst)
+{
+	japi_request *req;
+
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	if (req_name == NULL) {
+		fprintf(stderr, "ERROR: Request name is NULL.\n");
+		return -2;
+	}
+
+	req = japi_get_request(ctx, req_name);
+	if (req == NULL) {
+		fprintf(stderr, "ERROR: Request '%s' is not registered.\n", req_name);
+		return -3;
+	}
+
+	if (rate < 0 || (rate > 0 && burst < 1)) {
+		fprintf(stderr, "ERROR: Invalid rate limit.\n");
+		return -4;
+	}
+
+	/* Start with a full bucket */
+	req->rate = rate;
+	req->burst = burst;
+	req->tokens = burst;
+	req->tokens_us = japi_now_us();
+
+	return 0;
+}
+
+/* Convert a received request line into a JSON object. Returns NULL if the line
+ * is not valid JSON. */
+static json_object *japi_parse_request(const char *request)
+{
+	json_object *jreq;
+
+	jreq = json_tokener_parse(request);
+	if (jreq == NULL) {
+		fprintf(stderr, "ERROR: json_tokener_parse() failed. Received message: %s\n",
+				request);
+	}
+
+	return jreq;
+}
+
+/* Steps performed while processing a parsed JSON request:
+ * - Extract the request name
+ * - Search a suitable request handler
+ * - Call the request handler
+ * - Prepare the JSON response
+ * - Free memory
+ *
+ * The request object is modified, but not freed.
+ */
+static int japi_process_request(japi_context *ctx, json_object *jreq, char **response,
+								int socket, japi_client *client)
+{
+	const char *req_name;
+	json_object *jreq_no;
+	json_object *jresp;
+	json_object *jresp_data;
+	json_object *jargs;
+	japi_req_handler req_handler;
+	japi_request *req;
+	char *cache_key;
+	int ret;
+	bool args;
+
+	assert(ctx != NULL);
+	assert(jreq != NULL);
+	assert(response != NULL);
+	assert(socket >= 0);
+
+	ret = -1;
+	*response = NULL;
+	cache_key = NULL;
+
+	/* Only create new JSON objects after a valid JSON request was parsed. */
+	jresp = json_object_new_object(); /* Response object */
+	jresp_data = json_object_new_object();
+
+	if ((japi_get_value_as_str(jreq, "japi_request", &req_name)) == 0) {
+
+		/* Prepare response */
+		json_object_object_add(jresp, "japi_response",
+							   json_object_new_string(req_name));
+
+		/* Include japi_request_no in response, if included with request */
+		if (json_object_object_get_ex(jreq, "japi_request_no", &jreq_no)) {
+			json_object_get(jreq_no);
+			json_object_object_add(jresp, "japi_request_no", jreq_no);
+		}
+
+		/* Get arguments as an JSON object */
+		args = json_object_object_get_ex(jreq, "args", &jargs);
+
+		/* Add an empty args JSON object if no args were given
+		   Otherwise, include args with response, if configured. */
+		if (!args) {
+			json_object_object_add(jreq, "args", NULL);
+			json_object_object_get_ex(jreq, "args", &jargs);
+		} else {
+			if (ctx->include_args_in_response) {
+				json_object_get(jargs);
+				json_object_object_add(jresp, "args", jargs);
+			}
+		}
+
+		/* Subscribe/unsubscribe service needs client socket */
+		if (strcasecmp(req_name, "japi_pushsrv_subscribe") == 0 ||
+			strcasecmp(req_name, "japi_pushsrv_unsubscribe") == 0) {
+			json_object_object_add(jargs, "socket", json_object_new_int(socket));
+		}
+
+		/* Reject requests exceeding the rate limits of the client or the
+		 * request, without calling the handler */
+		req = japi_get_request(ctx, req_name);
+		if (japi_rate_limited(ctx, client, req, jresp_data)) {
+			goto out_response;
+		}
+
+		/* Answer cacheable requests and requests already answered in this
+		 * server loop iteration from the cache */
+		if (req != NULL && (req->cache_ttl_ms > 0 || req->coalesce)) {
+			cache_key = japi_cache_key(jargs);
+			if (cache_key != NULL) {
+				*response = japi_cache_response(ctx, req, cache_key, jresp);
+			}
+			if (*response != NULL) {
+				free(cache_key);
+				json_object_put(jresp_data);
+				json_object_put(jresp);
+				ret = 0;
+				goto out_free;
+			}
+		}
+
+		/* Try to find a suitable handler for the given request */
+		req_handler = japi_get_request_handler(ctx, req_name);
+		if (req_handler == NULL) {
+
+			/* No request handler found? Check if a fallback handler was registered. */
+			req_handler = japi_get_request_handler(ctx, "request_not_found_handler");
+
+			if (req_handler == NULL) {
+				fprintf(stderr,
+						"ERROR: No suitable request handler found. Falling back to "
+						"default fallback handler. Request was: %s\n",
+						req_name);
+				req_handler =
+					japi_get_request_handler(ctx, "japi_request_not_found_handler");
+			} else {
+				fprintf(stderr,
+						"WARNING: No suitable request handler found. Falling back to "
+						"user registered fallback handler. Request was: %s\n",
+						req_name);
+			}
+		}
+
+		/* Other requests may change the state coalesced responses were built
+		 * from, so later requests of this iteration don't share them */
+		if (req == NULL || (req->cache_ttl_ms == 0 && !req->coalesce)) {
+			ctx->cache_generation++;
+		}
+
+		/* Call request handler */
+		req_handler(ctx, jargs, jresp_data);
+
+		/* Keep the data for the cache after the response is freed */
+		if (cache_key != NULL) {
+			json_object_get(jresp_data);
+		}
+
+	} else {
+		/* Get request name */
+		if (req_name == NULL) {
+			fprintf(stderr, "ERROR: No keyword found!\n");
+			goto out_free;
+		}
+	}
+
+out_response:
+	/* Add response arguments */
+	json_object_object_add(jresp, "data", jresp_data);
+
+	/* Stringify response */
+	*response = japi_get_jobj_as_ndstr(jresp);
+	json_object_put(jresp);
+
+	/* The cache holds the last reference, so no other thread uses it yet */
+	if (cache_key != NULL) {
+		japi_cache_store(ctx, req, cache_key, jresp_data);
+	}
+
+	ret = 0;
+
+out_free:
+	return ret;
+}
+
+int japi_process_message(japi_context *ctx, const char *request, char **response,
+						 int socket)
+{
+	json_object *jreq;
+	int ret;
+
+	*response = NULL;
+
+	/* Create JSON object from received message */
+	jreq = japi_parse_request(request);
+	if (jreq == NULL) {
+		return -1;
+	}
+
+	ret = japi_process_request(ctx, jreq, response, socket, NULL);
+	json_object_put(jreq);
+
+	return ret;
+}
+
+int japi_shutdown(japi_context *ctx)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	ctx->shutdown = true;
+
+	return 0;
+}
+
+int japi_destroy(japi_context *ctx)
+{
+	japi_request *req, *req_next;
+	japi_pushsrv_context *psc, *psc_next;
+	japi_listener *listener, *listener_next;
+
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	japi_cache_invalidate(ctx, NULL);
+	free(ctx->cache);
+
+	req = ctx->requests;
+	while (req != NULL) {
+		req_next = req->next;
+		free(req);
+		req = req_next;
+	}
+
+	/* Let all push service routines end in parallel before joining them */
+	japi_pushsrv_request_stop_all(ctx);
+
+	psc = ctx->push_services;
+	while (psc != NULL) {
+		psc_next = psc->next;
+		japi_pushsrv_destroy(ctx, psc);
+		psc = psc_next;
+	}
+	japi_pushsrv_sched_destroy(ctx);
+	japi_pushsrv_patterns_destroy(ctx);
+
+	/* Clients served through japi_process_events() */
+	if (ctx->epoll_fd >= 0) {
+		japi_remove_all_clients(ctx);
+		close(ctx->epoll_fd);
+	}
+
+	listener = ctx->listeners;
+	while (listener != NULL) {
+		listener_next = listener->next;
+		close(listener->socket);
+		if (listener->path != NULL) {
+			unlink(listener->path);
+			free(listener->path);
+		}
+		free(listener);
+		listener = listener_next;
+	}
+
+	free(ctx->pushsrv_index);
+	pthread_mutex_destroy(&(ctx->pushsrv_lock));
+	pthread_mutex_destroy(&(ctx->cache_lock));
+	pthread_mutex_destroy(&(ctx->lock));
+	free(ctx);
+
+	return 0;
+}
+
+int japi_call(japi_context *ctx, const char *req_name, json_object *args,
+			  json_object *response)
+{
+	japi_req_handler req_handler;
+
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	if (req_name == NULL || response == NULL) {
+		fprintf(stderr, "ERROR: Request name or response object is NULL.\n");
+		return -2;
+	}
+
+	req_handler = japi_get_request_handler(ctx, req_name);
+	if (req_handler == NULL) {
+		return -3;
+	}
+
+	req_handler(ctx, args, response);
+
+	return 0;
+}
+
+int japi_register_request(japi_context *ctx, const char *req_name,
+						  japi_req_handler req_handler)
+{
+	japi_request *req;
+	char *bad_req_name = "japi_";
+
+	/* Error handling */
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	if ((req_name == NULL) || (strcmp(req_name, "") == 0)) {
+		fprintf(stderr, "ERROR: Request name is NULL or empty.\n");
+		return -2;
+	}
+
+	if (req_handler == NULL) {
+		fprintf(stderr, "ERROR: Request handler is NULL.\n");
+		return -3;
+	}
+
+	if (japi_get_request_handler(ctx, req_name) != NULL) {
+		fprintf(stderr,
+				"ERROR: A request handler called '%s' was already registered.\n",
+				req_name);
+		return -4;
+	}
+
+	if (ctx->init && strncmp(req_name, bad_req_name, strlen(bad_req_name)) == 0) {
+		fprintf(stderr, "ERROR: Request name is not allowed.\n");
+		return -6;
+	}
+
+	req = (japi_request *)malloc(sizeof(japi_request));
+	if (req == NULL) {
+		perror("ERROR: malloc() failed");
+		return -5;
+	}
+
+	req->name = req_name;
+	req->func = req_handler;
+	req->cache_ttl_ms = 0;
+	req->coalesce = false;
+	req->priority = JAPI_PRIORITY_NORMAL;
+	req->rate = 0;
+	req->burst = 0;
+	req->tokens = 0;
+	req->tokens_us = 0;
+	req->next = ctx->requests;
+
+	ctx->requests = req;
+
+	return 0;
+}
+
+japi_context *japi_init(void *userptr)
+{
+	japi_context *ctx;
+
+	ctx = (japi_context *)malloc(sizeof(japi_context));
+	if (ctx == NULL) {
+		perror("ERROR: malloc() failed");
+		return NULL;
 	}
 
 	ctx->init = false;
 	ctx->userptr = userptr;
 	ctx->requests = NULL;
 	ctx->push_services = NULL;
+	ctx->pushsrv_index = NULL;
+	ctx->pushsrv_index_size = 0;
+	ctx->num_push_services = 0;
+	ctx->pushsrv_sched = NULL;
+	ctx->pushsrv_pending = 0;
+	ctx->pushsrv_coalesce_us = 0;
+	ctx->pushsrv_trie = NULL;
+	ctx->pushsrv_patterns = NULL;
 	ctx->clients = NULL;
+	ctx->listeners = NULL;
+	ctx->listen_backlog = SOMAXCONN;
+	ctx->accept_resume_us = 0;
+	memset(&(ctx->socket_options), 0, sizeof(japi_socket_options));
+	ctx->idle_timeout_ms = 0;
+	ctx->request_timeout_ms = 0;
+	ctx->idle_head = NULL;
+	ctx->idle_tail = NULL;
+	ctx->line_head = NULL;
+	ctx->line_tail = NULL;
+	ctx->backend = JAPI_BACKEND_SELECT;
+	ctx->epoll_fd = -1;
+	ctx->uring = NULL;
+	ctx->cache = NULL;
+	ctx->cache_generation = 0;
+	ctx->client_rate = 0;
+	ctx->client_burst = 0;
+	ctx->client_budget = 0;
+	ctx->num_high_priority = 0;
+	ctx->queue_head = NULL;
+	ctx->queue_tail = NULL;
+	ctx->lines_pending = false;
 	ctx->num_clients = 0;
 	ctx->max_clients = 0;
 	ctx->include_args_in_response = false;
 	ctx->shutdown = false;
 
-	/* Initialize mutex */
-	if (pthread_mutex_init(&(ctx->lock), NULL) != 0) {
-		fprintf(stderr, "ERROR: mutex initialization has failed\n");
-		return NULL;
+	/* Initialize mutex */
+	if (pthread_mutex_init(&(ctx->lock), NULL) != 0) {
+		fprintf(stderr, "ERROR: mutex initialization has failed\n");
+		return NULL;
+	}
+	if (pthread_mutex_init(&(ctx->pushsrv_lock), NULL) != 0) {
+		fprintf(stderr, "ERROR: mutex initialization has failed\n");
+		return NULL;
+	}
+	if (pthread_mutex_init(&(ctx->cache_lock), NULL) != 0) {
+		fprintf(stderr, "ERROR: mutex initialization has failed\n");
+		return NULL;
+	}
+
+	/* Ignore SIGPIPE Signal */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Register the default fallback handler */
+	japi_register_request(ctx, "japi_request_not_found_handler",
+						  &japi_request_not_found_handler);
+	/* Register subscribe/unsubscribe service function */
+	japi_register_request(ctx, "japi_pushsrv_subscribe", &japi_pushsrv_subscribe);
+	japi_register_request(ctx, "japi_pushsrv_unsubscribe", &japi_pushsrv_unsubscribe);
+	/* Register list_push_service function  */
+	japi_register_request(ctx, "japi_pushsrv_list", &japi_pushsrv_list);
+	japi_register_request(ctx, "japi_cmd_list", &japi_cmd_list);
+
+	ctx->init = true;
+
+	return ctx;
+}
+
+/*
+ * Set maximal allowed number of clients.
+ * 0 is interpreted as unlimited number of allowed clients.
+ */
+int japi_set_max_allowed_clients(japi_context *ctx, uint16_t num)
+{
+	/* Error handling */
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	ctx->max_clients = num;
+
+	return 0;
+}
+
+int japi_set_backend(japi_context *ctx, japi_backend backend)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+#ifndef __linux__
+	if (backend == JAPI_BACKEND_EPOLL) {
+		fprintf(stderr, "ERROR: epoll is not supported on this platform.\n");
+		return -2;
+	}
+#endif
+	if (backend == JAPI_BACKEND_IO_URING && japi_uring_probe() != 0) {
+		fprintf(stderr, "ERROR: io_uring is not supported by this system.\n");
+		return -2;
+	}
+	if (backend != JAPI_BACKEND_SELECT && backend != JAPI_BACKEND_EPOLL &&
+		backend != JAPI_BACKEND_IO_URING) {
+		fprintf(stderr, "ERROR: Unknown server backend %i.\n", (int)backend);
+		return -2;
+	}
+
+	ctx->backend = backend;
+
+	return 0;
+}
+
+int japi_set_idle_timeout(japi_context *ctx, unsigned int timeout_ms)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	ctx->idle_timeout_ms = timeout_ms;
+
+	return 0;
+}
+
+int japi_set_client_budget(japi_context *ctx, unsigned int lines)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	ctx->client_budget = lines;
+
+	return 0;
+}
+
+int japi_set_request_timeout(japi_context *ctx, unsigned int timeout_ms)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	ctx->request_timeout_ms = timeout_ms;
+
+	return 0;
+}
+
+/*
+ * Include request arguments in response.
+ */
+int japi_include_args_in_response(japi_context *ctx, bool include_args)
+{
+	/* Error handling */
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	ctx->include_args_in_response = include_args;
+
+	return 0;
+}
+
+/*
+ * Add new client element to list
+ */
+int japi_add_client(japi_context *ctx, int socket)
+{
+	japi_client *client;
+
+	/* Error handling */
+	assert(ctx != NULL);
+	assert(socket >= 0);
+
+	/* Create new client list element */
+	client = (japi_client *)malloc(sizeof(japi_client));
+	if (client == NULL) {
+		perror("ERROR: malloc() failed");
+		return -1;
+	}
+
+	/* Reset the clients buffer used by creadline_nb_r */
+	client->crl_buffer.buf = NULL;
+	client->crl_buffer.nbytes = 0;
+	client->crl_buffer.size = 0;
+	client->idle_prev = NULL;
+	client->idle_next = NULL;
+	client->line_start_us = 0;
+	client->line_prev = NULL;
+	client->line_next = NULL;
+	client->ready = false;
+	client->pending = false;
+	client->queued = 0;
+	client->uring = NULL;
+	/* Start with a full rate limit bucket */
+	client->tokens = ctx->client_burst;
+	client->tokens_us = japi_now_us();
+	client->socket = socket;
+
+	/* Start receiving if the io_uring server loop is running */
+	if (ctx->uring != NULL && japi_uring_add_client(ctx->uring, client) != 0) {
+		free(client);
+		return -1;
+	}
+
+	pthread_mutex_lock(&(ctx->lock));
+	prntdbg("adding client %d to japi context\n", socket);
+
+	/* Link list */
+	client->next = ctx->clients;
+	ctx->clients = client;
+	japi_idle_touch(ctx, client);
+#ifdef __linux__
+	if (ctx->epoll_fd >= 0) {
+		japi_epoll_add(ctx, client);
+	}
+#endif
+	/* Increment number of connected clients */
+	ctx->num_clients++;
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return 0;
+}
+
+/* Close the socket of an unlinked client and free it. Called with ctx->lock
+ * held. */
+static void japi_free_client(japi_context *ctx, japi_client *client)
+{
+#ifdef __linux__
+	if (ctx->epoll_fd >= 0) {
+		epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+	}
+#endif
+	if (client->uring != NULL) {
+		japi_uring_remove_client(ctx->uring, client);
+	}
+	close(client->socket);
+	japi_idle_unlink(ctx, client);
+	japi_line_end(ctx, client);
+	free(client->crl_buffer.buf);
+	free(client);
+}
+
+/*
+ * Remove client from client list
+ */
+int japi_remove_client(japi_context *ctx, int socket)
+{
+	japi_client *client, *prev;
+	int ret;
+
+	/* Error Handling */
+	assert(ctx != NULL);
+	assert(socket >= 0);
+
+	client = ctx->clients;
+	prev = NULL;
+	ret = -1;
+
+	japi_pushsrv_remove_client_from_all_pushsrv(ctx, socket);
+
+	pthread_mutex_lock(&(ctx->lock));
+	/* Remove client from list */
+	while (client != NULL) {
+		/* If first element */
+		if ((client->socket == socket) && (prev == NULL)) {
+			ctx->clients = client->next;
+			prntdbg("removing client %d from japi context and close socket\n",
+					client->socket);
+			japi_free_client(ctx, client);
+			ctx->num_clients--;
+			ret = 0;
+			break;
+		}
+		/* If last element */
+		if ((client->socket == socket) && (client->next == NULL)) {
+			prev->next = NULL;
+			prntdbg("removing client %d from japi context and close socket\n",
+					client->socket);
+			japi_free_client(ctx, client);
+			ctx->num_clients--;
+			ret = 0;
+			break;
+		}
+		if (client->socket == socket) {
+			prev->next = client->next;
+			prntdbg("removing client %d from japi context and close socket\n",
+					client->socket);
+			japi_free_client(ctx, client);
+			ctx->num_clients--;
+			ret = 0;
+			break;
+		}
+
+		prev = client;
+		client = client->next;
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+
+	return ret;
+}
+
+int japi_remove_all_clients(japi_context *ctx)
+{
+	japi_client *client, *following_client;
+
+	/* Error Handling */
+	assert(ctx != NULL);
+
+	client = ctx->clients;
+	while (client != NULL) {
+		following_client = client->next;
+		if (japi_remove_client(ctx, client->socket) != 0) {
+			return -1;
+		}
+		client = following_client;
+	}
+
+	return 0;
+}
+
+/* Add a bound server socket to the listeners of the context */
+static int japi_add_listener(japi_context *ctx, int socket, const char *path)
+{
+	japi_listener *listener;
+
+	listener = (japi_listener *)malloc(sizeof(japi_listener));
+	if (listener == NULL) {
+		perror("ERROR: malloc() failed");
+		return -1;
+	}
+
+	/* Abstract sockets have no file to remove */
+	listener->path = NULL;
+	if (path != NULL && path[0] != '@') {
+		listener->path = strdup(path);
+		if (listener->path == NULL) {
+			free(listener);
+			return -1;
+		}
+	}
+
+	listener->socket = socket;
+	listener->next = ctx->listeners;
+	ctx->listeners = listener;
+
+	return 0;
+}
+
+int japi_add_unix_listener(japi_context *ctx, const char *path)
+{
+	int socket;
+
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	if (path == NULL || path[0] == '\0') {
+		fprintf(stderr, "ERROR: Unix socket path is NULL or empty.\n");
+		return -2;
+	}
+
+	socket = unix_start_server(path);
+	if (socket < 0) {
+		fprintf(stderr, "ERROR: Failed to start unix server on %s\n", path);
+		return -3;
+	}
+
+	if (japi_add_listener(ctx, socket, path) != 0) {
+		close(socket);
+		if (path[0] != '@') {
+			unlink(path);
+		}
+		return -4;
+	}
+
+	return 0;
+}
+
+int japi_add_tcp_listener(japi_context *ctx, const char *host, const char *port)
+{
+	int socket;
+
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	if (port == NULL || port[0] == '\0') {
+		fprintf(stderr, "ERROR: Port is NULL or empty.\n");
+		return -2;
+	}
+
+	socket = tcp_start_server_on_host(host, port);
+	if (socket < 0) {
+		fprintf(stderr, "ERROR: Failed to start tcp server on %s port %s\n",
+				(host != NULL) ? host : "*", port);
+		return -3;
+	}
+
+	if (japi_add_listener(ctx, socket, NULL) != 0) {
+		close(socket);
+		return -4;
+	}
+
+	return 0;
+}
+
+int japi_set_listen_backlog(japi_context *ctx, int backlog)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
+
+	if (backlog < 1) {
+		fprintf(stderr, "ERROR: Listen backlog must be at least 1.\n");
+		return -2;
+	}
+
+	ctx->listen_backlog = backlog;
+
+	return 0;
+}
+
+int japi_set_socket_options(japi_context *ctx, const japi_socket_options *opts)
+{
+	if (ctx == NULL || opts == NULL) {
+		fprintf(stderr, "ERROR: JAPI context or socket options are NULL.\n");
+		return -1;
+	}
+
+	if (opts->sndbuf < 0 || opts->rcvbuf < 0 || opts->keepalive_idle < 0 ||
+		opts->keepalive_interval < 0 || opts->keepalive_count < 0) {
+		fprintf(stderr, "ERROR: Socket options must not be negative.\n");
+		return -2;
 	}
 
-	/* Ignore SIGPIPE Signal */
-	signal(SIGPIPE, SIG_IGN);
+	ctx->socket_options = *opts;
 
-	/* Register the default fallback handler */
-	japi_register_request(ctx, "japi_request_not_found_handler",
-						  &japi_request_not_found_handler);
-	/* Register subscribe/unsubscribe service function */
-	japi_register_request(ctx, "japi_pushsrv_subscribe", &japi_pushsrv_subscribe);
-	japi_register_request(ctx, "japi_pushsrv_unsubscribe", &japi_pushsrv_unsubscribe);
-	/* Register list_push_service function  */
-	japi_register_request(ctx, "japi_pushsrv_list", &japi_pushsrv_list);
-	japi_register_request(ctx, "japi_cmd_list", &japi_cmd_list);
+	return 0;
+}
 
-	ctx->init = true;
+/* Set an integer socket option, reporting failures */
+static void japi_setsockopt(int socket, int level, int name, int value, const char *what)
+{
+	if (setsockopt(socket, level, name, &value, sizeof(value)) != 0) {
+		fprintf(stderr, "WARNING: Failed to set %s on client %i\n", what, socket);
+	}
+}
+
+/* Apply the configured socket options to an accepted client socket */
+static void japi_apply_socket_options(japi_context *ctx, int socket)
+{
+	const japi_socket_options *opts = &(ctx->socket_options);
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	if (opts->sndbuf > 0) {
+		japi_setsockopt(socket, SOL_SOCKET, SO_SNDBUF, opts->sndbuf, "SO_SNDBUF");
+	}
+	if (opts->rcvbuf > 0) {
+		japi_setsockopt(socket, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf, "SO_RCVBUF");
+	}
+
+	/* The remaining options only apply to TCP */
+	addrlen = sizeof(addr);
+	if (getsockname(socket, (struct sockaddr *)&addr, &addrlen) != 0 ||
+		(addr.ss_family != AF_INET && addr.ss_family != AF_INET6)) {
+		return;
+	}
+
+	if (opts->tcp_nodelay) {
+		japi_setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+	}
+	if (opts->keepalive) {
+		japi_setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#if defined(TCP_KEEPIDLE)
+		if (opts->keepalive_idle > 0) {
+			japi_setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, opts->keepalive_idle,
+							"TCP_KEEPIDLE");
+		}
+#elif defined(TCP_KEEPALIVE)
+		/* macOS */
+		if (opts->keepalive_idle > 0) {
+			japi_setsockopt(socket, IPPROTO_TCP, TCP_KEEPALIVE, opts->keepalive_idle,
+							"TCP_KEEPALIVE");
+		}
+#endif
+#ifdef TCP_KEEPINTVL
+		if (opts->keepalive_interval > 0) {
+			japi_setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, opts->keepalive_interval,
+							"TCP_KEEPINTVL");
+		}
+#endif
+#ifdef TCP_KEEPCNT
+		if (opts->keepalive_count > 0) {
+			japi_setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, opts->keepalive_count,
+							"TCP_KEEPCNT");
+		}
+#endif
+	}
+#ifdef TCP_USER_TIMEOUT
+	if (opts->user_timeout_ms > 0) {
+		japi_setsockopt(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, (int)opts->user_timeout_ms,
+						"TCP_USER_TIMEOUT");
+	}
+#endif
+}
+
+/* Disconnect clients whose idle timeout has passed and clients that didn't
+ * complete a request line within the request timeout. The queues are ordered by
+ * deadline, so only expired clients at their heads are visited. Clients with
+ * pending data are kept, their data will refresh them. */
+static void japi_expire_idle_clients(japi_context *ctx)
+{
+	japi_client *client;
+	uint64_t now;
+
+	now = japi_now_us();
+	while (ctx->request_timeout_ms > 0 && (client = ctx->line_head) != NULL &&
+		   now - client->line_start_us >= (uint64_t)ctx->request_timeout_ms * 1000) {
+		if (client->ready) {
+			break;
+		}
+		prntdbg("client %d stalled within a line, disconnecting\n", client->socket);
+		japi_remove_client(ctx, client->socket);
+	}
+
+	while (ctx->idle_timeout_ms > 0 && (client = ctx->idle_head) != NULL &&
+		   now - client->last_active_us >= (uint64_t)ctx->idle_timeout_ms * 1000) {
+		if (client->ready) {
+			break;
+		}
+		prntdbg("client %d idle, disconnecting\n", client->socket);
+		japi_remove_client(ctx, client->socket);
+	}
+}
+
+/* Response sent to clients exceeding the maximal number of allowed clients */
+#define JAPI_OVERLOAD_RESPONSE "{ \"error\": \"too many clients\" }\n"
+
+/* Make a server socket non-blocking */
+static int japi_set_nonblocking(int socket)
+{
+	int flags;
+
+	flags = fcntl(socket, F_GETFL);
+	if (flags < 0) {
+		return -1;
+	}
+
+	return fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Accept a client socket that is not inherited by child processes */
+static int japi_accept(int server_socket)
+{
+#if defined(__linux__) && defined(SOCK_CLOEXEC)
+	return accept4(server_socket, NULL, NULL, SOCK_CLOEXEC);
+#else
+	int client_socket;
+
+	client_socket = accept(server_socket, NULL, NULL);
+	if (client_socket >= 0) {
+		fcntl(client_socket, F_SETFD, FD_CLOEXEC);
+		/* BSD sockets inherit O_NONBLOCK, but responses are written blocking */
+		fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) & ~O_NONBLOCK);
+	}
+	return client_socket;
+#endif
+}
+
+/* Add an accepted client. Clients exceeding the maximal number of allowed
+ * clients receive an error line and are closed. */
+static void japi_admit_client(japi_context *ctx, int client_socket)
+{
+	if (ctx->max_clients == 0 || ctx->num_clients < ctx->max_clients) {
+		japi_apply_socket_options(ctx, client_socket);
+		if (japi_add_client(ctx, client_socket) != 0) {
+			close(client_socket);
+			return;
+		}
+		prntdbg("client %d added\n", client_socket);
+	} else {
+		/* The line fits into the empty send buffer, so this doesn't block */
+		if (write(client_socket, JAPI_OVERLOAD_RESPONSE, strlen(JAPI_OVERLOAD_RESPONSE)) <
+			0) {
+			prntdbg("failed to notify rejected client %d\n", client_socket);
+		}
+		close(client_socket);
+	}
+}
+
+/* Accept all pending clients on a non-blocking server socket, so bursts of
+ * connection attempts are drained in a single iteration. Clients exceeding the
+ * maximal number of allowed clients receive an error line and are closed.
+ *
+ * Returns 0 on success, 1 if the server ran out of file descriptors or memory
+ * and -1 on other errors. */
+static int japi_accept_clients(japi_context *ctx, int server_socket)
+{
+	int client_socket;
+
+	while (1) {
+		client_socket = japi_accept(server_socket);
+		if (client_socket < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+				errno == ENOMEM) {
+				/* Keep serving the connected clients */
+				perror("ERROR: accept() failed");
+				return 1;
+			}
+			perror("ERROR: accept() failed\n");
+			return -1;
+		}
+
+		japi_admit_client(ctx, client_socket);
+	}
+
+	return 0;
+}
+
+/* Normal request waiting until the high priority requests of the same
+ * iteration are answered */
+typedef struct __japi_queued {
+	japi_client *client;
+	json_object *jreq;
+	struct __japi_queued *next;
+} japi_queued;
+
+/* Check whether a parsed request has high priority */
+static bool japi_is_high_priority(japi_context *ctx, json_object *jreq)
+{
+	const char *req_name;
+	japi_request *req;
+
+	if (japi_get_value_as_str(jreq, "japi_request", &req_name) != 0) {
+		return false;
+	}
+	req = japi_get_request(ctx, req_name);
+
+	return req != NULL && req->priority == JAPI_PRIORITY_HIGH;
+}
+
+static int japi_queue_push(japi_context *ctx, japi_client *client, json_object *jreq)
+{
+	japi_queued *entry;
+
+	entry = (japi_queued *)malloc(sizeof(japi_queued));
+	if (entry == NULL) {
+		perror("ERROR: malloc() failed");
+		return -1;
+	}
+	entry->client = client;
+	entry->jreq = jreq;
+	entry->next = NULL;
+	client->queued++;
+
+	if (ctx->queue_tail != NULL) {
+		ctx->queue_tail->next = entry;
+	} else {
+		ctx->queue_head = entry;
+	}
+	ctx->queue_tail = entry;
+
+	return 0;
+}
+
+/* Remove a client together with its queued requests */
+static void japi_drop_client(japi_context *ctx, japi_client *client)
+{
+	japi_queued **link, *entry;
+
+	link = &(ctx->queue_head);
+	ctx->queue_tail = NULL;
+	while (*link != NULL) {
+		entry = *link;
+		if (entry->client == client) {
+			*link = entry->next;
+			json_object_put(entry->jreq);
+			free(entry);
+		} else {
+			ctx->queue_tail = entry;
+			link = &(entry->next);
+		}
+	}
+
+	japi_remove_client(ctx, client->socket);
+}
+
+/* Answer a parsed request and free it. Returns false if the client was
+ * removed. */
+static bool japi_answer(japi_context *ctx, japi_client *client, json_object *jreq)
+{
+	char *response;
+	int ret;
+
+	response = NULL;
+
+	/* Received a request, process it... */
+	japi_process_request(ctx, jreq, &response, client->socket, client);
+
+	/* After the request is processed, the object
+	 * is not needed anymore and can be freed at this point. */
+	json_object_put(jreq);
+
+	/* Send response (if provided) */
+	if (response != NULL) {
+		if (client->uring != NULL) {
+			/* Sent by the server loop in order with earlier responses */
+			ret = (japi_uring_send(ctx->uring, client, response, strlen(response)) == 0)
+					  ? 1
+					  : -1;
+		} else {
+			ret = write_n(client->socket, response, strlen(response));
+			free(response);
+		}
+
+		if (ret <= 0) {
+			/* Write failed */
+			fprintf(stderr,
+					"ERROR: Failed to send response to client %i "
+					"(write returned %i)\n",
+					client->socket, ret);
+			japi_drop_client(ctx, client);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Answer the normal requests queued behind high priority ones */
+static void japi_drain_queue(japi_context *ctx)
+{
+	japi_queued *entry;
+
+	while (ctx->queue_head != NULL) {
+		entry = ctx->queue_head;
+		ctx->queue_head = entry->next;
+		if (ctx->queue_head == NULL) {
+			ctx->queue_tail = NULL;
+		}
+		entry->client->queued--;
+		japi_answer(ctx, entry->client, entry->jreq);
+		free(entry);
+	}
+}
+
+/* Read and answer the requests of a client with pending data. At most
+ * client_budget lines are answered, further buffered lines are left for the
+ * next iteration. While requests with high priority are registered, only those
+ * are answered right away and normal requests are queued. Requests of a client
+ * with queued requests are queued as well, so each client is answered in order.
+ * Returns false if the client was removed. */
+static bool japi_serve_client(japi_context *ctx, japi_client *client)
+{
+	int ret;
+	unsigned int lines;
+	char *request;
+	json_object *jreq;
+	bool partial;
+
+	client->ready = false;
+	client->pending = false;
+	lines = 0;
+
+	while (1) {
+		if (ctx->client_budget > 0 && lines++ == ctx->client_budget) {
+			client->pending = true;
+			ctx->lines_pending = true;
+			break;
+		}
+
+		if (client->uring != NULL) {
+			/* Received data is split into lines without blocking. Reading
+			 * stops while too many responses wait to be sent. */
+			if (japi_uring_stalled(client)) {
+				break;
+			}
+			ret = japi_uring_readline(client, &request);
+			partial = japi_uring_buffered(client) > 0;
+		} else {
+			/* Never wait for the rest of a line, other clients would wait too */
+			ret = creadline_nb_r(client->socket, (void **)&request,
+								 &(client->crl_buffer));
+			partial = client->crl_buffer.nbytes > 0;
+		}
+		if (ret == -2) {
+			/* The request timeout starts with the first byte of a line */
+			if (partial) {
+				pthread_mutex_lock(&(ctx->lock));
+				japi_line_start(ctx, client);
+				pthread_mutex_unlock(&(ctx->lock));
+			}
+			break;
+		}
+		if (ret >= 0 && request != NULL) {
+			pthread_mutex_lock(&(ctx->lock));
+			japi_idle_touch(ctx, client);
+			japi_line_end(ctx, client);
+			pthread_mutex_unlock(&(ctx->lock));
+		}
+		if (ret > 0) {
+			/* Each line is parsed once, for its priority and for processing */
+			jreq = japi_parse_request(request);
+			free(request);
+			if (jreq == NULL) {
+				continue;
+			}
+			if (ctx->num_high_priority > 0 &&
+				(client->queued > 0 || !japi_is_high_priority(ctx, jreq))) {
+				if (japi_queue_push(ctx, client, jreq) != 0) {
+					json_object_put(jreq);
+				}
+			} else if (!japi_answer(ctx, client, jreq)) {
+				return false;
+			}
+		} else if (ret == 0) {
+			if (request == NULL) {
+				/* Received EOF (client disconnected) */
+				prntdbg("client %d disconnected\n", client->socket);
+				japi_drop_client(ctx, client);
+				return false;
+			} else {
+				/* Received an empty line */
+				free(request);
+			}
+		} else {
+			fprintf(stderr, "ERROR: creadline() failed (ret = %i)\n", ret);
+			japi_drop_client(ctx, client);
+			return false;
+		}
+
+	}
+
+	return true;
+}
+
+/* Time in microseconds the server loop may wait for events */
+static uint64_t japi_wait_timeout_us(japi_context *ctx)
+{
+	uint64_t timeout_us, deadline, now;
+
+	/* Poll more often while push messages are pending */
+	timeout_us = 200000;
+	if (ctx->pushsrv_pending > 0) {
+		timeout_us = JAPI_PUSHSRV_FLUSH_INTERVAL_US;
+		if (ctx->pushsrv_coalesce_us > 0 &&
+			ctx->pushsrv_coalesce_us < JAPI_PUSHSRV_FLUSH_INTERVAL_US) {
+			timeout_us = ctx->pushsrv_coalesce_us;
+		}
+	}
+
+	/* Don't wait while clients have buffered lines left over */
+	if (ctx->lines_pending) {
+		return 0;
+	}
+
+	/* Wake up when accepting resumes */
+	if (ctx->accept_resume_us != 0) {
+		now = japi_now_us();
+		if (ctx->accept_resume_us <= now) {
+			timeout_us = 0;
+		} else if (ctx->accept_resume_us - now < timeout_us) {
+			timeout_us = ctx->accept_resume_us - now;
+		}
+	}
+
+	/* Wake up when the oldest incomplete request line times out */
+	if (ctx->request_timeout_ms > 0 && ctx->line_head != NULL) {
+		deadline =
+			ctx->line_head->line_start_us + (uint64_t)ctx->request_timeout_ms * 1000;
+		now = japi_now_us();
+		if (deadline <= now) {
+			timeout_us = 0;
+		} else if (deadline - now < timeout_us) {
+			timeout_us = deadline - now;
+		}
+	}
+
+	/* Wake up when the least recently active client times out */
+	if (ctx->idle_timeout_ms > 0 && ctx->idle_head != NULL) {
+		deadline = ctx->idle_head->last_active_us + (uint64_t)ctx->idle_timeout_ms * 1000;
+		now = japi_now_us();
+		if (deadline <= now) {
+			timeout_us = 0;
+		} else if (deadline - now < timeout_us) {
+			timeout_us = deadline - now;
+		}
+	}
+
+	return timeout_us;
+}
+
+/* Resume accepting once the backoff after running out of resources is over */
+static int japi_resume_accept(japi_context *ctx, int server_socket)
+{
+	if (ctx->accept_resume_us == 0 || japi_now_us() < ctx->accept_resume_us) {
+		return 0;
+	}
+	ctx->accept_resume_us = 0;
+
+	if (ctx->uring != NULL) {
+		return japi_uring_rearm_servers(ctx->uring);
+	}
+#ifdef __linux__
+	if (ctx->epoll_fd >= 0) {
+		return japi_epoll_servers(ctx, server_socket, EPOLL_CTL_ADD);
+	}
+#endif
+	return 0;
+}
+
+/* Accept pending clients on all server sockets. Pending connections stay
+ * queued while the server is out of resources, so the server sockets are
+ * ignored for a while instead of waking up the loop over and over. */
+static int japi_accept_all(japi_context *ctx, int server_socket)
+{
+	japi_listener *listener;
+	int ret;
+
+	if (ctx->accept_resume_us != 0) {
+		return 0;
+	}
+
+	ret = (server_socket >= 0) ? japi_accept_clients(ctx, server_socket) : 0;
+	for (listener = ctx->listeners; listener != NULL && ret == 0;
+		 listener = listener->next) {
+		ret = japi_accept_clients(ctx, listener->socket);
+	}
+	if (ret <= 0) {
+		return ret;
+	}
+
+	ctx->accept_resume_us = japi_now_us() + JAPI_ACCEPT_BACKOFF_US;
+#ifdef __linux__
+	if (ctx->epoll_fd >= 0) {
+		return japi_epoll_servers(ctx, server_socket, EPOLL_CTL_DEL);
+	}
+#endif
+	return 0;
+}
+
+/* Server loop waiting for events with select() */
+static int japi_run_select(japi_context *ctx, int server_socket)
+{
+	int ret;
+	int nfds;
+	bool accept_pending;
+	bool lines_pending;
+	fd_set fdrd;
+	struct timeval timeout;
+	uint64_t timeout_us;
+	japi_listener *listener;
+	japi_client *client, *following_client;
+
+	while (1) {
+
+		FD_ZERO(&fdrd);
+		nfds = 0;
+
+		/* Add server sockets to set, unless accepting is paused */
+		japi_resume_accept(ctx, server_socket);
+		if (server_socket >= 0 && ctx->accept_resume_us == 0) {
+			FD_SET(server_socket, &fdrd);
+			nfds = server_socket + 1;
+		}
+		for (listener = ctx->listeners; listener != NULL && ctx->accept_resume_us == 0;
+			 listener = listener->next) {
+			FD_SET(listener->socket, &fdrd);
+			if (listener->socket >= nfds) {
+				nfds = listener->socket + 1;
+			}
+		}
+
+		/* Add all file descriptors to set */
+		client = ctx->clients;
+		while (client != NULL) {
+			FD_SET(client->socket, &fdrd);
+			if (client->socket >= nfds) {
+				nfds = client->socket + 1;
+			}
+			client = client->next;
+		}
+
+		timeout_us = japi_wait_timeout_us(ctx);
+		timeout.tv_sec = timeout_us / 1000000;
+		timeout.tv_usec = timeout_us % 1000000;
+		ret = select(nfds, &fdrd, NULL, NULL, &timeout);
+		if (ret == -1) {
+			perror("ERROR: select() failed\n");
+			return -1;
+		}
+
+		lines_pending = ctx->lines_pending;
+		ctx->lines_pending = false;
+		for (client = ctx->clients; client != NULL; client = client->next) {
+			client->ready = client->pending ||
+							(ret > 0 && FD_ISSET(client->socket, &fdrd));
+		}
+
+		/* Coalesced responses are shared by the requests of one iteration */
+		ctx->cache_generation++;
+
+		/* Deliver pending messages of push services in latest-value mode and
+		 * coalesced messages whose window has passed */
+		japi_pushsrv_flush(ctx);
+
+		japi_expire_idle_clients(ctx);
+
+		/* Check if there is a request to shutdown the server */
+		if (ctx->shutdown == true) {
+			break;
+		} else if (ret == 0 && !lines_pending) {
+			continue;
+		}
+
+		client = ctx->clients; // Reset pointer to list
+
+		while (client != NULL) {
+			following_client = client->next;
+			/* Check whether there is data to process */
+			if (client->ready) {
+				japi_serve_client(ctx, client);
+			}
+			client = following_client;
+		}
+		japi_drain_queue(ctx);
+
+		/* Check whether there are new clients */
+		accept_pending = server_socket >= 0 && FD_ISSET(server_socket, &fdrd);
+		for (listener = ctx->listeners; listener != NULL; listener = listener->next) {
+			accept_pending |= FD_ISSET(listener->socket, &fdrd);
+		}
+		if (accept_pending && japi_accept_all(ctx, server_socket) != 0) {
+			return -1;
+		}
+	}
 
-	return ctx;
+	return 0;
 }
 
-/*
- * Set maximal allowed number of clients.
- * 0 is interpreted as unlimited number of allowed clients.
- */
-int japi_set_max_allowed_clients(japi_context *ctx, uint16_t num)
+#ifdef __linux__
+/* Maximum number of events handled per epoll_wait() call */
+#define JAPI_EPOLL_MAX_EVENTS 64
+
+/* Create the epoll instance and register server sockets and clients */
+static int japi_epoll_setup(japi_context *ctx, int server_socket)
 {
-	/* Error handling */
-	if (ctx == NULL) {
-		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+	japi_client *client;
+
+	ctx->accept_resume_us = 0;
+	ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->epoll_fd < 0) {
+		perror("ERROR: epoll_create1() failed\n");
 		return -1;
 	}
 
-	ctx->max_clients = num;
+	if (japi_epoll_servers(ctx, server_socket, EPOLL_CTL_ADD) != 0) {
+		goto error;
+	}
+
+	/* Clients added before the server was started */
+	pthread_mutex_lock(&(ctx->lock));
+	for (client = ctx->clients; client != NULL; client = client->next) {
+		japi_epoll_add(ctx, client);
+	}
+	pthread_mutex_unlock(&(ctx->lock));
 
 	return 0;
+
+error:
+	close(ctx->epoll_fd);
+	ctx->epoll_fd = -1;
+	return -1;
 }
 
-/*
- * Include request arguments in response.
- */
-int japi_include_args_in_response(japi_context *ctx, bool include_args)
+/* Wait up to timeout_ms for events and handle them. Returns the number of
+ * events or -1 on error. */
+static int japi_epoll_step(japi_context *ctx, int server_socket, int timeout_ms)
 {
-	/* Error handling */
-	if (ctx == NULL) {
-		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+	struct epoll_event events[JAPI_EPOLL_MAX_EVENTS];
+	japi_client *client, *following_client;
+	bool accept_pending;
+	bool lines_pending;
+	int nev, i;
+
+	if (japi_resume_accept(ctx, server_socket) != 0) {
 		return -1;
 	}
 
-	ctx->include_args_in_response = include_args;
+	nev = epoll_wait(ctx->epoll_fd, events, JAPI_EPOLL_MAX_EVENTS, timeout_ms);
+	if (nev == -1) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("ERROR: epoll_wait() failed\n");
+		return -1;
+	}
 
-	return 0;
+	/* Clients with buffered lines left over get no event, so mark them
+	 * explicitly */
+	lines_pending = ctx->lines_pending;
+	ctx->lines_pending = false;
+	if (lines_pending) {
+		for (client = ctx->clients; client != NULL; client = client->next) {
+			client->ready = client->pending;
+		}
+	}
+
+	accept_pending = false;
+	for (i = 0; i < nev; i++) {
+		client = (japi_client *)events[i].data.ptr;
+		if (client == NULL) {
+			accept_pending = true;
+		} else {
+			client->ready = true;
+		}
+	}
+	ctx->cache_generation++;
+
+	japi_pushsrv_flush(ctx);
+
+	japi_expire_idle_clients(ctx);
+
+	if (ctx->shutdown == true) {
+		return nev;
+	}
+
+	/* Ready clients are not expired, so the pointers are still valid */
+	for (i = 0; i < nev; i++) {
+		client = (japi_client *)events[i].data.ptr;
+		if (client != NULL) {
+			japi_serve_client(ctx, client);
+		}
+	}
+	if (lines_pending) {
+		for (client = ctx->clients; client != NULL; client = following_client) {
+			following_client = client->next;
+			if (client->ready) {
+				japi_serve_client(ctx, client);
+			}
+		}
+	}
+	japi_drain_queue(ctx);
+
+	if (accept_pending && japi_accept_all(ctx, server_socket) != 0) {
+		return -1;
+	}
+
+	return nev;
 }
 
-/*
- * Add new client element to list
- */
-int japi_add_client(japi_context *ctx, int socket)
+/* Server loop waiting for events with epoll. Clients are registered once when
+ * they are added, so waiting doesn't scale with the number of clients. */
+static int japi_run_epoll(japi_context *ctx, int server_socket)
 {
-	japi_client *client;
-
-	/* Error handling */
-	assert(ctx != NULL);
-	assert(socket >= 0);
+	uint64_t timeout_us;
+	int ret;
 
-	/* Create new client list element */
-	client = (japi_client *)malloc(sizeof(japi_client));
-	if (client == NULL) {
-		perror("ERROR: malloc() failed");
+	if (japi_epoll_setup(ctx, server_socket) != 0) {
 		return -1;
 	}
 
-	/* Reset the clients buffer used by creadline_r */
-	client->crl_buffer.nbytes = 0;
+	ret = 0;
+	while (ctx->shutdown == false) {
+		/* Round up, so short waits don't become busy polling */
+		timeout_us = japi_wait_timeout_us(ctx);
+		if (japi_epoll_step(ctx, server_socket, (int)((timeout_us + 999) / 1000)) < 0) {
+			ret = -1;
+			break;
+		}
+	}
 
-	pthread_mutex_lock(&(ctx->lock));
-	prntdbg("adding client %d to japi context\n", socket);
-	/* Add socket */
-	client->socket = socket;
+	close(ctx->epoll_fd);
+	ctx->epoll_fd = -1;
+	return ret;
+}
 
-	/* Link list */
-	client->next = ctx->clients;
-	ctx->clients = client;
-	/* Increment number of connected clients */
-	ctx->num_clients++;
-	pthread_mutex_unlock(&(ctx->lock));
+/* Handle the completion of a multishot accept. Accepting pauses like in the
+ * other loops when the server runs out of resources. */
+static int japi_uring_accept(japi_context *ctx, const japi_uring_event *ev)
+{
+	if (ev->res >= 0) {
+		japi_admit_client(ctx, ev->res);
+	} else if (ev->res == -EMFILE || ev->res == -ENFILE || ev->res == -ENOBUFS ||
+			   ev->res == -ENOMEM) {
+		/* Keep serving the connected clients */
+		errno = -ev->res;
+		perror("ERROR: accept() failed");
+		ctx->accept_resume_us = japi_now_us() + JAPI_ACCEPT_BACKOFF_US;
+	} else if (ev->res != -EAGAIN && ev->res != -EINTR && ev->res != -ECONNABORTED &&
+			   ev->res != -ECANCELED) {
+		errno = -ev->res;
+		perror("ERROR: accept() failed\n");
+		return -1;
+	}
 
+	if (!ev->more && ctx->accept_resume_us == 0) {
+		return japi_uring_rearm_servers(ctx->uring);
+	}
 	return 0;
 }
 
-/*
- * Remove client from client list
- */
-int japi_remove_client(japi_context *ctx, int socket)
+/* Server loop based on io_uring. Clients are accepted by multishot accepts and
+ * received into provided buffers by multishot receives, responses are sent as
+ * chains of linked sends. A loop iteration submits and waits with a single
+ * system call. */
+static int japi_run_uring(japi_context *ctx, int server_socket)
 {
-	japi_client *client, *prev;
+	japi_uring_event ev;
+	japi_listener *listener;
+	japi_client *client, *following_client;
+	japi_client **ready, **grown;
+	size_t num_ready, ready_size, i;
+	bool lines_pending;
 	int ret;
 
-	/* Error Handling */
-	assert(ctx != NULL);
-	assert(socket >= 0);
-
-	client = ctx->clients;
-	prev = NULL;
-	ret = -1;
+	ctx->accept_resume_us = 0;
+	ctx->uring = japi_uring_create();
+	if (ctx->uring == NULL) {
+		return -1;
+	}
 
-	japi_pushsrv_remove_client_from_all_pushsrv(ctx, socket);
+	ret = 0;
+	if (server_socket >= 0 && japi_uring_add_server(ctx->uring, server_socket) != 0) {
+		ret = -1;
+	}
+	for (listener = ctx->listeners; listener != NULL && ret == 0;
+		 listener = listener->next) {
+		ret = japi_uring_add_server(ctx->uring, listener->socket);
+	}
 
+	/* Clients added before the server was started */
 	pthread_mutex_lock(&(ctx->lock));
-	/* Remove client from list */
-	while (client != NULL) {
-		/* If first element */
-		if ((client->socket == socket) && (prev == NULL)) {
-			ctx->clients = client->next;
-			prntdbg("removing client %d from japi context and close socket\n",
-					client->socket);
-			close(client->socket);
-			free(client);
-			ctx->num_clients--;
-			ret = 0;
+	for (client = ctx->clients; client != NULL && ret == 0; client = client->next) {
+		ret = japi_uring_add_client(ctx->uring, client);
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+
+	ready = NULL;
+	ready_size = 0;
+	while (ret == 0 && ctx->shutdown == false) {
+		if (japi_resume_accept(ctx, server_socket) != 0 ||
+			japi_uring_wait(ctx->uring, japi_wait_timeout_us(ctx)) != 0) {
+			ret = -1;
 			break;
 		}
-		/* If last element */
-		if ((client->socket == socket) && (client->next == NULL)) {
-			prev->next = NULL;
-			prntdbg("removing client %d from japi context and close socket\n",
-					client->socket);
-			close(client->socket);
-			free(client);
-			ctx->num_clients--;
-			ret = 0;
-			break;
+
+		/* Clients with buffered lines left over get no event */
+		lines_pending = ctx->lines_pending;
+		ctx->lines_pending = false;
+		if (lines_pending) {
+			for (client = ctx->clients; client != NULL; client = client->next) {
+				client->ready = client->pending;
+			}
 		}
-		if (client->socket == socket) {
-			prev->next = client->next;
-			prntdbg("removing client %d from japi context and close socket\n",
-					client->socket);
-			close(client->socket);
-			free(client);
-			ctx->num_clients--;
-			ret = 0;
+
+		num_ready = 0;
+		while (ret == 0 && japi_uring_next(ctx->uring, &ev)) {
+			if (ev.type == JAPI_URING_EV_ACCEPT) {
+				ret = japi_uring_accept(ctx, &ev);
+			} else if (!ev.client->ready) {
+				ev.client->ready = true;
+				if (num_ready == ready_size) {
+					grown = (japi_client **)realloc(
+						ready, (ready_size > 0 ? 2 * ready_size : 64) * sizeof(japi_client *));
+					if (grown == NULL) {
+						/* Found by walking the client list instead */
+						lines_pending = true;
+						continue;
+					}
+					ready = grown;
+					ready_size = (ready_size > 0) ? 2 * ready_size : 64;
+				}
+				ready[num_ready++] = ev.client;
+			}
+		}
+		if (ret != 0) {
 			break;
 		}
+		ctx->cache_generation++;
 
-		prev = client;
-		client = client->next;
-	}
-	pthread_mutex_unlock(&(ctx->lock));
-
-	return ret;
-}
+		japi_pushsrv_flush(ctx);
 
-int japi_remove_all_clients(japi_context *ctx)
-{
-	japi_client *client, *following_client;
+		japi_expire_idle_clients(ctx);
 
-	/* Error Handling */
-	assert(ctx != NULL);
+		if (ctx->shutdown == true) {
+			break;
+		}
 
-	client = ctx->clients;
-	while (client != NULL) {
-		following_client = client->next;
-		if (japi_remove_client(ctx, client->socket) != 0) {
-			return -1;
+		/* Ready clients are not expired, so the pointers are still valid */
+		for (i = 0; i < num_ready; i++) {
+			japi_serve_client(ctx, ready[i]);
 		}
-		client = following_client;
+		if (lines_pending) {
+			for (client = ctx->clients; client != NULL; client = following_client) {
+				following_client = client->next;
+				if (client->ready) {
+					japi_serve_client(ctx, client);
+				}
+			}
+		}
+		japi_drain_queue(ctx);
 	}
+	free(ready);
 
-	return 0;
+	/* Responses to the last requests, e.g. a shutdown, are still sent */
+	if (ret == 0) {
+		japi_uring_flush(ctx->uring, JAPI_URING_FLUSH_TIMEOUT_US);
+	}
+	pthread_mutex_lock(&(ctx->lock));
+	for (client = ctx->clients; client != NULL; client = client->next) {
+		japi_uring_remove_client(ctx->uring, client);
+	}
+	pthread_mutex_unlock(&(ctx->lock));
+	japi_uring_destroy(ctx->uring);
+	ctx->uring = NULL;
+
+	return ret;
 }
+#endif
 
 int japi_start_server(japi_context *ctx, const char *port)
 {
 	int server_socket;
+	int ret;
+	japi_listener *listener;
 
-	server_socket = tcp_start_server(port);
-	if (server_socket < 0) {
-		fprintf(stderr, "ERROR: Failed to start tcp server on port %s\n", port);
+	server_socket = -1;
+	if (port != NULL) {
+		server_socket = tcp_start_server(port);
+		if (server_socket < 0) {
+			fprintf(stderr, "ERROR: Failed to start tcp server on port %s\n", port);
+			return -1;
+		}
+	} else if (ctx->listeners == NULL) {
+		fprintf(stderr, "ERROR: Neither port nor listeners given\n");
 		return -1;
 	}
 
-	int ret;
-	int nfds;
-	fd_set fdrd;
-	struct timeval timeout;
-	japi_client *client, *following_client;
-
-	if (listen(server_socket, 1) != 0) {
+	/* Server sockets are non-blocking, so accepting stops when drained */
+	if (server_socket >= 0 && (listen(server_socket, ctx->listen_backlog) != 0 ||
+							   japi_set_nonblocking(server_socket) != 0)) {
 		perror("ERROR: listen() failed\n");
 		return -1;
 	}
+	for (listener = ctx->listeners; listener != NULL; listener = listener->next) {
+		if (listen(listener->socket, ctx->listen_backlog) != 0 ||
+			japi_set_nonblocking(listener->socket) != 0) {
+			perror("ERROR: listen() failed\n");
+			return -1;
+		}
+	}
 
-	while (1) {
+	ctx->accept_resume_us = 0;
+#ifdef __linux__
+	if (ctx->backend == JAPI_BACKEND_EPOLL) {
+		ret = japi_run_epoll(ctx, server_socket);
+	} else if (ctx->backend == JAPI_BACKEND_IO_URING) {
+		ret = japi_run_uring(ctx, server_socket);
+	} else {
+		ret = japi_run_select(ctx, server_socket);
+	}
+#else
+	ret = japi_run_select(ctx, server_socket);
+#endif
+	if (ret != 0) {
+		return -1;
+	}
 
-		FD_ZERO(&fdrd);
+	/* Clean up */
+	japi_remove_all_clients(ctx);
 
-		/* Add server socket to set */
-		FD_SET(server_socket, &fdrd);
+	if (server_socket >= 0) {
+		close(server_socket);
+	}
 
-		nfds = server_socket + 1;
+	return 0;
+}
 
-		/* Add all file descriptors to set */
-		client = ctx->clients;
-		while (client != NULL) {
-			FD_SET(client->socket, &fdrd);
-			if (client->socket >= nfds) {
-				nfds = client->socket + 1;
-			}
-			client = client->next;
-		}
+#ifdef __linux__
+/* Prepare the listeners and the epoll instance for japi_process_events() */
+static int japi_embed_setup(japi_context *ctx)
+{
+	japi_listener *listener;
 
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 200000;
-		ret = select(nfds, &fdrd, NULL, NULL, &timeout);
-		if (ret == -1) {
-			perror("ERROR: select() failed\n");
-			return -1;
-		}
+	if (ctx->epoll_fd >= 0) {
+		return 0;
+	}
 
-		/* Check if there is a request to shutdown the server */
-		if (ctx->shutdown == true) {
-			break;
-		} else if (ret == 0) {
-			continue;
+	for (listener = ctx->listeners; listener != NULL; listener = listener->next) {
+		if (listen(listener->socket, ctx->listen_backlog) != 0 ||
+			japi_set_nonblocking(listener->socket) != 0) {
+			perror("ERROR: listen() failed\n");
+			return -1;
 		}
+	}
 
-		client = ctx->clients; // Reset pointer to list
+	return japi_epoll_setup(ctx, -1);
+}
+#endif
 
-		while (client != NULL) {
+int japi_get_fd(japi_context *ctx)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
 
-			following_client = client->next;
+#ifdef __linux__
+	if (japi_embed_setup(ctx) != 0) {
+		return -3;
+	}
 
-			/* Check whether there is data to process */
-			if (FD_ISSET(client->socket, &fdrd)) {
-
-				int ret;
-				char *request;
-				char *response;
-
-				do {
-
-					ret = creadline_r(client->socket, (void **)&request,
-									  &(client->crl_buffer));
-					if (ret > 0) {
-
-						response = NULL;
-
-						/* Received a line, process it... */
-						japi_process_message(ctx, request, &response, client->socket);
-
-						/* After the request buffer is processed, the memory
-						 *is not needed anymore and can be freed at this point. */
-						free(request);
-
-						/* Send response (if provided) */
-						if (response != NULL) {
-							ret = write_n(client->socket, response, strlen(response));
-							free(response);
-
-							if (ret <= 0) {
-								/* Write failed */
-								fprintf(stderr,
-										"ERROR: Failed to send response to client %i "
-										"(write returned %i)\n",
-										client->socket, ret);
-								japi_remove_client(ctx, client->socket);
-								break;
-							}
-						}
-					} else if (ret == 0) {
-						if (request == NULL) {
-							/* Received EOF (client disconnected) */
-							prntdbg("client %d disconnected\n", client->socket);
-							japi_remove_client(ctx, client->socket);
-							break;
-						} else {
-							/* Received an empty line */
-							free(request);
-						}
-					} else {
-						fprintf(stderr, "ERROR: creadline() failed (ret = %i)\n", ret);
-						japi_remove_client(ctx, client->socket);
-						break;
-					}
+	return ctx->epoll_fd;
+#else
+	fprintf(stderr, "ERROR: Event loop integration is not supported on this platform.\n");
+	return -2;
+#endif
+}
 
-				} while (client->crl_buffer.nbytes != 0);
-			}
-			client = following_client;
-		}
+int japi_get_timeout(japi_context *ctx)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
+	}
 
-		/* Check whether there are new clients */
-		if (FD_ISSET(server_socket, &fdrd)) {
-			int client_socket = 0;
+	/* Round up, so the host loop doesn't wake up too early */
+	return (int)((japi_wait_timeout_us(ctx) + 999) / 1000);
+}
 
-			client_socket = accept(server_socket, NULL, NULL);
-			if (client_socket < 0) {
-				perror("ERROR: accept() failed\n");
-				return -1;
-			}
-			if (ctx->max_clients == 0 || ctx->num_clients < ctx->max_clients) {
-				japi_add_client(ctx, client_socket);
-				prntdbg("client %d added\n", client_socket);
-			} else {
-				close(client_socket);
-			}
-		}
+int japi_process_events(japi_context *ctx, int timeout_ms)
+{
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return -1;
 	}
 
-	/* Clean up */
-	japi_remove_all_clients(ctx);
+#ifdef __linux__
+	if (japi_embed_setup(ctx) != 0) {
+		return -3;
+	}
 
-	close(server_socket);
+	if (japi_epoll_step(ctx, -1, timeout_ms) < 0) {
+		return -4;
+	}
 
 	return 0;
+#else
+	fprintf(stderr, "ERROR: Event loop integration is not supported on this platform.\n");
+	return -2;
+#endif
 }
 
 /*
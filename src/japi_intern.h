@@ -58,6 +58,19 @@
  */
 int japi_process_message(japi_context *ctx, const char *request, char **response, int socket);
 
+/*!
+ * \brief Copy a JSON value in canonical form
+ *
+ * Copy a JSON value with the keys of all objects sorted recursively, so
+ * values differing only by key order have the same string representation.
+ *
+ * \param jobj	JSON value to copy
+ *
+ * \returns	The copy, to be released with json_object_put(). NULL is returned
+ * if jobj is NULL or memory allocation failed.
+ */
+json_object *japi_canonical(json_object *jobj);
+
 /*!
  * \brief Remove client from push service
  *
@@ -115,6 +128,48 @@ int japi_add_client(japi_context *ctx, int socket);
 */
 void japi_pushsrv_remove_client_from_all_pushsrv(japi_context *ctx, int socket);
 
+/*!
+ * \brief Deliver pending push messages
+ *
+ * Try to send the pending messages of push services in latest-value mode
+ * without blocking, and send coalesced messages whose coalescing window has
+ * passed. Called by the server loop.
+ *
+ * \param ctx		JAPI context
+ */
+void japi_pushsrv_flush(japi_context *ctx);
+
+/*!
+ * \brief Tell all push service routines to end
+ *
+ * Clear the enabled flag of all push service threads and wake up routines
+ * waiting in japi_pushsrv_wait(), without joining the threads. Used to stop
+ * all push services in parallel before joining them one by one.
+ *
+ * \param ctx		JAPI context
+ */
+void japi_pushsrv_request_stop_all(japi_context *ctx);
+
+/*!
+ * \brief Stop the periodic push service scheduler
+ *
+ * Stop the scheduler and worker threads used by japi_pushsrv_start_periodic()
+ * and free their resources. Periodic push services must be stopped before.
+ *
+ * \param ctx		JAPI context
+ */
+void japi_pushsrv_sched_destroy(japi_context *ctx);
+
+/*!
+ * \brief Free all wildcard subscriptions
+ *
+ * Free the wildcard subscriptions recorded by japi_pushsrv_subscribe(). The
+ * push services must be destroyed before.
+ *
+ * \param ctx		JAPI context
+ */
+void japi_pushsrv_patterns_destroy(japi_context *ctx);
+
 /*!
  * \brief Provide the names of all registered commands as a JAPI response.
  *
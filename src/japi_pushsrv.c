@@ -32,40 +32,348 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <json-c/json.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "japi_intern.h"
 #include "japi_pushsrv_intern.h"
+#include "japi_shm.h"
 #include "japi_utils.h"
 #include "prntdbg.h"
 
 #include "rw_n.h"
 
+/* Initial number of buckets of the push service hash index */
+#define JAPI_PUSHSRV_INDEX_SIZE 64
+
+/* Position of a push service that is not in the scheduler heap */
+#define JAPI_PUSHSRV_SCHED_NPOS ((size_t)-1)
+
+/* Size of coalesced messages that is sent without waiting for the window */
+#define JAPI_PUSHSRV_OUTBOX_MAX 65536
+
+/* Maximum length of a single key in a subscription filter field path */
+#define JAPI_PUSHSRV_FIELD_MAX 128
+
+/* Clock used by the periodic push service scheduler. macOS lacks
+ * pthread_condattr_setclock(), so the realtime clock is used there. */
+#ifdef __APPLE__
+#define JAPI_PUSHSRV_SCHED_CLOCK CLOCK_REALTIME
+#else
+#define JAPI_PUSHSRV_SCHED_CLOCK CLOCK_MONOTONIC
+#endif
+
+/*
+ * Scheduler of periodic push services.
+ *
+ * Periodic push services are kept in a binary min-heap ordered by their next
+ * due time. The scheduler thread sleeps until the earliest due time and hands
+ * due push services over to a small pool of worker threads.
+ */
+typedef struct __japi_pushsrv_sched {
+	pthread_mutex_t lock; /* Protects all members and the sched_* push service fields */
+	pthread_cond_t cond; /* Wakes the scheduler thread */
+	pthread_cond_t work_cond; /* Wakes worker threads */
+	pthread_cond_t idle_cond; /* Signalled when a callback returned */
+	pthread_t thread; /* Scheduler thread */
+	pthread_t workers[JAPI_PUSHSRV_WORKERS]; /* Worker threads */
+	japi_pushsrv_context **heap; /* Min-heap of periodic push services */
+	size_t heap_len; /* Number of elements in heap */
+	size_t heap_size; /* Number of allocated elements of heap */
+	japi_pushsrv_context *queue_head; /* Due push services waiting for a worker */
+	japi_pushsrv_context *queue_tail; /* Last element of the worker queue */
+	bool shutdown; /* Flag to end scheduler and worker threads */
+} japi_pushsrv_sched;
+
+/* Node of the trie of push service names split at '/' */
+typedef struct __japi_pushsrv_trie {
+	char *segment; /* Name segment of this node */
+	japi_pushsrv_context *psc; /* Push services named by the path to this node, which
+								* differ only by case, linked by trie_next, or NULL */
+	struct __japi_pushsrv_trie *children; /* First node of the next segment */
+	struct __japi_pushsrv_trie *next; /* Next sibling */
+} japi_pushsrv_trie;
+
+/* Subscription of a client to all push services matching a pattern */
+typedef struct __japi_pushsrv_pattern {
+	char *pattern; /* Service name with wildcard segments */
+	int socket; /* Subscribed client socket */
+	japi_pushsrv_client opts; /* Subscription options applied to every match */
+	struct __japi_pushsrv_pattern *next;
+} japi_pushsrv_pattern;
+
+/* Message kept in the replay ring of a push service */
+typedef struct __japi_pushsrv_replay {
+	uint64_t seq; /* Sequence number of the message */
+	char *msg; /* Serialized message or NULL */
+	size_t msg_len;
+} japi_pushsrv_replay;
+
+static bool pushsrv_replay(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+						   uint64_t since_seq);
+static void pushsrv_send_snapshot(japi_pushsrv_context *psc, japi_pushsrv_client *client);
+static int pushsrv_flush_outbox(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+								bool block);
+
+/* Current time of the push service clock in microseconds */
+static uint64_t pushsrv_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(JAPI_PUSHSRV_SCHED_CLOCK, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Hash the case-folded push service name (djb2) */
+static unsigned long pushsrv_hash(const char *pushsrv_name)
+{
+	unsigned long hash;
+	unsigned char c;
+
+	hash = 5381;
+	while ((c = (unsigned char)*pushsrv_name++) != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned long)tolower(c);
+	}
+
+	return hash;
+}
+
+/* (Re)build the hash index with 'size' buckets from ctx->push_services.
+ *
+ * The list is walked from the newest to the oldest entry and every entry is
+ * appended to its bucket, so a bucket keeps the order of the list.
+ * Must be called with ctx->pushsrv_lock held.
+ */
+static int pushsrv_index_resize(japi_context *ctx, size_t size)
+{
+	japi_pushsrv_context **index, **slot;
+	japi_pushsrv_context *psc;
+
+	index = (japi_pushsrv_context **)calloc(size, sizeof(japi_pushsrv_context *));
+	if (index == NULL) {
+		perror("ERROR: calloc() failed");
+		return -1;
+	}
+
+	psc = ctx->push_services;
+	while (psc != NULL) {
+		slot = &(index[psc->index_hash % size]);
+		while (*slot != NULL) {
+			slot = &((*slot)->index_next);
+		}
+		psc->index_next = NULL;
+		*slot = psc;
+		psc = psc->next;
+	}
+
+	free(ctx->pushsrv_index);
+	ctx->pushsrv_index = index;
+	ctx->pushsrv_index_size = size;
+
+	return 0;
+}
+
+/* Look for the most recently registered push service matching 'pushsrv_name'
+ * (case-insensitive). Must be called with ctx->pushsrv_lock held.
+ *
+ * NULL is returned if no push service was found.
+ */
+static japi_pushsrv_context *pushsrv_lookup(japi_context *ctx, const char *pushsrv_name)
+{
+	japi_pushsrv_context *psc;
+	unsigned long hash;
+
+	if (ctx->pushsrv_index == NULL) {
+		return NULL;
+	}
+
+	hash = pushsrv_hash(pushsrv_name);
+	psc = ctx->pushsrv_index[hash % ctx->pushsrv_index_size];
+	while (psc != NULL) {
+		if (psc->index_hash == hash && strcasecmp(pushsrv_name, psc->pushsrv_name) == 0) {
+			return psc;
+		}
+		psc = psc->index_next;
+	}
+
+	return NULL;
+}
+
+/* Set filter and fields of a subscriber from a private copy parsed from its
+ * canonical filter key */
+static void pushsrv_load_filter(japi_pushsrv_client *opts)
+{
+	json_object *jopts;
+	json_object *jval;
+
+	jopts = json_tokener_parse(opts->filter_key);
+	if (json_object_object_get_ex(jopts, "filter", &jval)) {
+		opts->filter = json_object_get(jval);
+	}
+	if (json_object_object_get_ex(jopts, "fields", &jval)) {
+		opts->fields = json_object_get(jval);
+	}
+	json_object_put(jopts);
+}
+
+/*!
+ * \brief Parse subscription options
+ *
+ * Read the optional subscription arguments of a subscribe request into opts.
+ *
+ * \param jreq	Subscribe request arguments
+ * \param opts	Subscriber to store the options in
+ *
+ * \returns	On success, NULL is returned. On error, a message describing the
+ * invalid argument is returned.
+ */
+static const char *pushsrv_parse_options(json_object *jreq, japi_pushsrv_client *opts)
+{
+	json_object *jval;
+	json_object *jfilter;
+	json_object *jfields;
+	json_object *jopts;
+	double max_rate;
+	int decimation;
+	int i;
+
+	opts->decimation = 1;
+	opts->min_interval_us = 0;
+	opts->filter_key = NULL;
+	opts->filter = NULL;
+	opts->fields = NULL;
+	opts->shm = NULL;
+	opts->by_name = true;
+	opts->patterns = 0;
+
+	/* Deliver only every n-th message */
+	if (json_object_object_get_ex(jreq, "decimation", &jval)) {
+		if (!json_object_is_type(jval, json_type_int) ||
+			(decimation = json_object_get_int(jval)) < 1) {
+			return "Invalid decimation, expecting an integer >= 1.";
+		}
+		opts->decimation = (unsigned int)decimation;
+	}
+
+	/* Deliver at most max_rate messages per second */
+	if (json_object_object_get_ex(jreq, "max_rate", &jval)) {
+		if (!(json_object_is_type(jval, json_type_int) ||
+			  json_object_is_type(jval, json_type_double)) ||
+			(max_rate = json_object_get_double(jval)) <= 0) {
+			return "Invalid max_rate, expecting a number > 0.";
+		}
+		opts->min_interval_us = (uint64_t)(1000000.0 / max_rate);
+	}
+
+	/* Deliver only messages with the given field values */
+	jfilter = NULL;
+	if (json_object_object_get_ex(jreq, "filter", &jfilter) &&
+		!json_object_is_type(jfilter, json_type_object)) {
+		return "Invalid filter, expecting an object of field paths and values.";
+	}
+
+	/* Deliver only the given fields of a message */
+	jfields = NULL;
+	if (json_object_object_get_ex(jreq, "fields", &jfields)) {
+		if (!json_object_is_type(jfields, json_type_array)) {
+			return "Invalid fields, expecting an array of field paths.";
+		}
+		for (i = 0; i < json_object_array_length(jfields); i++) {
+			if (!json_object_is_type(json_object_array_get_idx(jfields, i),
+									 json_type_string)) {
+				return "Invalid fields, expecting an array of field paths.";
+			}
+		}
+	}
+
+	if (jfilter == NULL && jfields == NULL) {
+		return NULL;
+	}
+
+	/* Subscribers with the same canonical form share serialized messages */
+	jopts = json_object_new_object();
+	json_object_object_add(jopts, "filter", japi_canonical(jfilter));
+	json_object_object_add(jopts, "fields", json_object_get(jfields));
+	opts->filter_key =
+		strdup(json_object_to_json_string_ext(jopts, JSON_C_TO_STRING_PLAIN));
+	json_object_put(jopts);
+	if (opts->filter_key == NULL) {
+		return "Out of memory.";
+	}
+
+	pushsrv_load_filter(opts);
+
+	return NULL;
+}
+
+/* Free the filter options of a subscriber */
+static void pushsrv_free_options(japi_pushsrv_client *opts)
+{
+	free(opts->filter_key);
+	json_object_put(opts->filter);
+	json_object_put(opts->fields);
+	opts->filter_key = NULL;
+	opts->filter = NULL;
+	opts->fields = NULL;
+}
+
+/* Copy subscription options. The filter is parsed again, so the copy can be
+ * used under a different push service lock. */
+static int pushsrv_copy_options(japi_pushsrv_client *dst, const japi_pushsrv_client *src)
+{
+	*dst = *src;
+	dst->filter = NULL;
+	dst->fields = NULL;
+	if (src->filter_key == NULL) {
+		return 0;
+	}
+
+	dst->filter_key = strdup(src->filter_key);
+	if (dst->filter_key == NULL) {
+		return -1;
+	}
+	pushsrv_load_filter(dst);
+
+	return 0;
+}
+
 /*!
  * \brief Add client to push service
  *
  * Add client socket to given push service.
  *
- * \param socket	Socket to add
- * \param pushsrv_name	The name of the push service
  * \param psc	JAPI push service context
+ * \param socket	Socket to add
+ * \param opts	Subscription options
+ * \param since_seq	Replay the kept messages after this sequence number, -1 to
+ * send a snapshot instead
  *
- * \returns	On success, 0 is returned. On error, -1 if memory allocation failed.
+ * \returns	On success, 0 is returned, or 1 if messages after since_seq are not
+ * kept anymore. On error, -1 if memory allocation failed and -2 if sending to
+ * the client failed, which removed the client along with the options.
  */
-static int japi_pushsrv_add_client(japi_pushsrv_context *psc, int socket)
+static int japi_pushsrv_add_client(japi_pushsrv_context *psc, int socket,
+								   const japi_pushsrv_client *opts, int64_t since_seq)
 {
-	japi_client *client;
+	japi_pushsrv_client *client;
+	int ret;
 
 	/* Error handling */
 	assert(psc != NULL);
 	assert(socket >= 0);
 
-	client = (japi_client *)malloc(sizeof(japi_client));
+	client = (japi_pushsrv_client *)malloc(sizeof(japi_pushsrv_client));
 	if (client == NULL) {
 		perror("ERROR: malloc() failed\n");
 		return -1;
@@ -73,19 +381,194 @@ static int japi_pushsrv_add_client(japi_pushsrv_context *psc, int socket)
 
 	pthread_mutex_lock(&(psc->lock));
 	client->socket = socket;
+	client->pending = NULL;
+	client->decimation = opts->decimation;
+	client->decimation_count = 0;
+	client->min_interval_us = opts->min_interval_us;
+	client->last_sent_us = 0;
+	client->filter_key = opts->filter_key;
+	client->filter = opts->filter;
+	client->fields = opts->fields;
+	client->last_seq = 0;
+	client->outbox = NULL;
+	client->outbox_len = 0;
+	client->outbox_size = 0;
+	client->outbox_since_us = 0;
+	client->shm = opts->shm;
+	client->by_name = opts->by_name;
+	client->patterns = opts->patterns;
 	client->next = psc->clients;
 	psc->clients = client;
+
+	/* Queue the missed messages or the current state before any new message.
+	 * They are sent as far as the socket takes them without blocking, the rest
+	 * is sent by the server loop. */
+	ret = 0;
+	if (since_seq >= 0) {
+		if (!pushsrv_replay(psc, client, (uint64_t)since_seq)) {
+			ret = 1;
+		}
+	} else {
+		pushsrv_send_snapshot(psc, client);
+	}
+	if (pushsrv_flush_outbox(psc, client, false) < 0) {
+		fprintf(stderr, "ERROR: Failed to send push service message to client %i\n",
+				client->socket);
+		japi_pushsrv_remove_client(psc, socket);
+		ret = -2;
+	}
 	pthread_mutex_unlock(&(psc->lock));
 
+	return ret;
+}
+
+/* Send a message to a subscriber, through its shared memory ring if it has one.
+ * A message dropped because the ring is full still counts as sent, the
+ * subscriber notices the gap in the sequence numbers. */
+static int pushsrv_write(japi_pushsrv_client *client, const char *msg, size_t len)
+{
+	if (client->shm != NULL) {
+		japi_shm_write(client->shm, msg, len);
+		return (int)len;
+	}
+
+	return write_n(client->socket, msg, len);
+}
+
+/* Drop the pending message of a subscriber. Must be called with psc->lock held. */
+static void pushsrv_drop_pending(japi_pushsrv_context *psc, japi_pushsrv_client *client)
+{
+	if (client->pending != NULL) {
+		free(client->pending);
+		client->pending = NULL;
+		__sync_sub_and_fetch(&(psc->ctx->pushsrv_pending), 1);
+	}
+}
+
+/* Append a message to the outbox of a subscriber. Must be called with
+ * psc->lock held.
+ *
+ * Returns 0 on success and -1 if memory allocation failed. */
+static int pushsrv_outbox_append(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+								 const char *msg, size_t len, uint64_t now)
+{
+	char *outbox;
+	size_t size;
+
+	if (client->outbox_len + len > client->outbox_size) {
+		size = 2 * client->outbox_size;
+		if (size < client->outbox_len + len) {
+			size = client->outbox_len + len;
+		}
+		outbox = (char *)realloc(client->outbox, size);
+		if (outbox == NULL) {
+			perror("ERROR: realloc() failed");
+			return -1;
+		}
+		client->outbox = outbox;
+		client->outbox_size = size;
+	}
+
+	if (client->outbox_len == 0) {
+		client->outbox_since_us = now;
+		__sync_add_and_fetch(&(psc->ctx->pushsrv_pending), 1);
+	}
+	memcpy(client->outbox + client->outbox_len, msg, len);
+	client->outbox_len += len;
+
 	return 0;
 }
 
+/* Send the outbox of a subscriber. Without block, only as much as fits into the
+ * socket buffer is sent and the rest is kept. Must be called with psc->lock
+ * held.
+ *
+ * Returns 1 if the outbox was sent completely, 0 if messages are left and -1
+ * if writing failed. */
+static int pushsrv_flush_outbox(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+								bool block)
+{
+	size_t sent;
+	ssize_t ret;
+
+	if (client->outbox_len == 0) {
+		return 1;
+	}
+
+	sent = 0;
+	ret = 0;
+	while (sent < client->outbox_len) {
+		ret = send(client->socket, client->outbox + sent, client->outbox_len - sent,
+				   MSG_DONTWAIT);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (!block) {
+				ret = 0;
+				break;
+			}
+			ret = write_n(client->socket, client->outbox + sent,
+						  client->outbox_len - sent);
+			if (ret > 0) {
+				sent = client->outbox_len;
+			}
+		}
+		if (ret <= 0) {
+			ret = -1;
+			break;
+		}
+		sent += ret;
+	}
+
+	if (ret >= 0 && sent < client->outbox_len) {
+		memmove(client->outbox, client->outbox + sent, client->outbox_len - sent);
+		client->outbox_len -= sent;
+		return 0;
+	}
+	client->outbox_len = 0;
+	__sync_sub_and_fetch(&(psc->ctx->pushsrv_pending), 1);
+
+	return (ret < 0) ? -1 : 1;
+}
+
+/* Queue a message for a new subscriber. Subscribers with a shared memory ring
+ * get it right away. Must be called with psc->lock held. */
+static void pushsrv_queue(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+						  const char *msg, size_t len)
+{
+	if (client->shm != NULL) {
+		pushsrv_write(client, msg, len);
+	} else {
+		pushsrv_outbox_append(psc, client, msg, len, pushsrv_now_us());
+	}
+}
+
+/* Free subscriber. Must be called with psc->lock held. */
+static void pushsrv_free_client(japi_pushsrv_context *psc, japi_pushsrv_client *client)
+{
+	pushsrv_drop_pending(psc, client);
+	if (client->outbox_len > 0) {
+		__sync_sub_and_fetch(&(psc->ctx->pushsrv_pending), 1);
+	}
+	free(client->outbox);
+	japi_shm_destroy(client->shm);
+	pushsrv_free_options(client);
+	free(client);
+
+	/* Without subscribers there is nobody to send a delta to */
+	if (psc->clients == NULL) {
+		json_object_put(psc->delta_prev);
+		psc->delta_prev = NULL;
+	}
+}
+
 /*
  * Remove the client socket for the respective push service
  */
 int japi_pushsrv_remove_client(japi_pushsrv_context *psc, int socket)
 {
-	japi_client *client, *prev;
+	japi_pushsrv_client *client, *prev;
 	int ret = -1;
 
 	/* Error handling */
@@ -102,7 +585,7 @@ int japi_pushsrv_remove_client(japi_pushsrv_context *psc, int socket)
 			psc->clients = client->next;
 			prntdbg("removing client %d from pushsrv %s\n", client->socket,
 					psc->pushsrv_name);
-			free(client);
+			pushsrv_free_client(psc, client);
 			ret = 0;
 			break;
 		}
@@ -111,7 +594,7 @@ int japi_pushsrv_remove_client(japi_pushsrv_context *psc, int socket)
 			prev->next = NULL;
 			prntdbg("removing client %d from pushsrv %s\n", client->socket,
 					psc->pushsrv_name);
-			free(client);
+			pushsrv_free_client(psc, client);
 			ret = 0;
 			break;
 		}
@@ -119,7 +602,7 @@ int japi_pushsrv_remove_client(japi_pushsrv_context *psc, int socket)
 			prev->next = client->next;
 			prntdbg("removing client %d from pushsrv %s\n", client->socket,
 					psc->pushsrv_name);
-			free(client);
+			pushsrv_free_client(psc, client);
 			ret = 0;
 			break;
 		}
@@ -132,97 +615,689 @@ int japi_pushsrv_remove_client(japi_pushsrv_context *psc, int socket)
 }
 
 /*
- * Removes clients from all push services
+ * Give up the ownership of a subscriber by its name subscription or by a number
+ * of wildcard subscriptions. The subscriber is removed once neither owns it
+ * anymore. Must be called with psc->lock held.
+ *
+ * Returns 1 if the subscriber was removed, 0 if it is still owned and -1 if
+ * the socket has no such subscription.
  */
-void japi_pushsrv_remove_client_from_all_pushsrv(japi_context *ctx, int socket)
+static int pushsrv_release_client(japi_pushsrv_context *psc, int socket, bool by_name,
+								  unsigned int patterns)
 {
-	japi_pushsrv_context *psc;
-
-	/* Error handling */
-	assert(ctx != NULL);
-	assert(socket >= 0);
+	japi_pushsrv_client **link;
+	japi_pushsrv_client *client;
 
-	prntdbg("removing client %i from all pushsrv\n", socket);
+	for (link = &(psc->clients); *link != NULL; link = &((*link)->next)) {
+		client = *link;
+		if (client->socket == socket &&
+			((by_name && client->by_name) || (!by_name && client->patterns > 0))) {
+			break;
+		}
+	}
+	if (*link == NULL) {
+		return -1;
+	}
 
-	psc = ctx->push_services;
-	while (psc != NULL) {
-		pthread_mutex_lock(&(psc->lock));
-		japi_pushsrv_remove_client(psc, socket);
-		pthread_mutex_unlock(&(psc->lock));
-		psc = psc->next;
+	if (by_name) {
+		client->by_name = false;
+	} else {
+		client->patterns -= (patterns < client->patterns) ? patterns : client->patterns;
+	}
+	if (client->by_name || client->patterns > 0) {
+		return 0;
 	}
+
+	*link = client->next;
+	prntdbg("removing client %d from pushsrv %s\n", client->socket, psc->pushsrv_name);
+	pushsrv_free_client(psc, client);
+
+	return 1;
+}
+
+/* Length of the first '/' separated segment of a service name */
+static size_t pushsrv_segment_len(const char *name)
+{
+	const char *end;
+
+	end = strchr(name, '/');
+	return (end != NULL) ? (size_t)(end - name) : strlen(name);
+}
+
+/* Check whether a trie node holds the given name segment */
+static bool pushsrv_segment_equal(japi_pushsrv_trie *node, const char *name, size_t len)
+{
+	return strlen(node->segment) == len && strncasecmp(node->segment, name, len) == 0;
 }
 
 /*
- * Saves client socket, if passed push service is registered
+ * Check whether a service name is a wildcard pattern. '*' matches exactly one
+ * segment, a trailing '#' matches one or more segments.
+ *
+ * Returns 1 for a pattern, 0 for a plain name and -1 for an invalid pattern.
  */
-void japi_pushsrv_subscribe(japi_context *ctx, json_object *jreq, json_object *jresp)
+static int pushsrv_is_pattern(const char *name)
 {
-	japi_pushsrv_context *psc;
-	json_object *jval;
-	const char *pushsrv_name;
-	int socket, ret;
+	size_t len;
+	int ret;
 
-	/* Error handling */
-	assert(ctx != NULL);
-	assert(jresp != NULL);
+	ret = 0;
+	for (;;) {
+		len = pushsrv_segment_len(name);
+		if (len == 1 && (name[0] == '*' || name[0] == '#')) {
+			if (name[0] == '#' && name[len] != '\0') {
+				return -1;
+			}
+			ret = 1;
+		}
+		if (name[len] == '\0') {
+			return ret;
+		}
+		name += len + 1;
+	}
+}
 
-	psc = ctx->push_services;
+/* Check whether a service name matches a pattern */
+static bool pushsrv_pattern_match(const char *pattern, const char *name)
+{
+	size_t plen, nlen;
 
-	/* Get the push service name */
-	if (!json_object_object_get_ex(jreq, "service", &jval) || jval == NULL) {
-		json_object_object_add(jresp, "success", json_object_new_boolean(false));
-		json_object_object_add(jresp, "message",
-							   json_object_new_string("Push service not found."));
-		return;
+	for (;;) {
+		plen = pushsrv_segment_len(pattern);
+		nlen = pushsrv_segment_len(name);
+		if (plen == 1 && pattern[0] == '#') {
+			return true;
+		}
+		if (!(plen == 1 && pattern[0] == '*') &&
+			(plen != nlen || strncasecmp(pattern, name, plen) != 0)) {
+			return false;
+		}
+		if (pattern[plen] == '\0' || name[nlen] == '\0') {
+			return pattern[plen] == '\0' && name[nlen] == '\0';
+		}
+		pattern += plen + 1;
+		name += nlen + 1;
 	}
-	pushsrv_name = json_object_get_string(jval);
-	ret = json_object_object_get_ex(jreq, "socket", &jval);
-	socket = json_object_get_int(jval);
-	if (!ret || socket < 0) {
-		json_object_object_add(jresp, "success", json_object_new_boolean(false));
-		json_object_object_add(
-			jresp, "message",
-			json_object_new_string("Subscribing push service to non-existing socket"));
+}
+
+/* Remove a push service from the name trie and prune nodes that became empty.
+ * Must be called with ctx->pushsrv_lock held. */
+static void pushsrv_trie_remove(japi_pushsrv_trie **level, const char *name,
+								japi_pushsrv_context *psc)
+{
+	japi_pushsrv_trie *node;
+	japi_pushsrv_context **link;
+	size_t len;
+
+	len = pushsrv_segment_len(name);
+	while (*level != NULL && !pushsrv_segment_equal(*level, name, len)) {
+		level = &((*level)->next);
+	}
+	node = *level;
+	if (node == NULL) {
 		return;
 	}
 
-	/* Search for push service in list and save socket, if found */
-	while (psc != NULL) {
-		if (strcasecmp(pushsrv_name, psc->pushsrv_name) == 0) {
-			ret = japi_pushsrv_add_client(psc, socket);
-			break;
+	if (name[len] == '\0') {
+		for (link = &(node->psc); *link != NULL; link = &((*link)->trie_next)) {
+			if (*link == psc) {
+				*link = psc->trie_next;
+				psc->trie_next = NULL;
+				break;
+			}
 		}
-		psc = psc->next;
+	} else {
+		pushsrv_trie_remove(&(node->children), name + len + 1, psc);
 	}
 
-	json_object_object_add(jresp, "service", json_object_new_string(pushsrv_name));
-
-	/* Create JSON response object */
-	if (psc == NULL || ret < 0) {
-		json_object_object_add(jresp, "success", json_object_new_boolean(false));
-		json_object_object_add(jresp, "message",
-							   json_object_new_string("Push service not found."));
-	} else {
-		json_object_object_add(jresp, "success", json_object_new_boolean(true));
+	if (node->psc == NULL && node->children == NULL) {
+		*level = node->next;
+		free(node->segment);
+		free(node);
 	}
 }
 
-/*
- * Removes client socket, if passed push service is registered
- */
+/* Add a push service to the name trie. Must be called with ctx->pushsrv_lock
+ * held. */
+static int pushsrv_trie_insert(japi_context *ctx, japi_pushsrv_context *psc)
+{
+	japi_pushsrv_trie **level;
+	japi_pushsrv_trie *node;
+	const char *name;
+	size_t len;
+
+	level = &(ctx->pushsrv_trie);
+	name = psc->pushsrv_name;
+	for (;;) {
+		len = pushsrv_segment_len(name);
+		node = *level;
+		while (node != NULL && !pushsrv_segment_equal(node, name, len)) {
+			node = node->next;
+		}
+
+		if (node == NULL) {
+			node = (japi_pushsrv_trie *)calloc(1, sizeof(japi_pushsrv_trie));
+			if (node == NULL || (node->segment = strndup(name, len)) == NULL) {
+				perror("ERROR: malloc() failed");
+				free(node);
+				/* Prune the nodes created so far */
+				pushsrv_trie_remove(&(ctx->pushsrv_trie), psc->pushsrv_name, psc);
+				return -1;
+			}
+			node->next = *level;
+			*level = node;
+		}
+
+		if (name[len] == '\0') {
+			/* Names are matched case-insensitively, but may be registered in
+			 * several cases */
+			psc->trie_next = node->psc;
+			node->psc = psc;
+			return 0;
+		}
+		name += len + 1;
+		level = &(node->children);
+	}
+}
+
+/* Subscribe the client of a wildcard subscription to a matching push service.
+ * If the client is subscribed already, the wildcard subscription becomes
+ * another owner of that subscriber. Must be called with ctx->pushsrv_lock
+ * held. */
+static int pushsrv_attach_pattern(japi_pushsrv_context *psc, japi_pushsrv_pattern *pattern)
+{
+	japi_pushsrv_client *client;
+	japi_pushsrv_client opts;
+	int ret;
+
+	pthread_mutex_lock(&(psc->lock));
+	for (client = psc->clients; client != NULL; client = client->next) {
+		if (client->socket == pattern->socket) {
+			client->patterns++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(psc->lock));
+	if (client != NULL) {
+		return 0;
+	}
+
+	if (pushsrv_copy_options(&opts, &(pattern->opts)) != 0) {
+		return -1;
+	}
+	opts.by_name = false;
+	opts.patterns = 1;
+	ret = japi_pushsrv_add_client(psc, pattern->socket, &opts, -1);
+	if (ret == -1) {
+		pushsrv_free_options(&opts);
+	}
+	if (ret < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Operation applied to the push services matching a pattern */
+typedef struct {
+	japi_pushsrv_pattern *pattern; /* Wildcard subscription to attach or NULL */
+	int socket; /* Socket to unsubscribe, if pattern is NULL */
+	unsigned int released; /* Number of removed wildcard subscriptions */
+	json_object *jservices; /* Names of the subscribed or unsubscribed services */
+} pushsrv_match_op;
+
+/* Apply op to a matching push service */
+static void pushsrv_match_apply(japi_pushsrv_context *psc, pushsrv_match_op *op)
+{
+	int ret;
+
+	if (op->pattern != NULL) {
+		if (pushsrv_attach_pattern(psc, op->pattern) != 0) {
+			return;
+		}
+	} else {
+		/* Subscriptions by name or by other patterns keep the subscriber */
+		pthread_mutex_lock(&(psc->lock));
+		ret = pushsrv_release_client(psc, op->socket, false, op->released);
+		pthread_mutex_unlock(&(psc->lock));
+		if (ret != 1) {
+			return;
+		}
+	}
+	json_object_array_add(op->jservices, json_object_new_string(psc->pushsrv_name));
+}
+
+/* Apply op to the push services of a trie node */
+static void pushsrv_node_apply(japi_pushsrv_trie *node, pushsrv_match_op *op)
+{
+	japi_pushsrv_context *psc;
+
+	for (psc = node->psc; psc != NULL; psc = psc->trie_next) {
+		pushsrv_match_apply(psc, op);
+	}
+}
+
+/* Apply op to all push services below a trie node */
+static void pushsrv_trie_apply_all(japi_pushsrv_trie *node, pushsrv_match_op *op)
+{
+	for (; node != NULL; node = node->next) {
+		pushsrv_node_apply(node, op);
+		pushsrv_trie_apply_all(node->children, op);
+	}
+}
+
+/* Apply op to all push services in the trie matching a pattern. Must be called
+ * with ctx->pushsrv_lock held. */
+static void pushsrv_trie_match(japi_pushsrv_trie *level, const char *pattern,
+							   pushsrv_match_op *op)
+{
+	japi_pushsrv_trie *node;
+	size_t len;
+
+	len = pushsrv_segment_len(pattern);
+	if (len == 1 && pattern[0] == '#') {
+		pushsrv_trie_apply_all(level, op);
+		return;
+	}
+
+	for (node = level; node != NULL; node = node->next) {
+		if (!(len == 1 && pattern[0] == '*') &&
+			!pushsrv_segment_equal(node, pattern, len)) {
+			continue;
+		}
+		if (pattern[len] == '\0') {
+			pushsrv_node_apply(node, op);
+		} else {
+			pushsrv_trie_match(node->children, pattern + len + 1, op);
+		}
+	}
+}
+
+/* Remove the wildcard subscriptions of a socket. If pattern is NULL, all
+ * wildcard subscriptions of the socket are removed. Must be called with
+ * ctx->pushsrv_lock held.
+ *
+ * Returns the number of removed subscriptions.
+ */
+static int pushsrv_remove_patterns(japi_context *ctx, const char *pattern, int socket)
+{
+	japi_pushsrv_pattern **link;
+	japi_pushsrv_pattern *entry;
+	int removed;
+
+	removed = 0;
+	link = &(ctx->pushsrv_patterns);
+	while (*link != NULL) {
+		entry = *link;
+		if (entry->socket == socket &&
+			(pattern == NULL || strcasecmp(entry->pattern, pattern) == 0)) {
+			*link = entry->next;
+			pushsrv_free_options(&(entry->opts));
+			free(entry->pattern);
+			free(entry);
+			removed++;
+		} else {
+			link = &(entry->next);
+		}
+	}
+
+	return removed;
+}
+
+void japi_pushsrv_patterns_destroy(japi_context *ctx)
+{
+	japi_pushsrv_pattern *entry;
+
+	while (ctx->pushsrv_patterns != NULL) {
+		entry = ctx->pushsrv_patterns;
+		ctx->pushsrv_patterns = entry->next;
+		pushsrv_free_options(&(entry->opts));
+		free(entry->pattern);
+		free(entry);
+	}
+}
+
+/*
+ * Removes clients from all push services
+ */
+void japi_pushsrv_remove_client_from_all_pushsrv(japi_context *ctx, int socket)
+{
+	japi_pushsrv_context *psc;
+
+	/* Error handling */
+	assert(ctx != NULL);
+	assert(socket >= 0);
+
+	prntdbg("removing client %i from all pushsrv\n", socket);
+
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	psc = ctx->push_services;
+	while (psc != NULL) {
+		pthread_mutex_lock(&(psc->lock));
+		japi_pushsrv_remove_client(psc, socket);
+		pthread_mutex_unlock(&(psc->lock));
+		psc = psc->next;
+	}
+	pushsrv_remove_patterns(ctx, NULL, socket);
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+}
+
+/* Subscribe a socket to all current and future push services matching a
+ * pattern. Takes ownership of the filter options in opts. */
+static void pushsrv_subscribe_pattern(japi_context *ctx, const char *pattern, int socket,
+									  japi_pushsrv_client *opts, json_object *jresp)
+{
+	japi_pushsrv_pattern *entry;
+	pushsrv_match_op op;
+
+	json_object_object_add(jresp, "service", json_object_new_string(pattern));
+
+	if (pushsrv_is_pattern(pattern) < 0) {
+		pushsrv_free_options(opts);
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(
+			jresp, "message",
+			json_object_new_string("Invalid pattern, '#' must be the last segment."));
+		return;
+	}
+
+	entry = (japi_pushsrv_pattern *)malloc(sizeof(japi_pushsrv_pattern));
+	if (entry == NULL || (entry->pattern = strdup(pattern)) == NULL) {
+		perror("ERROR: malloc() failed");
+		free(entry);
+		pushsrv_free_options(opts);
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(jresp, "message", json_object_new_string("Out of memory."));
+		return;
+	}
+	entry->socket = socket;
+	entry->opts = *opts;
+
+	op.pattern = entry;
+	op.socket = socket;
+	op.released = 0;
+	op.jservices = json_object_new_array();
+
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	entry->next = ctx->pushsrv_patterns;
+	ctx->pushsrv_patterns = entry;
+	pushsrv_trie_match(ctx->pushsrv_trie, pattern, &op);
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	json_object_object_add(jresp, "services", op.jservices);
+	json_object_object_add(jresp, "success", json_object_new_boolean(true));
+}
+
+/* Remove a wildcard subscription and unsubscribe the socket from all push
+ * services matching the pattern */
+static void pushsrv_unsubscribe_pattern(japi_context *ctx, const char *pattern,
+										int socket, json_object *jresp)
+{
+	pushsrv_match_op op;
+	int removed;
+
+	op.pattern = NULL;
+	op.socket = socket;
+	op.jservices = json_object_new_array();
+
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	removed = pushsrv_remove_patterns(ctx, pattern, socket);
+	if (removed > 0) {
+		op.released = (unsigned int)removed;
+		pushsrv_trie_match(ctx->pushsrv_trie, pattern, &op);
+	}
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	json_object_object_add(jresp, "service", json_object_new_string(pattern));
+
+	if (removed > 0) {
+		json_object_object_add(jresp, "services", op.jservices);
+		json_object_object_add(jresp, "success", json_object_new_boolean(true));
+	} else {
+		json_object_put(op.jservices);
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(
+			jresp, "message",
+			json_object_new_string(
+				"Can't unsubscribe a service that wasn't subscribed before."));
+	}
+}
+
+/* Create a shared memory ring for a subscriber and pass its file descriptor
+ * over the Unix domain socket, attached to a line announcing the ring. Must be
+ * called before the subscriber is added, so its first messages go to the ring,
+ * and without holding ctx->pushsrv_lock, as sending may block.
+ *
+ * Returns NULL on success, otherwise a message describing the error. */
+static const char *pushsrv_send_shm(int socket, const char *pushsrv_name, size_t size,
+									japi_shm_producer **shm)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	json_object *jnotice;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	char *line;
+	ssize_t ret;
+	int fd;
+
+	addrlen = sizeof(addr);
+	if (getsockname(socket, (struct sockaddr *)&addr, &addrlen) != 0 ||
+		addr.ss_family != AF_UNIX) {
+		return "Shared memory requires a Unix domain socket.";
+	}
+
+	*shm = japi_shm_create(size, &fd);
+	if (*shm == NULL) {
+		return "Failed to create shared memory.";
+	}
+
+	jnotice = json_object_new_object();
+	json_object_object_add(jnotice, "japi_pushsrv_shm", json_object_new_string(pushsrv_name));
+	json_object_object_add(jnotice, "size", json_object_new_int64((*shm)->size));
+	line = japi_get_jobj_as_ndstr(jnotice);
+	json_object_put(jnotice);
+
+	memset(&mh, 0, sizeof(mh));
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = line;
+	iov.iov_len = strlen(line);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	do {
+		ret = sendmsg(socket, &mh, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	/* The descriptor is passed on with the first byte, the rest is a plain line */
+	if (ret > 0 && (size_t)ret < iov.iov_len &&
+		write_n(socket, line + ret, iov.iov_len - ret) <= 0) {
+		ret = -1;
+	}
+	free(line);
+	close(fd);
+
+	if (ret <= 0) {
+		japi_shm_destroy(*shm);
+		*shm = NULL;
+		return "Failed to pass shared memory.";
+	}
+
+	return NULL;
+}
+
+/*
+ * Saves client socket, if passed push service is registered
+ */
+void japi_pushsrv_subscribe(japi_context *ctx, json_object *jreq, json_object *jresp)
+{
+	japi_pushsrv_context *psc;
+	japi_pushsrv_client opts;
+	json_object *jval;
+	const char *pushsrv_name;
+	const char *errmsg;
+	int64_t since_seq;
+	size_t shm_size;
+	int socket, ret;
+
+	/* Error handling */
+	assert(ctx != NULL);
+	assert(jresp != NULL);
+
+	/* Get the push service name */
+	if (!json_object_object_get_ex(jreq, "service", &jval) || jval == NULL) {
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(jresp, "message",
+							   json_object_new_string("Push service not found."));
+		return;
+	}
+	pushsrv_name = json_object_get_string(jval);
+	ret = json_object_object_get_ex(jreq, "socket", &jval);
+	socket = json_object_get_int(jval);
+	if (!ret || socket < 0) {
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(
+			jresp, "message",
+			json_object_new_string("Subscribing push service to non-existing socket"));
+		return;
+	}
+
+	errmsg = pushsrv_parse_options(jreq, &opts);
+	if (errmsg != NULL) {
+		json_object_object_add(jresp, "service", json_object_new_string(pushsrv_name));
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(jresp, "message", json_object_new_string(errmsg));
+		return;
+	}
+
+	/* Deliver messages through a shared memory ring of the given size */
+	shm_size = 0;
+	if (json_object_object_get_ex(jreq, "shm", &jval)) {
+		if (!json_object_is_type(jval, json_type_int) ||
+			json_object_get_int64(jval) < JAPI_SHM_MIN_SIZE ||
+			json_object_get_int64(jval) > (int64_t)JAPI_SHM_MAX_SIZE) {
+			errmsg = "Invalid shm, expecting a size in bytes between 4 KiB and 1 GiB.";
+		} else if (pushsrv_is_pattern(pushsrv_name) != 0) {
+			errmsg = "Shared memory is not supported for wildcard subscriptions.";
+		}
+		if (errmsg != NULL) {
+			pushsrv_free_options(&opts);
+			json_object_object_add(jresp, "service",
+								   json_object_new_string(pushsrv_name));
+			json_object_object_add(jresp, "success", json_object_new_boolean(false));
+			json_object_object_add(jresp, "message", json_object_new_string(errmsg));
+			return;
+		}
+		shm_size = (size_t)json_object_get_int64(jval);
+	}
+
+	/* A wildcard subscription covers all current and future matching services */
+	if (pushsrv_is_pattern(pushsrv_name) != 0) {
+		pushsrv_subscribe_pattern(ctx, pushsrv_name, socket, &opts, jresp);
+		return;
+	}
+
+	/* Messages to replay for a reconnecting client */
+	since_seq = -1;
+	if (json_object_object_get_ex(jreq, "since_seq", &jval)) {
+		if (!json_object_is_type(jval, json_type_int) ||
+			json_object_get_int64(jval) < 0) {
+			pushsrv_free_options(&opts);
+			json_object_object_add(jresp, "service",
+								   json_object_new_string(pushsrv_name));
+			json_object_object_add(jresp, "success", json_object_new_boolean(false));
+			json_object_object_add(
+				jresp, "message",
+				json_object_new_string(
+					"Invalid since_seq, expecting a non-negative integer."));
+			return;
+		}
+		since_seq = json_object_get_int64(jval);
+	}
+
+	/* Passing the ring may block, so it is done without holding the lock.
+	 * Unknown push services get no ring announced. */
+	if (shm_size > 0) {
+		pthread_mutex_lock(&(ctx->pushsrv_lock));
+		psc = pushsrv_lookup(ctx, pushsrv_name);
+		pthread_mutex_unlock(&(ctx->pushsrv_lock));
+		if (psc != NULL) {
+			errmsg = pushsrv_send_shm(socket, pushsrv_name, shm_size, &(opts.shm));
+		}
+	}
+
+	/* Look up push service and save socket, if found */
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	psc = pushsrv_lookup(ctx, pushsrv_name);
+	if (psc == NULL) {
+		/* The push service was removed while the ring was passed */
+		japi_shm_destroy(opts.shm);
+	} else if (errmsg == NULL) {
+		ret = japi_pushsrv_add_client(psc, socket, &opts, since_seq);
+		if (ret == -1) {
+			japi_shm_destroy(opts.shm);
+		} else if (ret == -2) {
+			/* The options were freed along with the client */
+			opts.filter_key = NULL;
+			opts.filter = NULL;
+			opts.fields = NULL;
+			errmsg = "Failed to send to the client.";
+		}
+	}
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	if (errmsg != NULL) {
+		pushsrv_free_options(&opts);
+		json_object_object_add(jresp, "service", json_object_new_string(pushsrv_name));
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(jresp, "message", json_object_new_string(errmsg));
+		return;
+	}
+
+	json_object_object_add(jresp, "service", json_object_new_string(pushsrv_name));
+
+	/* Create JSON response object */
+	if (psc == NULL || ret < 0) {
+		pushsrv_free_options(&opts);
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(jresp, "message",
+							   json_object_new_string("Push service not found."));
+	} else {
+		json_object_object_add(jresp, "success", json_object_new_boolean(true));
+		if (since_seq >= 0) {
+			json_object_object_add(jresp, "replay_complete",
+								   json_object_new_boolean(ret == 0));
+		}
+	}
+}
+
+/*
+ * Removes client socket, if passed push service is registered
+ */
 void japi_pushsrv_unsubscribe(japi_context *ctx, json_object *jreq, json_object *jresp)
 {
 	japi_pushsrv_context *psc;
 	json_object *jval;
 	const char *pushsrv_name;
+	unsigned long hash;
 	int ret, socket;
 
 	/* Error handling */
 	assert(ctx != NULL);
 	assert(jresp != NULL);
 
-	psc = ctx->push_services;
 	bool registered = false; /* Service registered? */
 	bool unsubscribed = false; /* Service unsubscribed? */
 
@@ -246,266 +1321,1685 @@ void japi_pushsrv_unsubscribe(japi_context *ctx, json_object *jreq, json_object
 		return;
 	}
 
-	/* Search for push service in list and remove socket, if found & socket is
-	 * registered */
+	if (pushsrv_is_pattern(pushsrv_name) != 0) {
+		pushsrv_unsubscribe_pattern(ctx, pushsrv_name, socket, jresp);
+		return;
+	}
+
+	/* Search for push service in its hash bucket and remove socket, if found &
+	 * socket is registered */
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	hash = pushsrv_hash(pushsrv_name);
+	psc = NULL;
+	if (ctx->pushsrv_index != NULL) {
+		psc = ctx->pushsrv_index[hash % ctx->pushsrv_index_size];
+	}
 	while (psc != NULL) {
-		if (strcasecmp(pushsrv_name, psc->pushsrv_name) == 0) {
+		if (psc->index_hash == hash && strcasecmp(pushsrv_name, psc->pushsrv_name) == 0) {
 			registered = true;
-			if (japi_pushsrv_remove_client(psc, socket) >= 0) {
+			pthread_mutex_lock(&(psc->lock));
+			ret = pushsrv_release_client(psc, socket, true, 0);
+			pthread_mutex_unlock(&(psc->lock));
+			if (ret >= 0) {
 				unsubscribed = true;
 				break;
 			}
 		}
-		psc = psc->next;
+		psc = psc->index_next;
+	}
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	json_object_object_add(jresp, "service", json_object_new_string(pushsrv_name));
+
+	/* Create JSON response object */
+	if (registered && unsubscribed) { /* Subscribed */
+		json_object_object_add(jresp, "success", json_object_new_boolean(true));
+	} else if (registered && !unsubscribed) { /* Registered, but not subscribed */
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(
+			jresp, "message",
+			json_object_new_string(
+				"Can't unsubscribe a service that wasn't subscribed before."));
+	} else { /* Not registered */
+		json_object_object_add(jresp, "success", json_object_new_boolean(false));
+		json_object_object_add(jresp, "message",
+							   json_object_new_string("Push service not found."));
+	}
+}
+
+/* Check if there is a duplicate name for a request.
+ * Must be called with ctx->pushsrv_lock held. */
+static bool pushsrv_isredundant(japi_context *ctx, const char *pushsrv_name)
+{
+	japi_pushsrv_context *psc;
+	bool duplicate;
+
+	duplicate = false;
+	if (ctx->pushsrv_index == NULL) {
+		return duplicate;
+	}
+
+	psc = ctx->pushsrv_index[pushsrv_hash(pushsrv_name) % ctx->pushsrv_index_size];
+	while (psc != NULL) {
+		if (strcmp(psc->pushsrv_name, pushsrv_name) == 0) {
+			duplicate = true;
+			break;
+		}
+		psc = psc->index_next;
+	}
+	return duplicate;
+}
+
+/* Initialize locks and condition variable of a push service */
+static int pushsrv_init_sync(japi_pushsrv_context *psc)
+{
+	pthread_condattr_t attr;
+	int ret;
+
+	if (pthread_mutex_init(&(psc->lock), NULL) != 0) {
+		return -1;
+	}
+	if (pthread_mutex_init(&(psc->wait_lock), NULL) != 0) {
+		pthread_mutex_destroy(&(psc->lock));
+		return -1;
+	}
+
+	/* japi_pushsrv_wait() uses the clock of the scheduler */
+	pthread_condattr_init(&attr);
+#ifndef __APPLE__
+	pthread_condattr_setclock(&attr, JAPI_PUSHSRV_SCHED_CLOCK);
+#endif
+	ret = pthread_cond_init(&(psc->wait_cond), &attr);
+	pthread_condattr_destroy(&attr);
+	if (ret != 0) {
+		pthread_mutex_destroy(&(psc->wait_lock));
+		pthread_mutex_destroy(&(psc->lock));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Destroy locks and condition variable of a push service */
+static void pushsrv_destroy_sync(japi_pushsrv_context *psc)
+{
+	pthread_cond_destroy(&(psc->wait_cond));
+	pthread_mutex_destroy(&(psc->wait_lock));
+	pthread_mutex_destroy(&(psc->lock));
+}
+
+/* Free the replay ring of a push service */
+static void pushsrv_free_replay(japi_pushsrv_context *psc)
+{
+	unsigned int i;
+
+	if (psc->replay == NULL) {
+		return;
+	}
+	for (i = 0; i < psc->replay_size; i++) {
+		free(psc->replay[i].msg);
+	}
+	free(psc->replay);
+	psc->replay = NULL;
+	psc->replay_size = 0;
+}
+
+/* Free memory for duplicated push service name and element */
+static void free_pushsrv(japi_pushsrv_context *psc)
+{
+	pushsrv_free_replay(psc);
+	if (psc->last_msg != NULL) {
+		free(psc->last_msg->msg);
+		free(psc->last_msg);
+	}
+	json_object_put(psc->delta_prev);
+	free(psc->pushsrv_name);
+	free(psc);
+}
+
+/*
+ * Registers push-service and returns pointer to that service object.
+ */
+japi_pushsrv_context *japi_pushsrv_register(japi_context *ctx, const char *pushsrv_name)
+{
+	japi_pushsrv_context *psc;
+	japi_pushsrv_pattern *pattern;
+	size_t bucket;
+	bool resized;
+
+	if (ctx == NULL) {
+		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
+		return NULL;
+	}
+
+	if ((pushsrv_name == NULL) || (strcmp(pushsrv_name, "") == 0)) {
+		fprintf(stderr, "ERROR: Push service name is NULL or empty.\n");
+		return NULL;
+	}
+
+	/* Reserve memory for japi_pushsrv_context struct */
+	psc = (japi_pushsrv_context *)malloc(sizeof(japi_pushsrv_context));
+	if (psc == NULL) {
+		perror("ERROR: malloc() failed");
+		return NULL;
+	}
+
+	/* Duplicate string in case that pushsrv_name comes from
+	a namespace that is left after this function */
+	psc->pushsrv_name = strdup(pushsrv_name);
+	if (psc->pushsrv_name == NULL) {
+		free(psc);
+		return NULL;
+	}
+
+	/* Initialize struct */
+	psc->thread_id = 0;
+	psc->routine = NULL;
+	psc->clients = NULL;
+	psc->conflate = false;
+	psc->seq = 0;
+	psc->replay = NULL;
+	psc->replay_size = 0;
+	psc->snapshot = NULL;
+	psc->last_msg = NULL;
+	psc->delta_interval = 0;
+	psc->delta_count = 0;
+	psc->delta_prev = NULL;
+	psc->coalesce_us = 0;
+	psc->enabled = false;
+	psc->userptr = ctx->userptr;
+	psc->index_next = NULL;
+	psc->index_hash = pushsrv_hash(pushsrv_name);
+	psc->trie_next = NULL;
+	psc->ctx = ctx;
+	psc->interval_ms = 0;
+	psc->sched_deadline = 0;
+	psc->sched_pos = JAPI_PUSHSRV_SCHED_NPOS;
+	psc->sched_queued = false;
+	psc->sched_running = false;
+	psc->sched_next = NULL;
+	psc->joinable = false;
+
+	if (pushsrv_init_sync(psc) != 0) {
+		fprintf(stderr, "ERROR: mutex initialization has failed\n");
+		free_pushsrv(psc);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+
+	if (pushsrv_isredundant(ctx, pushsrv_name)) {
+		pthread_mutex_unlock(&(ctx->pushsrv_lock));
+		fprintf(stderr, "ERROR: A push service called '%s' was already registered.\n",
+				pushsrv_name);
+		pushsrv_destroy_sync(psc);
+		free_pushsrv(psc);
+		return NULL;
+	}
+
+	if (pushsrv_trie_insert(ctx, psc) != 0) {
+		pthread_mutex_unlock(&(ctx->pushsrv_lock));
+		pushsrv_destroy_sync(psc);
+		free_pushsrv(psc);
+		return NULL;
+	}
+
+	/* Point to last struct */
+	psc->next = ctx->push_services;
+	ctx->push_services = psc;
+	ctx->num_push_services++;
+
+	/* Add to hash index. A resize rebuilds the index from the list and thereby
+	 * includes the new entry. */
+	resized = false;
+	if (ctx->pushsrv_index == NULL) {
+		if (pushsrv_index_resize(ctx, JAPI_PUSHSRV_INDEX_SIZE) != 0) {
+			ctx->push_services = psc->next;
+			ctx->num_push_services--;
+			pushsrv_trie_remove(&(ctx->pushsrv_trie), psc->pushsrv_name, psc);
+			pthread_mutex_unlock(&(ctx->pushsrv_lock));
+			pushsrv_destroy_sync(psc);
+			free_pushsrv(psc);
+			return NULL;
+		}
+		resized = true;
+	} else if (ctx->num_push_services > ctx->pushsrv_index_size) {
+		/* If growing fails, the current index is kept with a higher load */
+		resized = (pushsrv_index_resize(ctx, 2 * ctx->pushsrv_index_size) == 0);
+	}
+
+	if (!resized) {
+		bucket = psc->index_hash % ctx->pushsrv_index_size;
+		psc->index_next = ctx->pushsrv_index[bucket];
+		ctx->pushsrv_index[bucket] = psc;
+	}
+
+	/* Pick up wildcard subscriptions matching the new push service */
+	for (pattern = ctx->pushsrv_patterns; pattern != NULL; pattern = pattern->next) {
+		if (pushsrv_pattern_match(pattern->pattern, psc->pushsrv_name)) {
+			pushsrv_attach_pattern(psc, pattern);
+		}
+	}
+
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	return psc;
+}
+
+/*
+ * Remove push service context from japi context, unsubscribe for all clients and free
+ * memory
+ */
+int japi_pushsrv_destroy(japi_context *ctx, japi_pushsrv_context *psc)
+{
+	japi_pushsrv_context *psc_iter, *psc_prev, *psc_next;
+	japi_pushsrv_context **slot;
+	japi_pushsrv_client *client, *client_next;
+
+	assert(ctx != NULL);
+
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: push service context is NULL\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+
+	/* clean up linked list in ctx->push_service */
+	psc_prev = NULL;
+	psc_iter = ctx->push_services;
+
+	while (psc_iter != NULL) {
+		psc_next = psc_iter->next;
+		if (psc_iter == psc) {
+			/* If first element */
+			if (psc_prev == NULL) {
+				ctx->push_services = psc_next;
+			} else {
+				psc_prev->next = psc_next;
+			}
+			break;
+		}
+		psc_prev = psc_iter;
+		psc_iter = psc_next;
+	}
+
+	/* Remove from hash bucket */
+	if (psc_iter != NULL) {
+		slot = &(ctx->pushsrv_index[psc->index_hash % ctx->pushsrv_index_size]);
+		while (*slot != NULL && *slot != psc) {
+			slot = &((*slot)->index_next);
+		}
+		if (*slot != NULL) {
+			*slot = psc->index_next;
+		}
+		ctx->num_push_services--;
+		pushsrv_trie_remove(&(ctx->pushsrv_trie), psc->pushsrv_name, psc);
+	}
+
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	/* Iterates through push service client list and frees memory for every element and
+	 * for the push service themself */
+	client = psc->clients;
+	pthread_mutex_lock(&(psc->lock));
+	while (client != NULL) {
+		client_next = client->next;
+		japi_pushsrv_remove_client(psc, client->socket);
+		client = client_next;
+	}
+	pthread_mutex_unlock(&(psc->lock));
+
+	japi_pushsrv_stop(psc);
+
+	pushsrv_destroy_sync(psc);
+	free_pushsrv(psc);
+
+	return 0;
+}
+
+/*
+ * Provide the names of all registered push-services as a JAPI response.
+ */
+void japi_pushsrv_list(japi_context *ctx, json_object *request, json_object *response)
+{
+	japi_pushsrv_context *psc;
+	json_object *jstring;
+	json_object *jarray;
+
+	assert(ctx != NULL);
+	assert(response != NULL);
+
+	jarray = json_object_new_array();
+
+	/* Iterate through push service list and return JSON object  */
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	psc = ctx->push_services;
+	while (psc != NULL) {
+		jstring = json_object_new_string(psc->pushsrv_name); /* Create JSON-string */
+		json_object_array_add(jarray, jstring); /* Add string to JSON array */
+		psc = psc->next;
+	}
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	/* Add array to JSON-object */
+	json_object_object_add(response, "services", jarray);
+}
+
+/* Send the outboxes of all subscribers, or without blocking only those whose
+ * coalescing window has passed. Must be called with psc->lock held. */
+static void pushsrv_flush_outboxes(japi_pushsrv_context *psc, bool all)
+{
+	japi_pushsrv_client *client, *following_client;
+	uint64_t now;
+
+	now = pushsrv_now_us();
+	client = psc->clients;
+	while (client != NULL) {
+		following_client = client->next;
+		if (client->outbox_len > 0 &&
+			(all || now - client->outbox_since_us >= psc->coalesce_us) &&
+			pushsrv_flush_outbox(psc, client, all) < 0) {
+			fprintf(stderr, "ERROR: Failed to send push service message to client %i\n",
+					client->socket);
+			japi_pushsrv_remove_client(psc, client->socket);
+		}
+		client = following_client;
+	}
+}
+
+/*
+ * Enable or disable latest-value mode
+ */
+int japi_pushsrv_set_conflate(japi_pushsrv_context *psc, bool conflate)
+{
+	japi_pushsrv_client *client;
+
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: push service context is NULL\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(psc->lock));
+	psc->conflate = conflate;
+	if (conflate) {
+		/* Messages are not coalesced in latest-value mode */
+		pushsrv_flush_outboxes(psc, true);
+	} else {
+		/* Pending messages are not delivered anymore */
+		client = psc->clients;
+		while (client != NULL) {
+			pushsrv_drop_pending(psc, client);
+			client = client->next;
+		}
+	}
+	pthread_mutex_unlock(&(psc->lock));
+
+	return 0;
+}
+
+/*
+ * Set the number of messages kept for replay
+ */
+int japi_pushsrv_set_replay(japi_pushsrv_context *psc, unsigned int size)
+{
+	japi_pushsrv_replay *replay;
+
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: push service context is NULL\n");
+		return -1;
+	}
+
+	replay = NULL;
+	if (size > 0) {
+		replay = (japi_pushsrv_replay *)calloc(size, sizeof(japi_pushsrv_replay));
+		if (replay == NULL) {
+			perror("ERROR: calloc() failed");
+			return -2;
+		}
+	}
+
+	pthread_mutex_lock(&(psc->lock));
+	pushsrv_free_replay(psc);
+	psc->replay = replay;
+	psc->replay_size = size;
+	pthread_mutex_unlock(&(psc->lock));
+
+	return 0;
+}
+
+/*
+ * Set the snapshot callback for new subscribers
+ */
+int japi_pushsrv_set_snapshot(japi_pushsrv_context *psc, japi_pushsrv_snapshot snapshot)
+{
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: push service context is NULL\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(psc->lock));
+	psc->snapshot = snapshot;
+	pthread_mutex_unlock(&(psc->lock));
+
+	return 0;
+}
+
+/*
+ * Enable or disable caching the last message for new subscribers
+ */
+int japi_pushsrv_set_snapshot_cache(japi_pushsrv_context *psc, bool enable)
+{
+	japi_pushsrv_replay *last_msg;
+
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: push service context is NULL\n");
+		return -1;
+	}
+
+	last_msg = NULL;
+	if (enable) {
+		last_msg = (japi_pushsrv_replay *)calloc(1, sizeof(japi_pushsrv_replay));
+		if (last_msg == NULL) {
+			perror("ERROR: calloc() failed");
+			return -2;
+		}
+	}
+
+	pthread_mutex_lock(&(psc->lock));
+	if (psc->last_msg != NULL && enable) {
+		/* Keep the cached message */
+		free(last_msg);
+		last_msg = psc->last_msg;
+	} else if (psc->last_msg != NULL) {
+		free(psc->last_msg->msg);
+		free(psc->last_msg);
+	}
+	psc->last_msg = last_msg;
+	pthread_mutex_unlock(&(psc->lock));
+
+	return 0;
+}
+
+/*
+ * Enable or disable delta mode
+ */
+int japi_pushsrv_set_delta(japi_pushsrv_context *psc, unsigned int keyframe_interval)
+{
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: push service context is NULL\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(psc->lock));
+	psc->delta_interval = keyframe_interval;
+	psc->delta_count = 0;
+	json_object_put(psc->delta_prev);
+	psc->delta_prev = NULL;
+	pthread_mutex_unlock(&(psc->lock));
+
+	return 0;
+}
+
+/*
+ * Set the coalescing window of a push service
+ */
+int japi_pushsrv_set_coalesce(japi_pushsrv_context *psc, unsigned int window_us)
+{
+	japi_context *ctx;
+
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: push service context is NULL\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&(psc->lock));
+	psc->coalesce_us = window_us;
+	if (window_us == 0) {
+		pushsrv_flush_outboxes(psc, true);
+	}
+	pthread_mutex_unlock(&(psc->lock));
+
+	/* The server loop polls at least once per smallest coalescing window */
+	ctx = psc->ctx;
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	ctx->pushsrv_coalesce_us = 0;
+	for (psc = ctx->push_services; psc != NULL; psc = psc->next) {
+		if (psc->coalesce_us > 0 && (ctx->pushsrv_coalesce_us == 0 ||
+									 psc->coalesce_us < ctx->pushsrv_coalesce_us)) {
+			ctx->pushsrv_coalesce_us = psc->coalesce_us;
+		}
+	}
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+
+	return 0;
+}
+
+/* Append a message to the outbox of a subscriber. The outbox is sent once the
+ * coalescing window of its first message has passed or it grew large. Must be
+ * called with psc->lock held.
+ *
+ * Returns 1 on success and -1 on error. */
+static int pushsrv_send_coalesced(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+								  const char *msg, size_t len, uint64_t now)
+{
+	if (pushsrv_outbox_append(psc, client, msg, len, now) != 0) {
+		return -1;
+	}
+
+	if (now - client->outbox_since_us >= psc->coalesce_us ||
+		client->outbox_len >= JAPI_PUSHSRV_OUTBOX_MAX) {
+		return pushsrv_flush_outbox(psc, client, true);
+	}
+
+	return 1;
+}
+
+/* Send message to a subscriber without blocking on a full socket buffer.
+ *
+ * If nothing could be sent, the message replaces the pending message of the
+ * subscriber. A partially sent message is completed with a blocking write, so
+ * messages are never interleaved on the socket.
+ * Must be called with psc->lock held.
+ *
+ * Returns 1 if the message was sent, 0 if it is pending and -1 on error.
+ */
+static int pushsrv_send_conflated(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+								  const char *msg, size_t len)
+{
+	ssize_t ret;
+
+	/* Messages queued on subscribe go first */
+	ret = pushsrv_flush_outbox(psc, client, false);
+	if (ret < 0) {
+		return -1;
+	}
+	if (ret > 0) {
+		do {
+			ret = send(client->socket, msg, len, MSG_DONTWAIT);
+		} while (ret < 0 && errno == EINTR);
+	} else {
+		ret = -1;
+		errno = EAGAIN;
+	}
+
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		if (client->pending != msg) {
+			pushsrv_drop_pending(psc, client);
+			client->pending = strdup(msg);
+			if (client->pending == NULL) {
+				perror("ERROR: strdup() failed");
+				return -1;
+			}
+			__sync_add_and_fetch(&(psc->ctx->pushsrv_pending), 1);
+		}
+		return 0;
+	}
+	if (ret < 0) {
+		return -1;
+	}
+
+	/* Complete a partially sent message */
+	if ((size_t)ret < len && write_n(client->socket, msg + ret, len - ret) <= 0) {
+		return -1;
+	}
+
+	pushsrv_drop_pending(psc, client);
+
+	return 1;
+}
+
+/*
+ * Try to deliver pending messages of push services in latest-value mode
+ */
+void japi_pushsrv_flush(japi_context *ctx)
+{
+	japi_pushsrv_context *psc;
+	japi_pushsrv_client *client, *following_client;
+
+	assert(ctx != NULL);
+
+	if (ctx->pushsrv_pending == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	psc = ctx->push_services;
+	while (psc != NULL) {
+		pthread_mutex_lock(&(psc->lock));
+		client = psc->clients;
+		while (client != NULL) {
+			following_client = client->next;
+			if (client->pending != NULL &&
+				pushsrv_send_conflated(psc, client, client->pending,
+									   strlen(client->pending)) < 0) {
+				fprintf(stderr,
+						"ERROR: Failed to send push service message to client %i\n",
+						client->socket);
+				japi_pushsrv_remove_client(psc, client->socket);
+			}
+			client = following_client;
+		}
+		pushsrv_flush_outboxes(psc, false);
+		pthread_mutex_unlock(&(psc->lock));
+		psc = psc->next;
+	}
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+}
+
+/* Check whether a message is due for a subscriber with decimation or rate limit.
+ * Must be called with psc->lock held. */
+static bool pushsrv_client_due(japi_pushsrv_client *client, uint64_t now)
+{
+	bool due;
+
+	/* Deliver the first and then every n-th message */
+	due = (client->decimation_count == 0);
+	client->decimation_count = (client->decimation_count + 1) % client->decimation;
+	if (!due) {
+		return false;
+	}
+
+	if (client->min_interval_us != 0) {
+		if (client->last_sent_us != 0 &&
+			now - client->last_sent_us < client->min_interval_us) {
+			return false;
+		}
+		client->last_sent_us = now;
+	}
+
+	return true;
+}
+
+/* Build the newline terminated push message string with the message data stored
+ * under key */
+static char *pushsrv_serialize(japi_pushsrv_context *psc, const char *key,
+							   json_object *jmsg_data, uint64_t seq)
+{
+	json_object *jmsg;
+	char *msg;
+
+	jmsg = json_object_new_object();
+	json_object_object_add(jmsg, "japi_pushsrv",
+						   json_object_new_string(psc->pushsrv_name));
+	json_object_object_add(jmsg, "japi_pushsrv_seq", json_object_new_int64((int64_t)seq));
+	// increment refcount before calling json_object_object_add as jmsg_data may
+	// still be in use by the caller
+	json_object_object_add(jmsg, key, json_object_get(jmsg_data));
+
+	msg = japi_get_jobj_as_ndstr(jmsg);
+	json_object_put(jmsg);
+
+	return msg;
+}
+
+/* Serialized push message shared by all subscribers with the same filter */
+typedef struct {
+	const char *filter_key; /* Filter of the subscribers or NULL */
+	bool match;				/* Message passes the filter */
+	char *msg;				/* Serialized message or NULL if not yet needed */
+	size_t msg_len;
+} pushsrv_variant;
+
+/* Number of variants kept on the stack before the list is moved to the heap */
+#define PUSHSRV_LOCAL_VARIANTS 8
+
+/* Variants of one push message. Most services have few distinct filters, so
+ * the list starts in local storage and only allocates beyond that. */
+typedef struct {
+	pushsrv_variant *items;
+	size_t num;
+	size_t size;
+	pushsrv_variant local[PUSHSRV_LOCAL_VARIANTS];
+} pushsrv_variants;
+
+/* Look up the value at a dot-separated field path, e.g. "sensor.value" */
+static bool pushsrv_get_path(json_object *jobj, const char *path, json_object **jval)
+{
+	char key[JAPI_PUSHSRV_FIELD_MAX];
+	const char *end;
+	size_t len;
+
+	for (;;) {
+		end = strchr(path, '.');
+		len = (end != NULL) ? (size_t)(end - path) : strlen(path);
+		if (len >= sizeof(key) || !json_object_is_type(jobj, json_type_object)) {
+			return false;
+		}
+		memcpy(key, path, len);
+		key[len] = '\0';
+		if (!json_object_object_get_ex(jobj, key, &jobj)) {
+			return false;
+		}
+		if (end == NULL) {
+			*jval = jobj;
+			return true;
+		}
+		path = end + 1;
+	}
+}
+
+/* Store a value at a dot-separated field path, creating intermediate objects */
+static void pushsrv_set_path(json_object *jobj, const char *path, json_object *jval)
+{
+	char key[JAPI_PUSHSRV_FIELD_MAX];
+	json_object *jchild;
+	const char *end;
+	size_t len;
+
+	while ((end = strchr(path, '.')) != NULL) {
+		len = (size_t)(end - path);
+		if (len >= sizeof(key)) {
+			return;
+		}
+		memcpy(key, path, len);
+		key[len] = '\0';
+		if (!json_object_object_get_ex(jobj, key, &jchild) ||
+			!json_object_is_type(jchild, json_type_object)) {
+			jchild = json_object_new_object();
+			json_object_object_add(jobj, key, jchild);
+		}
+		jobj = jchild;
+		path = end + 1;
+	}
+	json_object_object_add(jobj, path, json_object_get(jval));
+}
+
+/* Compare JSON values. Numbers are compared by value, everything else by its
+ * plain JSON representation. */
+static bool pushsrv_value_equal(json_object *ja, json_object *jb)
+{
+	bool a_num, b_num;
+
+	a_num = json_object_is_type(ja, json_type_int) ||
+			json_object_is_type(ja, json_type_double);
+	b_num = json_object_is_type(jb, json_type_int) ||
+			json_object_is_type(jb, json_type_double);
+	if (a_num && b_num) {
+		if (json_object_is_type(ja, json_type_int) &&
+			json_object_is_type(jb, json_type_int)) {
+			return json_object_get_int64(ja) == json_object_get_int64(jb);
+		}
+		return json_object_get_double(ja) == json_object_get_double(jb);
+	}
+	if (a_num != b_num) {
+		return false;
+	}
+
+	return strcmp(json_object_to_json_string_ext(ja, JSON_C_TO_STRING_PLAIN),
+				  json_object_to_json_string_ext(jb, JSON_C_TO_STRING_PLAIN)) == 0;
+}
+
+/* Check whether message data satisfies all field values of a filter */
+static bool pushsrv_filter_match(json_object *jmsg_data, json_object *jfilter)
+{
+	json_object *jval;
+
+	if (jfilter == NULL || !json_object_is_type(jfilter, json_type_object)) {
+		return true;
+	}
+	json_object_object_foreach(jfilter, path, jexpected)
+	{
+		if (!pushsrv_get_path(jmsg_data, path, &jval) ||
+			!pushsrv_value_equal(jval, jexpected)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Create a copy of message data containing only the given fields */
+static json_object *pushsrv_project(json_object *jmsg_data, json_object *jfields)
+{
+	json_object *jproj;
+	json_object *jval;
+	const char *path;
+	int i;
+
+	jproj = json_object_new_object();
+	for (i = 0; i < json_object_array_length(jfields); i++) {
+		path = json_object_get_string(json_object_array_get_idx(jfields, i));
+		if (pushsrv_get_path(jmsg_data, path, &jval)) {
+			pushsrv_set_path(jproj, path, jval);
+		}
+	}
+
+	return jproj;
+}
+
+/* Find the shared message of a subscriber's filter, evaluating the filter on
+ * first use. Returns NULL if memory allocation failed. */
+static pushsrv_variant *pushsrv_get_variant(pushsrv_variants *variants,
+											japi_pushsrv_client *client,
+											json_object *jmsg_data)
+{
+	pushsrv_variant *variant;
+	size_t i;
+
+	for (i = 0; i < variants->num; i++) {
+		variant = &(variants->items[i]);
+		if (variant->filter_key == client->filter_key ||
+			(variant->filter_key != NULL && client->filter_key != NULL &&
+			 strcmp(variant->filter_key, client->filter_key) == 0)) {
+			return variant;
+		}
+	}
+
+	if (variants->num == variants->size) {
+		if (variants->items == variants->local) {
+			variant = (pushsrv_variant *)malloc(2 * variants->size *
+												sizeof(pushsrv_variant));
+			if (variant != NULL) {
+				memcpy(variant, variants->local, sizeof(variants->local));
+			}
+		} else {
+			variant = (pushsrv_variant *)realloc(variants->items,
+												 2 * variants->size *
+													 sizeof(pushsrv_variant));
+		}
+		if (variant == NULL) {
+			return NULL;
+		}
+		variants->items = variant;
+		variants->size *= 2;
+	}
+
+	variant = &(variants->items[variants->num++]);
+	variant->filter_key = client->filter_key;
+	variant->match = pushsrv_filter_match(jmsg_data, client->filter);
+	variant->msg = NULL;
+	variant->msg_len = 0;
+
+	return variant;
+}
+
+/* Serialize the shared message of a filter for the given subscriber */
+static int pushsrv_serialize_variant(japi_pushsrv_context *psc,
+									 pushsrv_variant *variant,
+									 japi_pushsrv_client *client,
+									 json_object *jmsg_data, uint64_t seq)
+{
+	json_object *jproj;
+
+	if (client->fields != NULL) {
+		jproj = pushsrv_project(jmsg_data, client->fields);
+		variant->msg = pushsrv_serialize(psc, "data", jproj, seq);
+		json_object_put(jproj);
+	} else {
+		variant->msg = pushsrv_serialize(psc, "data", jmsg_data, seq);
+	}
+	if (variant->msg == NULL) {
+		return -1;
+	}
+	variant->msg_len = strlen(variant->msg);
+
+	return 0;
+}
+
+/* Compare JSON values by their plain JSON representation */
+static bool pushsrv_json_equal(json_object *ja, json_object *jb)
+{
+	return strcmp(json_object_to_json_string_ext(ja, JSON_C_TO_STRING_PLAIN),
+				  json_object_to_json_string_ext(jb, JSON_C_TO_STRING_PLAIN)) == 0;
+}
+
+/*
+ * Create a JSON merge patch (RFC 7396) turning the object jold into jnew.
+ *
+ * Returns NULL if the change can't be expressed as merge patch, i.e. if a value
+ * is not an object or a member changes to null.
+ */
+static json_object *pushsrv_diff(json_object *jold, json_object *jnew)
+{
+	json_object *jpatch;
+	json_object *jsub;
+	json_object *jval;
+
+	if (!json_object_is_type(jold, json_type_object) ||
+		!json_object_is_type(jnew, json_type_object)) {
+		return NULL;
+	}
+
+	jpatch = json_object_new_object();
+
+	/* Removed members */
+	json_object_object_foreach(jold, old_key, old_val)
+	{
+		(void)old_val;
+		if (!json_object_object_get_ex(jnew, old_key, NULL)) {
+			json_object_object_add(jpatch, old_key, NULL);
+		}
+	}
+
+	/* Added and changed members */
+	json_object_object_foreach(jnew, key, new_val)
+	{
+		if (json_object_object_get_ex(jold, key, &jval)) {
+			if (json_object_is_type(jval, json_type_object) &&
+				json_object_is_type(new_val, json_type_object)) {
+				jsub = pushsrv_diff(jval, new_val);
+				if (jsub == NULL) {
+					json_object_put(jpatch);
+					return NULL;
+				}
+				if (json_object_object_length(jsub) > 0) {
+					json_object_object_add(jpatch, key, jsub);
+				} else {
+					json_object_put(jsub);
+				}
+				continue;
+			}
+			if (pushsrv_json_equal(jval, new_val)) {
+				continue;
+			}
+		}
+		if (new_val == NULL) {
+			json_object_put(jpatch);
+			return NULL;
+		}
+		json_object_object_add(jpatch, key, json_object_get(new_val));
+	}
+
+	return jpatch;
+}
+
+/* Copy message data to keep it as base of the next delta */
+static json_object *pushsrv_copy(json_object *jobj)
+{
+#if defined(JSON_C_VERSION_NUM) && JSON_C_VERSION_NUM >= ((0 << 16) | (13 << 8))
+	json_object *jcopy = NULL;
+
+	if (json_object_deep_copy(jobj, &jcopy, NULL) < 0) {
+		return NULL;
+	}
+	return jcopy;
+#else
+	/* json_object_deep_copy() is only available since json-c 0.13 */
+	return json_tokener_parse(json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN));
+#endif
+}
+
+/* Serialize the delta of the message data against the previous message. Must
+ * be called with psc->lock held.
+ *
+ * Returns 1 on success and -1 if the message has to be sent in full. */
+static int pushsrv_delta(japi_pushsrv_context *psc, json_object *jmsg_data, uint64_t seq,
+						 char **msg, size_t *msg_len)
+{
+	json_object *jdelta;
+
+	jdelta = pushsrv_diff(psc->delta_prev, jmsg_data);
+	if (jdelta == NULL) {
+		return -1;
+	}
+	*msg = pushsrv_serialize(psc, "delta", jdelta, seq);
+	json_object_put(jdelta);
+	if (*msg == NULL) {
+		return -1;
+	}
+	*msg_len = strlen(*msg);
+
+	return 1;
+}
+
+/* Keep a sent message. The unfiltered message is taken over from the variants,
+ * if it was serialized already. Must be called with psc->lock held. */
+static void pushsrv_keep(japi_pushsrv_context *psc, japi_pushsrv_replay *entry,
+						 pushsrv_variants *variants, json_object *jmsg_data,
+						 uint64_t seq)
+{
+	char *msg;
+	size_t i;
+
+	msg = NULL;
+	for (i = 0; i < variants->num; i++) {
+		if (variants->items[i].filter_key == NULL && variants->items[i].msg != NULL) {
+			msg = variants->items[i].msg;
+			variants->items[i].msg = NULL;
+			break;
+		}
+	}
+	if (msg == NULL) {
+		msg = pushsrv_serialize(psc, "data", jmsg_data, seq);
+		if (msg == NULL) {
+			return;
+		}
+	}
+
+	free(entry->msg);
+	entry->seq = seq;
+	entry->msg = msg;
+	entry->msg_len = strlen(msg);
+}
+
+/* Queue message data for a new subscriber, applying its filter. Must be
+ * called with psc->lock held. */
+static void pushsrv_send_data(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+							  json_object *jmsg_data, uint64_t seq)
+{
+	pushsrv_variant variant;
+
+	if (!pushsrv_filter_match(jmsg_data, client->filter)) {
+		return;
+	}
+	variant.msg = NULL;
+	if (pushsrv_serialize_variant(psc, &variant, client, jmsg_data, seq) == 0) {
+		pushsrv_queue(psc, client, variant.msg, variant.msg_len);
+		free(variant.msg);
+	}
+}
+
+/* Queue a kept message for a new subscriber. Must be called with psc->lock
+ * held. */
+static void pushsrv_send_kept(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+							  japi_pushsrv_replay *entry)
+{
+	json_object *jmsg;
+	json_object *jmsg_data;
+
+	if (client->filter_key == NULL) {
+		pushsrv_queue(psc, client, entry->msg, entry->msg_len);
+		return;
+	}
+
+	jmsg = json_tokener_parse(entry->msg);
+	if (json_object_object_get_ex(jmsg, "data", &jmsg_data)) {
+		pushsrv_send_data(psc, client, jmsg_data, entry->seq);
+	}
+	json_object_put(jmsg);
+}
+
+/* Send the current state to a new subscriber. Must be called with psc->lock
+ * held. */
+static void pushsrv_send_snapshot(japi_pushsrv_context *psc, japi_pushsrv_client *client)
+{
+	json_object *jmsg_data;
+
+	if (psc->snapshot != NULL) {
+		jmsg_data = json_object_new_object();
+		if (psc->snapshot(psc, jmsg_data) == 0) {
+			pushsrv_send_data(psc, client, jmsg_data, psc->seq);
+		}
+		json_object_put(jmsg_data);
+	} else if (psc->last_msg != NULL && psc->last_msg->msg != NULL) {
+		pushsrv_send_kept(psc, client, psc->last_msg);
+	}
+}
+
+/*
+ * Send the kept messages after since_seq to a new subscriber. Must be called
+ * with psc->lock held.
+ *
+ * Returns false if messages after since_seq are not kept anymore.
+ */
+static bool pushsrv_replay(japi_pushsrv_context *psc, japi_pushsrv_client *client,
+						   uint64_t since_seq)
+{
+	japi_pushsrv_replay *entry;
+	uint64_t oldest, seq;
+	bool complete;
+
+	/* A higher sequence number was handed out by a previous instance */
+	if (since_seq > psc->seq) {
+		return false;
+	}
+	if (since_seq == psc->seq) {
+		return true;
+	}
+	if (psc->replay == NULL) {
+		return false;
+	}
+
+	oldest = (psc->seq > psc->replay_size) ? psc->seq - psc->replay_size + 1 : 1;
+	complete = (since_seq + 1 >= oldest);
+	seq = complete ? since_seq + 1 : oldest;
+
+	for (; seq <= psc->seq; seq++) {
+		entry = &(psc->replay[seq % psc->replay_size]);
+		if (entry->msg == NULL || entry->seq != seq) {
+			complete = false;
+			continue;
+		}
+		pushsrv_send_kept(psc, client, entry);
+	}
+
+	return complete;
+}
+
+/*
+ * Send message to all subscribed clients of a push service
+ */
+int japi_pushsrv_sendmsg(japi_pushsrv_context *psc, json_object *jmsg_data)
+{
+	pushsrv_variants variants;
+	pushsrv_variant *variant;
+	size_t i;
+	char *msg;
+	size_t msg_len;
+	char *delta_msg;
+	size_t delta_len;
+	int delta_state; /* -1 full messages only, 0 delta not yet created, 1 created */
+	bool delta_base; /* a subscriber that can receive deltas got the message */
+	int ret;
+	int success; /* number of successfull send messages */
+	uint64_t now;
+	uint64_t seq;
+	japi_pushsrv_client *client, *following_client;
+
+	/* Return -1 if there is no message to send */
+	if (jmsg_data == NULL) {
+		fprintf(stderr, "ERROR: Nothing to send.\n");
+		return -1;
+	}
+
+	/* Return 0 if no client is subscribed and no message is kept */
+	if (psc->clients == NULL && psc->replay == NULL && psc->last_msg == NULL) {
+		__sync_add_and_fetch(&(psc->seq), 1);
+		return 0;
+	}
+
+	ret = 0;
+	success = 0;
+	variants.items = variants.local;
+	variants.num = 0;
+	variants.size = PUSHSRV_LOCAL_VARIANTS;
+	now = pushsrv_now_us();
+
+	pthread_mutex_lock(&(psc->lock));
+	seq = __sync_add_and_fetch(&(psc->seq), 1);
+	client = psc->clients;
+
+	/* Deltas are sent unless a keyframe is due */
+	delta_msg = NULL;
+	delta_len = 0;
+	delta_state = -1;
+	delta_base = false;
+	if (psc->delta_interval > 0 && !psc->conflate && psc->delta_prev != NULL &&
+		psc->delta_count + 1 < psc->delta_interval) {
+		delta_state = 0;
+	}
+
+	while (client != NULL) {
+		following_client = client->next; // Save pointer to next element
+
+		/* Subscribers with identical filters share one evaluation and one
+		 * serialized message */
+		variant = pushsrv_get_variant(&variants, client, jmsg_data);
+		if (variant == NULL) {
+			success = -1;
+			break;
+		}
+
+		/* Skip subscribers that don't want this message */
+		if (!variant->match || !pushsrv_client_due(client, now)) {
+			client = following_client;
+			continue;
+		}
+
+		/* Subscribers that received the previous message get the delta */
+		msg = NULL;
+		msg_len = 0;
+		if (delta_state >= 0 && client->filter_key == NULL &&
+			client->last_seq + 1 == seq) {
+			if (delta_state == 0) {
+				delta_state = pushsrv_delta(psc, jmsg_data, seq, &delta_msg, &delta_len);
+			}
+			if (delta_state > 0) {
+				msg = delta_msg;
+				msg_len = delta_len;
+			}
+		}
+
+		/* Serialize only if at least one subscriber receives the message */
+		if (msg == NULL) {
+			if (variant->msg == NULL &&
+				pushsrv_serialize_variant(psc, variant, client, jmsg_data, seq) < 0) {
+				success = -1;
+				break;
+			}
+			msg = variant->msg;
+			msg_len = variant->msg_len;
+		}
+
+		prntdbg("pushsrv '%s': Sending message to client %d\n. Message: '%s'",
+				psc->pushsrv_name, client->socket, msg);
+
+		if (client->shm != NULL) {
+			/* The ring already decouples producer and consumer */
+			ret = pushsrv_write(client, msg, msg_len);
+		} else if (psc->conflate) {
+			ret = pushsrv_send_conflated(psc, client, msg, msg_len);
+		} else if (psc->coalesce_us > 0 || client->outbox_len > 0) {
+			/* Messages still queued from subscribing are sent first */
+			ret = pushsrv_send_coalesced(psc, client, msg, msg_len, now);
+		} else {
+			ret = write_n(client->socket, msg, msg_len);
+		}
+
+		if (ret < 0 || (ret == 0 && !psc->conflate)) {
+			/* If write failed print error and unsubscribe client */
+			fprintf(stderr,
+					"ERROR: Failed to send push service message to client %i (write "
+					"returned %i)\n",
+					client->socket, ret);
+			/* Remove client from respective push service and free */
+			japi_pushsrv_remove_client(psc, client->socket);
+		} else if (ret > 0) {
+			client->last_seq = seq;
+			if (client->filter_key == NULL) {
+				delta_base = true;
+			}
+			success++;
+		}
+		client = following_client;
+	}
+
+	/* Remember the message data as base of the next delta, but only if a
+	 * subscriber that can receive deltas got it */
+	if (psc->delta_interval > 0) {
+		psc->delta_count = (delta_state < 0) ? 0 : psc->delta_count + 1;
+		json_object_put(psc->delta_prev);
+		psc->delta_prev = (delta_base && !psc->conflate) ? pushsrv_copy(jmsg_data) : NULL;
+	}
+
+	if (psc->replay != NULL && success >= 0) {
+		pushsrv_keep(psc, &(psc->replay[seq % psc->replay_size]), &variants,
+					 jmsg_data, seq);
+	}
+	if (psc->last_msg != NULL && success >= 0) {
+		pushsrv_keep(psc, psc->last_msg, &variants, jmsg_data, seq);
+	}
+	pthread_mutex_unlock(&(psc->lock));
+
+	for (i = 0; i < variants.num; i++) {
+		free(variants.items[i].msg);
+	}
+	if (variants.items != variants.local) {
+		free(variants.items);
+	}
+	free(delta_msg);
+
+	return success;
+}
+
+/* Current time of the scheduler clock in milliseconds */
+static uint64_t pushsrv_sched_now(void)
+{
+	return pushsrv_now_us() / 1000;
+}
+
+/* Swap two heap elements and update their positions */
+static void pushsrv_heap_swap(japi_pushsrv_sched *sched, size_t a, size_t b)
+{
+	japi_pushsrv_context *tmp;
+
+	tmp = sched->heap[a];
+	sched->heap[a] = sched->heap[b];
+	sched->heap[b] = tmp;
+	sched->heap[a]->sched_pos = a;
+	sched->heap[b]->sched_pos = b;
+}
+
+/* Restore the heap property for the element at position pos */
+static void pushsrv_heap_fix(japi_pushsrv_sched *sched, size_t pos)
+{
+	size_t parent, child;
+
+	/* Sift up */
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (sched->heap[parent]->sched_deadline <= sched->heap[pos]->sched_deadline) {
+			break;
+		}
+		pushsrv_heap_swap(sched, parent, pos);
+		pos = parent;
+	}
+
+	/* Sift down */
+	while ((child = 2 * pos + 1) < sched->heap_len) {
+		if (child + 1 < sched->heap_len &&
+			sched->heap[child + 1]->sched_deadline < sched->heap[child]->sched_deadline) {
+			child++;
+		}
+		if (sched->heap[pos]->sched_deadline <= sched->heap[child]->sched_deadline) {
+			break;
+		}
+		pushsrv_heap_swap(sched, pos, child);
+		pos = child;
+	}
+}
+
+/* Insert push service into the heap */
+static int pushsrv_heap_push(japi_pushsrv_sched *sched, japi_pushsrv_context *psc)
+{
+	japi_pushsrv_context **heap;
+	size_t size;
+
+	if (sched->heap_len == sched->heap_size) {
+		size = (sched->heap_size == 0) ? 16 : 2 * sched->heap_size;
+		heap = (japi_pushsrv_context **)realloc(sched->heap,
+												size * sizeof(japi_pushsrv_context *));
+		if (heap == NULL) {
+			perror("ERROR: realloc() failed");
+			return -1;
+		}
+		sched->heap = heap;
+		sched->heap_size = size;
 	}
 
-	json_object_object_add(jresp, "service", json_object_new_string(pushsrv_name));
+	psc->sched_pos = sched->heap_len;
+	sched->heap[sched->heap_len++] = psc;
+	pushsrv_heap_fix(sched, psc->sched_pos);
 
-	/* Create JSON response object */
-	if (registered && unsubscribed) { /* Subscribed */
-		json_object_object_add(jresp, "success", json_object_new_boolean(true));
-	} else if (registered && !unsubscribed) { /* Registered, but not subscribed */
-		json_object_object_add(jresp, "success", json_object_new_boolean(false));
-		json_object_object_add(
-			jresp, "message",
-			json_object_new_string(
-				"Can't unsubscribe a service that wasn't subscribed before."));
-	} else { /* Not registered */
-		json_object_object_add(jresp, "success", json_object_new_boolean(false));
-		json_object_object_add(jresp, "message",
-							   json_object_new_string("Push service not found."));
+	return 0;
+}
+
+/* Remove push service from the heap */
+static void pushsrv_heap_remove(japi_pushsrv_sched *sched, japi_pushsrv_context *psc)
+{
+	size_t pos;
+
+	pos = psc->sched_pos;
+	if (pos == JAPI_PUSHSRV_SCHED_NPOS) {
+		return;
+	}
+
+	sched->heap_len--;
+	if (pos != sched->heap_len) {
+		sched->heap[pos] = sched->heap[sched->heap_len];
+		sched->heap[pos]->sched_pos = pos;
+		pushsrv_heap_fix(sched, pos);
 	}
+	psc->sched_pos = JAPI_PUSHSRV_SCHED_NPOS;
 }
 
-/* Check if there is a duplicate name for a request */
-static bool pushsrv_isredundant(japi_context *ctx, const char *pushsrv_name)
+/* Scheduler thread: sleep until the earliest push service is due and queue it */
+static void *pushsrv_sched_runner(void *arg)
 {
+	japi_pushsrv_sched *sched;
 	japi_pushsrv_context *psc;
-	bool duplicate;
+	struct timespec ts;
+	uint64_t now;
 
-	duplicate = false;
-	psc = ctx->push_services;
+	sched = (japi_pushsrv_sched *)arg;
 
-	while (psc != NULL) {
-		if (strcmp(psc->pushsrv_name, pushsrv_name) == 0) {
-			duplicate = true;
-			break;
+	pthread_mutex_lock(&(sched->lock));
+	while (!sched->shutdown) {
+
+		if (sched->heap_len == 0) {
+			pthread_cond_wait(&(sched->cond), &(sched->lock));
+			continue;
 		}
-		psc = psc->next;
+
+		psc = sched->heap[0];
+		now = pushsrv_sched_now();
+		if (psc->sched_deadline > now) {
+			ts.tv_sec = psc->sched_deadline / 1000;
+			ts.tv_nsec = (psc->sched_deadline % 1000) * 1000000;
+			pthread_cond_timedwait(&(sched->cond), &(sched->lock), &ts);
+			continue;
+		}
+
+		/* Hand over to a worker, unless the previous call is still pending */
+		if (!psc->sched_queued && !psc->sched_running) {
+			psc->sched_queued = true;
+			psc->sched_next = NULL;
+			if (sched->queue_tail == NULL) {
+				sched->queue_head = psc;
+			} else {
+				sched->queue_tail->sched_next = psc;
+			}
+			sched->queue_tail = psc;
+			pthread_cond_signal(&(sched->work_cond));
+		}
+
+		/* Reschedule, skipping periods that were missed */
+		psc->sched_deadline += psc->interval_ms;
+		if (psc->sched_deadline <= now) {
+			psc->sched_deadline = now + psc->interval_ms;
+		}
+		pushsrv_heap_fix(sched, 0);
 	}
-	return duplicate;
-}
+	pthread_mutex_unlock(&(sched->lock));
 
-/* Free memory for duplicated push service name and element */
-static void free_pushsrv(japi_pushsrv_context *psc)
-{
-	free(psc->pushsrv_name);
-	free(psc);
+	return NULL;
 }
 
-/*
- * Registers push-service and returns pointer to that service object.
- */
-japi_pushsrv_context *japi_pushsrv_register(japi_context *ctx, const char *pushsrv_name)
+/* Worker thread: execute the callbacks of due push services */
+static void *pushsrv_sched_worker(void *arg)
 {
+	japi_pushsrv_sched *sched;
 	japi_pushsrv_context *psc;
 
-	if (ctx == NULL) {
-		fprintf(stderr, "ERROR: JAPI context is NULL.\n");
-		return NULL;
-	}
+	sched = (japi_pushsrv_sched *)arg;
 
-	if ((pushsrv_name == NULL) || (strcmp(pushsrv_name, "") == 0)) {
-		fprintf(stderr, "ERROR: Push service name is NULL or empty.\n");
-		return NULL;
-	}
+	pthread_mutex_lock(&(sched->lock));
+	while (!sched->shutdown) {
 
-	if (pushsrv_isredundant(ctx, pushsrv_name)) {
-		fprintf(stderr, "ERROR: A push service called '%s' was already registered.\n",
-				pushsrv_name);
-		return NULL;
+		psc = sched->queue_head;
+		if (psc == NULL) {
+			pthread_cond_wait(&(sched->work_cond), &(sched->lock));
+			continue;
+		}
+
+		sched->queue_head = psc->sched_next;
+		if (sched->queue_head == NULL) {
+			sched->queue_tail = NULL;
+		}
+		psc->sched_queued = false;
+		psc->sched_running = true;
+		pthread_mutex_unlock(&(sched->lock));
+
+		psc->routine(psc);
+
+		pthread_mutex_lock(&(sched->lock));
+		psc->sched_running = false;
+		pthread_cond_broadcast(&(sched->idle_cond));
 	}
+	pthread_mutex_unlock(&(sched->lock));
 
-	/* Reserve memory for japi_pushsrv_context struct */
-	psc = (japi_pushsrv_context *)malloc(sizeof(japi_pushsrv_context));
-	if (psc == NULL) {
+	return NULL;
+}
+
+/* Create the scheduler of a JAPI context and start its threads */
+static japi_pushsrv_sched *pushsrv_sched_create(void)
+{
+	japi_pushsrv_sched *sched;
+	pthread_condattr_t attr;
+	int i, num_workers;
+
+	sched = (japi_pushsrv_sched *)malloc(sizeof(japi_pushsrv_sched));
+	if (sched == NULL) {
 		perror("ERROR: malloc() failed");
 		return NULL;
 	}
 
-	/* Duplicate string in case that pushsrv_name comes from
-	a namespace that is left after this function */
-	psc->pushsrv_name = strdup(pushsrv_name);
-	if (psc->pushsrv_name == NULL) {
-		free(psc);
-		return NULL;
+	sched->heap = NULL;
+	sched->heap_len = 0;
+	sched->heap_size = 0;
+	sched->queue_head = NULL;
+	sched->queue_tail = NULL;
+	sched->shutdown = false;
+
+	pthread_condattr_init(&attr);
+#ifndef __APPLE__
+	pthread_condattr_setclock(&attr, JAPI_PUSHSRV_SCHED_CLOCK);
+#endif
+	pthread_mutex_init(&(sched->lock), NULL);
+	pthread_cond_init(&(sched->cond), &attr);
+	pthread_cond_init(&(sched->work_cond), NULL);
+	pthread_cond_init(&(sched->idle_cond), NULL);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&(sched->thread), NULL, pushsrv_sched_runner, sched) != 0) {
+		fprintf(stderr, "ERROR: Error creating push service scheduler thread.\n");
+		goto err_free;
 	}
 
-	/* Initialize struct */
-	psc->thread_id = 0;
-	psc->routine = NULL;
-	psc->clients = NULL;
-	psc->enabled = false;
-	psc->userptr = ctx->userptr;
+	for (num_workers = 0; num_workers < JAPI_PUSHSRV_WORKERS; num_workers++) {
+		if (pthread_create(&(sched->workers[num_workers]), NULL, pushsrv_sched_worker,
+						   sched) != 0) {
+			fprintf(stderr, "ERROR: Error creating push service worker thread.\n");
+			goto err_join;
+		}
+	}
 
-	if (pthread_mutex_init(&(psc->lock), NULL) != 0) {
-		fprintf(stderr, "ERROR: mutex initialization has failed\n");
-		return NULL;
+	return sched;
+
+err_join:
+	pthread_mutex_lock(&(sched->lock));
+	sched->shutdown = true;
+	pthread_cond_broadcast(&(sched->cond));
+	pthread_cond_broadcast(&(sched->work_cond));
+	pthread_mutex_unlock(&(sched->lock));
+	pthread_join(sched->thread, NULL);
+	for (i = 0; i < num_workers; i++) {
+		pthread_join(sched->workers[i], NULL);
 	}
 
-	/* Point to last struct */
-	psc->next = ctx->push_services;
-	ctx->push_services = psc;
+err_free:
+	pthread_cond_destroy(&(sched->idle_cond));
+	pthread_cond_destroy(&(sched->work_cond));
+	pthread_cond_destroy(&(sched->cond));
+	pthread_mutex_destroy(&(sched->lock));
+	free(sched);
 
-	return psc;
+	return NULL;
 }
 
 /*
- * Remove push service context from japi context, unsubscribe for all clients and free
- * memory
+ * Stop scheduler and worker threads and free the scheduler
  */
-int japi_pushsrv_destroy(japi_context *ctx, japi_pushsrv_context *psc)
+void japi_pushsrv_sched_destroy(japi_context *ctx)
 {
-	japi_pushsrv_context *psc_iter, *psc_prev, *psc_next;
-	japi_client *client, *client_next;
+	japi_pushsrv_sched *sched;
+	int i;
 
 	assert(ctx != NULL);
 
-	if (psc == NULL) {
-		fprintf(stderr, "ERROR: push service context is NULL\n");
-		return -1;
+	sched = ctx->pushsrv_sched;
+	if (sched == NULL) {
+		return;
 	}
 
-	/* clean up linked list in ctx->push_service */
-	psc_prev = NULL;
-	psc_iter = ctx->push_services;
-
-	while (psc_iter != NULL) {
-		psc_next = psc_iter->next;
-		if (psc_iter == psc) {
-			/* If first element */
-			if (psc_prev == NULL) {
-				ctx->push_services = psc_next;
-			} else {
-				psc_prev->next = psc_next;
-			}
-			break;
-		}
-		psc_prev = psc_iter;
-		psc_iter = psc_next;
-	}
+	pthread_mutex_lock(&(sched->lock));
+	sched->shutdown = true;
+	pthread_cond_broadcast(&(sched->cond));
+	pthread_cond_broadcast(&(sched->work_cond));
+	pthread_mutex_unlock(&(sched->lock));
 
-	/* Iterates through push service client list and frees memory for every element and
-	 * for the push service themself */
-	client = psc->clients;
-	pthread_mutex_lock(&(psc->lock));
-	while (client != NULL) {
-		client_next = client->next;
-		japi_pushsrv_remove_client(psc, client->socket);
-		client = client_next;
+	pthread_join(sched->thread, NULL);
+	for (i = 0; i < JAPI_PUSHSRV_WORKERS; i++) {
+		pthread_join(sched->workers[i], NULL);
 	}
-	pthread_mutex_unlock(&(psc->lock));
-
-	japi_pushsrv_stop(psc);
 
-	pthread_mutex_destroy(&(psc->lock));
-	free_pushsrv(psc);
+	pthread_cond_destroy(&(sched->idle_cond));
+	pthread_cond_destroy(&(sched->work_cond));
+	pthread_cond_destroy(&(sched->cond));
+	pthread_mutex_destroy(&(sched->lock));
+	free(sched->heap);
+	free(sched);
 
-	return 0;
+	ctx->pushsrv_sched = NULL;
 }
 
 /*
- * Provide the names of all registered push-services as a JAPI response.
+ * Schedule push service callback to be called periodically
  */
-void japi_pushsrv_list(japi_context *ctx, json_object *request, json_object *response)
+int japi_pushsrv_start_periodic(japi_pushsrv_context *psc, unsigned int interval_ms,
+								japi_pushsrv_routine callback)
 {
-	japi_pushsrv_context *psc;
-	json_object *jstring;
-	json_object *jarray;
-
-	assert(ctx != NULL);
-	assert(response != NULL);
+	japi_context *ctx;
+	japi_pushsrv_sched *sched;
 
-	jarray = json_object_new_array();
-	psc = ctx->push_services;
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: No push service context passed. Not starting.\n");
+		return -1;
+	}
 
-	/* Iterate through push service list and return JSON object  */
-	while (psc != NULL) {
-		jstring = json_object_new_string(psc->pushsrv_name); /* Create JSON-string */
-		json_object_array_add(jarray, jstring); /* Add string to JSON array */
-		psc = psc->next;
+	if (callback == NULL || interval_ms == 0) {
+		fprintf(stderr, "ERROR: No callback or interval passed. Not starting.\n");
+		return -2;
 	}
 
-	/* Add array to JSON-object */
-	json_object_object_add(response, "services", jarray);
-}
+	if (psc->enabled) {
+		fprintf(stderr, "ERROR: Push service '%s' is already running.\n",
+				psc->pushsrv_name);
+		return -4;
+	}
 
-/*
- * Send message to all subscribed clients of a push service
- */
-int japi_pushsrv_sendmsg(japi_pushsrv_context *psc, json_object *jmsg_data)
-{
-	char *msg;
-	int ret;
-	int success; /* number of successfull send messages */
-	japi_client *client, *following_client;
-	json_object *jmsg;
-	json_object *jdata;
+	/* The scheduler is created with the first periodic push service */
+	ctx = psc->ctx;
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	if (ctx->pushsrv_sched == NULL) {
+		ctx->pushsrv_sched = pushsrv_sched_create();
+	}
+	sched = ctx->pushsrv_sched;
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
 
-	/* Return -1 if there is no message to send */
-	if (jmsg_data == NULL) {
-		fprintf(stderr, "ERROR: Nothing to send.\n");
-		return -1;
+	if (sched == NULL) {
+		return -3;
 	}
 
-	/* Return 0 if no client is subscribed */
-	if (psc->clients == NULL) {
-		return 0;
+	pthread_mutex_lock(&(sched->lock));
+	psc->routine = callback;
+	psc->interval_ms = interval_ms;
+	psc->sched_deadline = pushsrv_sched_now() + interval_ms;
+	if (pushsrv_heap_push(sched, psc) != 0) {
+		psc->interval_ms = 0;
+		pthread_mutex_unlock(&(sched->lock));
+		return -3;
 	}
+	psc->enabled = true;
+	pthread_cond_signal(&(sched->cond));
+	pthread_mutex_unlock(&(sched->lock));
 
-	ret = 0;
-	success = 0;
-	jmsg = json_object_new_object();
-	jdata = NULL;
+	return 0;
+}
 
-	json_object_object_add(jmsg, "japi_pushsrv",
-						   json_object_new_string(psc->pushsrv_name));
-	jdata = json_object_get(
-		jmsg_data); // increment refcount before calling json_object_object_add as
-					// jmesg_data may still be in use by the caller
-	json_object_object_add(jmsg, "data", jdata);
+/* Tell routine to end and wake it up, if it waits in japi_pushsrv_wait() */
+static void pushsrv_request_stop(japi_pushsrv_context *psc)
+{
+	pthread_mutex_lock(&(psc->wait_lock));
+	psc->enabled = false;
+	pthread_cond_broadcast(&(psc->wait_cond));
+	pthread_mutex_unlock(&(psc->wait_lock));
+}
 
-	msg = japi_get_jobj_as_ndstr(jmsg);
-	json_object_put(jmsg);
+/* Unschedule periodic push service and wait for a running callback to return */
+static void pushsrv_stop_periodic(japi_pushsrv_context *psc)
+{
+	japi_pushsrv_sched *sched;
+	japi_pushsrv_context **entry;
 
-	pthread_mutex_lock(&(psc->lock));
-	client = psc->clients;
+	sched = psc->ctx->pushsrv_sched;
 
-	while (client != NULL) {
-		prntdbg("pushsrv '%s': Sending message to client %d\n. Message: '%s'",
-				psc->pushsrv_name, client->socket, msg);
-		following_client = client->next; // Save pointer to next element
+	pushsrv_request_stop(psc);
 
-		ret = write_n(client->socket, msg, strlen(msg));
+	pthread_mutex_lock(&(sched->lock));
+	pushsrv_heap_remove(sched, psc);
 
-		if (ret <= 0) {
-			/* If write failed print error and unsubscribe client */
-			fprintf(stderr,
-					"ERROR: Failed to send push service message to client %i (write "
-					"returned %i)\n",
-					client->socket, ret);
-			/* Remove client from respective push service and free */
-			japi_pushsrv_remove_client(psc, client->socket);
-		} else {
-			success++;
+	/* Remove from worker queue */
+	if (psc->sched_queued) {
+		sched->queue_tail = NULL;
+		entry = &(sched->queue_head);
+		while (*entry != NULL) {
+			if (*entry == psc) {
+				*entry = psc->sched_next;
+			} else {
+				sched->queue_tail = *entry;
+				entry = &((*entry)->sched_next);
+			}
 		}
-		client = following_client;
+		psc->sched_queued = false;
 	}
-	pthread_mutex_unlock(&(psc->lock));
 
-	free(msg);
-
-	return success;
+	while (psc->sched_running) {
+		pthread_cond_wait(&(sched->idle_cond), &(sched->lock));
+	}
+	psc->interval_ms = 0;
+	pthread_mutex_unlock(&(sched->lock));
 }
 
 /*
@@ -553,10 +3047,65 @@ int japi_pushsrv_start(japi_pushsrv_context *psc, japi_pushsrv_routine routine)
 		psc->enabled = false;
 		return -3;
 	}
+	psc->joinable = true;
 
 	return 0;
 }
 
+/*
+ * Tell all push service routines to end without waiting for them
+ */
+void japi_pushsrv_request_stop_all(japi_context *ctx)
+{
+	japi_pushsrv_context *psc;
+
+	assert(ctx != NULL);
+
+	pthread_mutex_lock(&(ctx->pushsrv_lock));
+	psc = ctx->push_services;
+	while (psc != NULL) {
+		if (psc->joinable) {
+			pushsrv_request_stop(psc);
+		}
+		psc = psc->next;
+	}
+	pthread_mutex_unlock(&(ctx->pushsrv_lock));
+}
+
+/*
+ * Sleep until timeout or until the push service is stopped
+ */
+bool japi_pushsrv_wait(japi_pushsrv_context *psc, unsigned int timeout_ms)
+{
+	struct timespec ts;
+	bool enabled;
+
+	if (psc == NULL) {
+		fprintf(stderr, "ERROR: No push service context passed.\n");
+		return false;
+	}
+
+	clock_gettime(JAPI_PUSHSRV_SCHED_CLOCK, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&(psc->wait_lock));
+	while (psc->enabled) {
+		if (pthread_cond_timedwait(&(psc->wait_cond), &(psc->wait_lock), &ts) ==
+			ETIMEDOUT) {
+			break;
+		}
+	}
+	enabled = psc->enabled;
+	pthread_mutex_unlock(&(psc->wait_lock));
+
+	return enabled;
+}
+
 /*
  * Stop pushsrv routine
  */
@@ -567,15 +3116,22 @@ int japi_pushsrv_stop(japi_pushsrv_context *psc)
 		return -1;
 	}
 
-	if (psc->enabled == false) {
+	if (psc->interval_ms != 0) {
+		pushsrv_stop_periodic(psc);
+		return 0;
+	}
+
+	/* A thread might have been told to end already, but not been joined */
+	if (psc->joinable == false) {
 		fprintf(stderr, "ERROR: Thread not running.\n");
 		return -2;
 	}
 
 	/* Tell routine to end */
-	psc->enabled = false;
+	pushsrv_request_stop(psc);
 
 	/* Wait for thread to end and close it */
+	psc->joinable = false;
 	if (pthread_join(psc->thread_id, NULL) != 0) {
 		fprintf(stderr, "ERROR: Error joining push service routine '%s'\n",
 				psc->pushsrv_name);
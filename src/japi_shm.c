@@ -0,0 +1,216 @@
+/*!
+ * \file
+ * \date 2026-10-18
+ * \version 0.1
+ *
+ * \brief Shared memory transport for push messages.
+ *
+  *\copyright
+ * Copyright (c) 2023 Fraunhofer IIS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* memfd_create() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "japi_shm.h"
+
+/* Copy bytes into the data area, wrapping around at its end */
+static void shm_copy_in(japi_shm_producer *shm, uint64_t pos, const void *src,
+						size_t len)
+{
+	size_t off = pos & (shm->size - 1);
+	size_t first = (len < shm->size - off) ? len : shm->size - off;
+
+	memcpy(shm->data + off, src, first);
+	memcpy(shm->data, (const char *)src + first, len - first);
+}
+
+/* Copy bytes out of the data area, wrapping around at its end */
+static void shm_copy_out(japi_shm_ring *ring, uint64_t pos, void *dst, size_t len)
+{
+	const char *data = (const char *)ring + ring->data_offset;
+	size_t off = pos & (ring->size - 1);
+	size_t first = (len < ring->size - off) ? len : ring->size - off;
+
+	memcpy(dst, data + off, first);
+	memcpy((char *)dst + first, data, len - first);
+}
+
+japi_shm_producer *japi_shm_create(size_t size, int *fd)
+{
+#ifdef __linux__
+	japi_shm_producer *shm;
+	japi_shm_ring *ring;
+	size_t data_size;
+
+	if (size < JAPI_SHM_MIN_SIZE || size > JAPI_SHM_MAX_SIZE) {
+		fprintf(stderr, "ERROR: Invalid shared memory size %zu.\n", size);
+		return NULL;
+	}
+
+	/* Positions are masked, so the size has to be a power of two */
+	data_size = JAPI_SHM_MIN_SIZE;
+	while (data_size < size) {
+		data_size <<= 1;
+	}
+
+	*fd = memfd_create("japi_shm", MFD_CLOEXEC);
+	if (*fd < 0) {
+		perror("ERROR: memfd_create() failed");
+		return NULL;
+	}
+	if (ftruncate(*fd, sizeof(japi_shm_ring) + data_size) != 0) {
+		perror("ERROR: ftruncate() failed");
+		close(*fd);
+		return NULL;
+	}
+
+	ring = mmap(NULL, sizeof(japi_shm_ring) + data_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, *fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("ERROR: mmap() failed");
+		close(*fd);
+		return NULL;
+	}
+
+	shm = malloc(sizeof(japi_shm_producer));
+	if (shm == NULL) {
+		fprintf(stderr, "ERROR: malloc() failed\n");
+		munmap(ring, sizeof(japi_shm_ring) + data_size);
+		close(*fd);
+		return NULL;
+	}
+	shm->ring = ring;
+	shm->data = (char *)ring + sizeof(japi_shm_ring);
+	shm->size = data_size;
+	shm->head = 0;
+	shm->map_size = sizeof(japi_shm_ring) + data_size;
+
+	/* The file is zero-filled, so only the layout has to be set */
+	ring->data_offset = sizeof(japi_shm_ring);
+	ring->size = data_size;
+	__atomic_store_n(&(ring->magic), JAPI_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return shm;
+#else
+	fprintf(stderr, "ERROR: Shared memory transport is not supported on this platform.\n");
+	return NULL;
+#endif
+}
+
+japi_shm_ring *japi_shm_attach(int fd)
+{
+	japi_shm_ring *ring;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(japi_shm_ring)) {
+		fprintf(stderr, "ERROR: Invalid shared memory file descriptor.\n");
+		return NULL;
+	}
+
+	ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("ERROR: mmap() failed");
+		return NULL;
+	}
+
+	if (__atomic_load_n(&(ring->magic), __ATOMIC_ACQUIRE) != JAPI_SHM_MAGIC ||
+		ring->data_offset + ring->size != (uint64_t)st.st_size) {
+		fprintf(stderr, "ERROR: Shared memory is not a JAPI ring.\n");
+		munmap(ring, st.st_size);
+		return NULL;
+	}
+
+	return ring;
+}
+
+void japi_shm_detach(japi_shm_ring *ring)
+{
+	if (ring != NULL) {
+		munmap(ring, ring->data_offset + ring->size);
+	}
+}
+
+void japi_shm_destroy(japi_shm_producer *shm)
+{
+	if (shm != NULL) {
+		munmap(shm->ring, shm->map_size);
+		free(shm);
+	}
+}
+
+int japi_shm_write(japi_shm_producer *shm, const char *msg, size_t len)
+{
+	uint64_t head, tail;
+	uint32_t len32;
+
+	head = shm->head;
+	tail = __atomic_load_n(&(shm->ring->tail), __ATOMIC_ACQUIRE);
+
+	/* Drop the message instead of waiting for a slow consumer. A tail ahead of
+	 * head or behind by more than the size is corrupt. */
+	if (head - tail > shm->size || len > UINT32_MAX ||
+		sizeof(len32) + len > shm->size - (head - tail)) {
+		__atomic_add_fetch(&(shm->ring->dropped), 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	len32 = (uint32_t)len;
+	shm_copy_in(shm, head, &len32, sizeof(len32));
+	shm_copy_in(shm, head + sizeof(len32), msg, len);
+
+	/* Publish the message after its bytes are written */
+	shm->head = head + sizeof(len32) + len;
+	__atomic_store_n(&(shm->ring->head), shm->head, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+int japi_shm_read(japi_shm_ring *ring, char *buf, size_t size)
+{
+	uint64_t head, tail;
+	uint32_t len32;
+
+	tail = ring->tail;
+	head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return 0;
+	}
+
+	shm_copy_out(ring, tail, &len32, sizeof(len32));
+	if (len32 > size || len32 > INT32_MAX) {
+		return -1;
+	}
+	shm_copy_out(ring, tail + sizeof(len32), buf, len32);
+
+	/* Release the space after the message was copied */
+	__atomic_store_n(&(ring->tail), tail + sizeof(len32) + len32, __ATOMIC_RELEASE);
+
+	return (int)len32;
+}
@@ -0,0 +1,1071 @@
+/*!
+ * \file
+ * \date 2026-10-18
+ * \version 0.1
+ *
+ * \brief io_uring backend of the JAPI server loop.
+ *
+ * \copyright
+ * Copyright (c) 2023 Fraunhofer IIS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* syscall() */
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include <unistd.h>
+
+#include "japi_uring.h"
+
+#ifdef JAPI_HAVE_IO_URING
+
+/* Number of submission queue entries */
+#define JAPI_URING_ENTRIES 256
+
+/* Number and size of the provided buffers clients receive into */
+#define JAPI_URING_BUF_COUNT 256
+#define JAPI_URING_BUF_SIZE 4096
+#define JAPI_URING_BGID 0
+
+/* Received data a client may have buffered without completing its lines */
+#define JAPI_URING_MAX_INPUT (64 * 1024 * 1024)
+
+/* Bytes of responses queued for a client before its requests are not read */
+#define JAPI_URING_MAX_QUEUED (4 * 1024 * 1024)
+
+/* Maximal number of linked sends submitted at once for a client */
+#define JAPI_URING_MAX_CHAIN 32
+
+/* Interval in microseconds japi_uring_flush() checks for sent responses */
+#define JAPI_URING_FLUSH_STEP_US 10000
+
+/* Kind of request, stored in the low bits of the user data */
+#define JAPI_URING_ACCEPT 1
+#define JAPI_URING_RECV 2
+#define JAPI_URING_SEND 3
+#define JAPI_URING_KIND_MASK 3
+
+/* Response queued or being sent. The entry is the user data of its send, so it
+ * can be freed even if the client was removed meanwhile. */
+typedef struct __japi_uring_out {
+	char *msg;
+	size_t len;
+	int socket;
+	uint32_t id; /* Client the response belongs to */
+	struct __japi_uring_out *next;
+} japi_uring_out;
+
+/* io_uring state of a client */
+typedef struct __japi_uring_client {
+	japi_client *client;
+	uint32_t id; /* Tells completions for a reused socket apart */
+	char *in; /* Received data not read as lines yet */
+	size_t in_off; /* Start of the unread data */
+	size_t in_len; /* Length of the unread data */
+	size_t in_size; /* Size of the buffer */
+	japi_uring_out *queue_head; /* Responses not submitted yet */
+	japi_uring_out *queue_tail;
+	unsigned int inflight; /* Sends of the submitted chain */
+	size_t queued; /* Bytes of queued and submitted responses */
+	bool eof; /* Flag marking that the client closed the connection */
+	bool failed; /* Flag marking a failed receive or send */
+	bool stalled; /* Flag marking that reading waits for responses to be sent */
+	bool dirty; /* Flag marking that the client is listed for submitting sends */
+	struct __japi_uring_client *dirty_next;
+} japi_uring_client;
+
+/* Server socket accepting clients */
+typedef struct __japi_uring_server {
+	int socket;
+	bool armed; /* Flag marking an active multishot accept */
+} japi_uring_server;
+
+typedef struct __japi_uring {
+	int fd; /* io_uring instance */
+	pthread_mutex_t lock; /* Lock for the submission queue and the client table */
+
+	/* Submission and completion queue, mapped at once */
+	void *ring;
+	size_t ring_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_local_tail; /* Tail including reserved entries */
+	unsigned int sq_submitted; /* Tail of the entries passed to the kernel */
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Provided buffers */
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_size;
+	char *bufs;
+	unsigned short buf_tail;
+
+	/* Clients indexed by socket */
+	japi_uring_client **clients;
+	size_t clients_size;
+	uint32_t next_id;
+	japi_uring_client *dirty; /* Clients with responses to submit */
+	size_t sends; /* Responses queued or being sent */
+
+	japi_uring_server *servers;
+	size_t num_servers;
+} japi_uring;
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+					   unsigned int flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg,
+						argsz);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Cancel all requests on a file descriptor and wait until they are done */
+static int uring_cancel_fd(japi_uring *uring, int fd)
+{
+	struct io_uring_sync_cancel_reg reg;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.fd = fd;
+	reg.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	reg.timeout.tv_sec = -1;
+	reg.timeout.tv_nsec = -1;
+	if (uring_register(uring->fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1) != 0 &&
+		errno != ENOENT) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void uring_free(japi_uring *uring)
+{
+	if (uring->sqes != NULL) {
+		munmap(uring->sqes, uring->sqes_size);
+	}
+	if (uring->ring != NULL) {
+		munmap(uring->ring, uring->ring_size);
+	}
+	if (uring->buf_ring != NULL) {
+		munmap(uring->buf_ring, uring->buf_ring_size);
+	}
+	if (uring->fd >= 0) {
+		close(uring->fd);
+	}
+	free(uring->bufs);
+	free(uring->clients);
+	free(uring->servers);
+	free(uring);
+}
+
+/* Hand a provided buffer back to the kernel */
+static void uring_buf_add(japi_uring *uring, unsigned short bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &(uring->buf_ring->bufs[uring->buf_tail & (JAPI_URING_BUF_COUNT - 1)]);
+	buf->addr = (uint64_t)(uintptr_t)(uring->bufs + (size_t)bid * JAPI_URING_BUF_SIZE);
+	buf->len = JAPI_URING_BUF_SIZE;
+	buf->bid = bid;
+	uring->buf_tail++;
+	__atomic_store_n(&(uring->buf_ring->tail), uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/* Free entries of the submission queue. Called with uring->lock held. */
+static unsigned int uring_sq_space(japi_uring *uring)
+{
+	return uring->sq_entries -
+		   (uring->sq_local_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/* Pass the reserved entries to the kernel. Called with uring->lock held. */
+static int uring_submit(japi_uring *uring)
+{
+	unsigned int to_submit;
+	int ret;
+
+	__atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = uring->sq_local_tail - uring->sq_submitted;
+	while (to_submit > 0) {
+		ret = uring_enter(uring->fd, to_submit, 0, 0, NULL, 0);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret < 0 && (errno == EAGAIN || errno == EBUSY)) {
+			/* Retried when the server loop waits next time */
+			return 0;
+		}
+		if (ret <= 0) {
+			perror("ERROR: io_uring_enter() failed");
+			return -1;
+		}
+		uring->sq_submitted += ret;
+		to_submit -= ret;
+	}
+
+	return 0;
+}
+
+/* Reserve a submission queue entry, passing the queue to the kernel if it is
+ * full. Called with uring->lock held. */
+static struct io_uring_sqe *uring_get_sqe(japi_uring *uring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if (uring_sq_space(uring) == 0 &&
+		(uring_submit(uring) != 0 || uring_sq_space(uring) == 0)) {
+		fprintf(stderr, "ERROR: io_uring submission queue is full\n");
+		return NULL;
+	}
+
+	idx = uring->sq_local_tail & uring->sq_mask;
+	sqe = &(uring->sqes[idx]);
+	memset(sqe, 0, sizeof(*sqe));
+	uring->sq_array[idx] = idx;
+	uring->sq_local_tail++;
+
+	return sqe;
+}
+
+/* Start a multishot receive into the provided buffers. Called with uring->lock
+ * held. */
+static int uring_arm_recv(japi_uring *uring, japi_uring_client *uc, int socket)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe(uring);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = socket;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = JAPI_URING_BGID;
+	sqe->user_data = ((uint64_t)uc->id << 32) | ((uint64_t)socket << 2) | JAPI_URING_RECV;
+
+	return 0;
+}
+
+/* Look up the client a completion belongs to. Called with uring->lock held. */
+static japi_uring_client *uring_lookup(japi_uring *uring, int socket, uint32_t id)
+{
+	japi_uring_client *uc;
+
+	if (socket < 0 || (size_t)socket >= uring->clients_size) {
+		return NULL;
+	}
+	uc = uring->clients[socket];
+
+	return (uc != NULL && uc->id == id) ? uc : NULL;
+}
+
+/* List a client for submitting its queued responses. Called with uring->lock
+ * held. */
+static void uring_mark_dirty(japi_uring *uring, japi_uring_client *uc)
+{
+	if (!uc->dirty) {
+		uc->dirty = true;
+		uc->dirty_next = uring->dirty;
+		uring->dirty = uc;
+	}
+}
+
+/* Submit the queued responses of clients without sends in flight as chains of
+ * linked sends, so they go out in order. Called with uring->lock held. */
+static void uring_flush_sends(japi_uring *uring)
+{
+	japi_uring_client *uc;
+	japi_uring_out *out;
+	struct io_uring_sqe *sqe;
+	unsigned int n, i;
+
+	while ((uc = uring->dirty) != NULL) {
+		uring->dirty = uc->dirty_next;
+		uc->dirty = false;
+		if (uc->inflight > 0 || uc->queue_head == NULL) {
+			continue;
+		}
+
+		/* A chain must not be split between two submissions */
+		n = 0;
+		for (out = uc->queue_head; out != NULL && n < JAPI_URING_MAX_CHAIN;
+			 out = out->next) {
+			n++;
+		}
+		if (uring_sq_space(uring) < n && uring_submit(uring) != 0) {
+			uring_mark_dirty(uring, uc);
+			return;
+		}
+		if (uring_sq_space(uring) < n) {
+			n = uring_sq_space(uring);
+		}
+		if (n == 0) {
+			uring_mark_dirty(uring, uc);
+			return;
+		}
+
+		for (i = 0; i < n; i++) {
+			out = uc->queue_head;
+			uc->queue_head = out->next;
+			if (uc->queue_head == NULL) {
+				uc->queue_tail = NULL;
+			}
+			sqe = uring_get_sqe(uring);
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = out->socket;
+			sqe->addr = (uint64_t)(uintptr_t)out->msg;
+			sqe->len = (uint32_t)out->len;
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			sqe->user_data = (uint64_t)(uintptr_t)out | JAPI_URING_SEND;
+			if (i + 1 < n) {
+				sqe->flags = IOSQE_IO_LINK;
+			}
+			uc->inflight++;
+		}
+	}
+}
+
+/* Append received data to the line buffer of a client */
+static int uring_append(japi_uring_client *uc, const char *data, size_t len)
+{
+	char *in;
+	size_t size;
+
+	if (uc->in_len + len > JAPI_URING_MAX_INPUT) {
+		fprintf(stderr, "ERROR: Maximum line size of %i bytes exceeded!\n",
+				JAPI_URING_MAX_INPUT);
+		return -1;
+	}
+
+	if (uc->in_off + uc->in_len + len > uc->in_size) {
+		/* Move the unread data to the front before growing the buffer */
+		if (uc->in_off > 0) {
+			memmove(uc->in, uc->in + uc->in_off, uc->in_len);
+			uc->in_off = 0;
+		}
+		size = (uc->in_size > 0) ? uc->in_size : JAPI_URING_BUF_SIZE;
+		while (size < uc->in_len + len) {
+			size *= 2;
+		}
+		if (size != uc->in_size) {
+			in = (char *)realloc(uc->in, size);
+			if (in == NULL) {
+				perror("ERROR: realloc() failed");
+				return -1;
+			}
+			uc->in = in;
+			uc->in_size = size;
+		}
+	}
+
+	memcpy(uc->in + uc->in_off + uc->in_len, data, len);
+	uc->in_len += len;
+
+	return 0;
+}
+
+/* Handle the completion of a receive */
+static bool uring_received(japi_uring *uring, struct io_uring_cqe *cqe,
+						   japi_uring_event *ev)
+{
+	japi_uring_client *uc;
+	unsigned short bid;
+	int socket;
+
+	socket = (int)((cqe->user_data & 0xffffffff) >> 2);
+
+	pthread_mutex_lock(&(uring->lock));
+	uc = uring_lookup(uring, socket, (uint32_t)(cqe->user_data >> 32));
+
+	/* Copy the data and recycle the buffer right away, also for removed clients */
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		if (uc != NULL && cqe->res > 0 &&
+			uring_append(uc, uring->bufs + (size_t)bid * JAPI_URING_BUF_SIZE,
+						 cqe->res) != 0) {
+			uc->failed = true;
+		}
+		uring_buf_add(uring, bid);
+	}
+	if (uc == NULL) {
+		pthread_mutex_unlock(&(uring->lock));
+		return false;
+	}
+
+	if (cqe->res == 0) {
+		uc->eof = true;
+	} else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+		/* Running out of buffers only ends the multishot receive */
+		fprintf(stderr, "ERROR: recv() failed: %s\n", strerror(-cqe->res));
+		uc->failed = true;
+	}
+	if (!(cqe->flags & IORING_CQE_F_MORE) && !uc->eof && !uc->failed &&
+		uring_arm_recv(uring, uc, socket) != 0) {
+		uc->failed = true;
+	}
+
+	ev->type = JAPI_URING_EV_CLIENT;
+	ev->client = uc->client;
+	pthread_mutex_unlock(&(uring->lock));
+
+	return true;
+}
+
+/* Handle the completion of a send */
+static bool uring_sent(japi_uring *uring, struct io_uring_cqe *cqe, japi_uring_event *ev)
+{
+	japi_uring_client *uc;
+	japi_uring_out *out;
+	bool notify;
+
+	out = (japi_uring_out *)(uintptr_t)(cqe->user_data & ~(uint64_t)JAPI_URING_KIND_MASK);
+	notify = false;
+
+	pthread_mutex_lock(&(uring->lock));
+	uring->sends--;
+	uc = uring_lookup(uring, out->socket, out->id);
+	if (uc != NULL) {
+		uc->inflight--;
+		uc->queued -= out->len;
+		if (cqe->res < 0 || (size_t)cqe->res != out->len) {
+			fprintf(stderr, "ERROR: Failed to send response to client %i (send returned %i)\n",
+					out->socket, cqe->res);
+			uc->failed = true;
+			notify = true;
+		}
+		if (uc->inflight == 0 && uc->queue_head != NULL) {
+			uring_mark_dirty(uring, uc);
+		}
+		if (uc->stalled && uc->queued < JAPI_URING_MAX_QUEUED) {
+			/* Continue reading the requests of the client */
+			uc->stalled = false;
+			notify = true;
+		}
+		if (notify) {
+			ev->type = JAPI_URING_EV_CLIENT;
+			ev->client = uc->client;
+		}
+	}
+	pthread_mutex_unlock(&(uring->lock));
+
+	free(out->msg);
+	free(out);
+
+	return notify;
+}
+
+/* Handle the completion of an accept */
+static bool uring_accepted(japi_uring *uring, struct io_uring_cqe *cqe,
+						   japi_uring_event *ev)
+{
+	size_t i;
+
+	ev->type = JAPI_URING_EV_ACCEPT;
+	ev->socket = (int)(cqe->user_data >> 2);
+	ev->res = cqe->res;
+	ev->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+	ev->client = NULL;
+
+	if (!ev->more) {
+		pthread_mutex_lock(&(uring->lock));
+		for (i = 0; i < uring->num_servers; i++) {
+			if (uring->servers[i].socket == ev->socket) {
+				uring->servers[i].armed = false;
+			}
+		}
+		pthread_mutex_unlock(&(uring->lock));
+	}
+
+	return true;
+}
+
+int japi_uring_probe(void)
+{
+	japi_uring *uring;
+	int ret;
+
+	uring = japi_uring_create();
+	if (uring == NULL) {
+		return -1;
+	}
+
+	/* Synchronous cancellation came with multishot receives in Linux 6.0 */
+	ret = uring_cancel_fd(uring, uring->fd);
+	uring_free(uring);
+
+	return ret;
+}
+
+japi_uring *japi_uring_create(void)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	japi_uring *uring;
+	char *ring;
+	unsigned int i;
+
+	uring = (japi_uring *)calloc(1, sizeof(japi_uring));
+	if (uring == NULL) {
+		perror("ERROR: calloc() failed");
+		return NULL;
+	}
+
+	memset(&p, 0, sizeof(p));
+	uring->fd = uring_setup(JAPI_URING_ENTRIES, &p);
+	if (uring->fd < 0) {
+		perror("ERROR: io_uring_setup() failed");
+		goto error;
+	}
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+		!(p.features & IORING_FEAT_EXT_ARG)) {
+		fprintf(stderr, "ERROR: io_uring of this kernel lacks required features\n");
+		goto error;
+	}
+
+	/* Both queues share one mapping */
+	uring->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > uring->ring_size) {
+		uring->ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	}
+	ring = (char *)mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED) {
+		perror("ERROR: mmap() failed");
+		goto error;
+	}
+	uring->ring = ring;
+	uring->sq_head = (unsigned int *)(ring + p.sq_off.head);
+	uring->sq_tail = (unsigned int *)(ring + p.sq_off.tail);
+	uring->sq_array = (unsigned int *)(ring + p.sq_off.array);
+	uring->sq_mask = *(unsigned int *)(ring + p.sq_off.ring_mask);
+	uring->sq_entries = *(unsigned int *)(ring + p.sq_off.ring_entries);
+	uring->sq_local_tail = *(uring->sq_tail);
+	uring->sq_submitted = uring->sq_local_tail;
+	uring->cq_head = (unsigned int *)(ring + p.cq_off.head);
+	uring->cq_tail = (unsigned int *)(ring + p.cq_off.tail);
+	uring->cq_mask = *(unsigned int *)(ring + p.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	uring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = (struct io_uring_sqe *)mmap(NULL, uring->sqes_size,
+											  PROT_READ | PROT_WRITE,
+											  MAP_SHARED | MAP_POPULATE, uring->fd,
+											  IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		uring->sqes = NULL;
+		perror("ERROR: mmap() failed");
+		goto error;
+	}
+
+	/* The ring of provided buffers has to be page aligned */
+	uring->buf_ring_size = JAPI_URING_BUF_COUNT * sizeof(struct io_uring_buf);
+	uring->buf_ring = (struct io_uring_buf_ring *)mmap(NULL, uring->buf_ring_size,
+													   PROT_READ | PROT_WRITE,
+													   MAP_PRIVATE | MAP_ANONYMOUS,
+													   -1, 0);
+	if (uring->buf_ring == MAP_FAILED) {
+		uring->buf_ring = NULL;
+		perror("ERROR: mmap() failed");
+		goto error;
+	}
+	uring->bufs = (char *)malloc((size_t)JAPI_URING_BUF_COUNT * JAPI_URING_BUF_SIZE);
+	if (uring->bufs == NULL) {
+		perror("ERROR: malloc() failed");
+		goto error;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+	reg.ring_entries = JAPI_URING_BUF_COUNT;
+	reg.bgid = JAPI_URING_BGID;
+	if (uring_register(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		perror("ERROR: Failed to register provided buffers");
+		goto error;
+	}
+	for (i = 0; i < JAPI_URING_BUF_COUNT; i++) {
+		uring_buf_add(uring, (unsigned short)i);
+	}
+
+	pthread_mutex_init(&(uring->lock), NULL);
+
+	return uring;
+
+error:
+	uring_free(uring);
+	return NULL;
+}
+
+void japi_uring_destroy(japi_uring *uring)
+{
+	japi_uring_event ev;
+	size_t i;
+
+	if (uring == NULL) {
+		return;
+	}
+
+	/* Stop accepting and free the responses of canceled sends */
+	for (i = 0; i < uring->num_servers; i++) {
+		uring_cancel_fd(uring, uring->servers[i].socket);
+	}
+	uring_enter(uring->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+	while (japi_uring_next(uring, &ev)) {
+		if (ev.type == JAPI_URING_EV_ACCEPT && ev.res >= 0) {
+			/* Accepted, but never handed to the server loop */
+			close(ev.res);
+		}
+	}
+
+	pthread_mutex_destroy(&(uring->lock));
+	uring_free(uring);
+}
+
+int japi_uring_add_server(japi_uring *uring, int socket)
+{
+	japi_uring_server *servers;
+
+	servers = (japi_uring_server *)realloc(uring->servers, (uring->num_servers + 1) *
+															  sizeof(japi_uring_server));
+	if (servers == NULL) {
+		perror("ERROR: realloc() failed");
+		return -1;
+	}
+	uring->servers = servers;
+	uring->servers[uring->num_servers].socket = socket;
+	uring->servers[uring->num_servers].armed = false;
+	uring->num_servers++;
+
+	return japi_uring_rearm_servers(uring);
+}
+
+int japi_uring_rearm_servers(japi_uring *uring)
+{
+	struct io_uring_sqe *sqe;
+	size_t i;
+	int ret;
+
+	ret = 0;
+	pthread_mutex_lock(&(uring->lock));
+	for (i = 0; i < uring->num_servers && ret == 0; i++) {
+		if (uring->servers[i].armed) {
+			continue;
+		}
+		sqe = uring_get_sqe(uring);
+		if (sqe == NULL) {
+			ret = -1;
+			break;
+		}
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = uring->servers[i].socket;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		sqe->user_data = ((uint64_t)uring->servers[i].socket << 2) | JAPI_URING_ACCEPT;
+		uring->servers[i].armed = true;
+	}
+	pthread_mutex_unlock(&(uring->lock));
+
+	return ret;
+}
+
+int japi_uring_add_client(japi_uring *uring, japi_client *client)
+{
+	japi_uring_client **clients;
+	japi_uring_client *uc;
+	size_t size;
+
+	uc = (japi_uring_client *)calloc(1, sizeof(japi_uring_client));
+	if (uc == NULL) {
+		perror("ERROR: calloc() failed");
+		return -1;
+	}
+	uc->client = client;
+
+	pthread_mutex_lock(&(uring->lock));
+	if ((size_t)client->socket >= uring->clients_size) {
+		size = (uring->clients_size > 0) ? uring->clients_size : 64;
+		while (size <= (size_t)client->socket) {
+			size *= 2;
+		}
+		clients = (japi_uring_client **)realloc(uring->clients,
+												size * sizeof(japi_uring_client *));
+		if (clients == NULL) {
+			pthread_mutex_unlock(&(uring->lock));
+			perror("ERROR: realloc() failed");
+			free(uc);
+			return -1;
+		}
+		memset(clients + uring->clients_size, 0,
+			   (size - uring->clients_size) * sizeof(japi_uring_client *));
+		uring->clients = clients;
+		uring->clients_size = size;
+	}
+
+	/* Zero is never used, so completions of canceled requests don't match */
+	uc->id = ++(uring->next_id);
+	if (uc->id == 0) {
+		uc->id = ++(uring->next_id);
+	}
+	if (uring_arm_recv(uring, uc, client->socket) != 0) {
+		pthread_mutex_unlock(&(uring->lock));
+		free(uc);
+		return -1;
+	}
+	uring->clients[client->socket] = uc;
+	pthread_mutex_unlock(&(uring->lock));
+
+	client->uring = uc;
+
+	return 0;
+}
+
+void japi_uring_remove_client(japi_uring *uring, japi_client *client)
+{
+	japi_uring_client *uc, **link;
+	japi_uring_out *out;
+
+	uc = client->uring;
+	if (uc == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&(uring->lock));
+	if ((size_t)client->socket < uring->clients_size &&
+		uring->clients[client->socket] == uc) {
+		uring->clients[client->socket] = NULL;
+	}
+	for (link = &(uring->dirty); *link != NULL; link = &((*link)->dirty_next)) {
+		if (*link == uc) {
+			*link = uc->dirty_next;
+			break;
+		}
+	}
+
+	/* Requests still in the submission queue have to reach the kernel first,
+	 * otherwise they would run on a reused socket */
+	uring_submit(uring);
+	pthread_mutex_unlock(&(uring->lock));
+
+	/* Cancel the receive and the sends in flight, their completions free the
+	 * responses. Shutting the socket down ends them as well. */
+	if (uring_cancel_fd(uring, client->socket) != 0) {
+		shutdown(client->socket, SHUT_RDWR);
+	}
+
+	pthread_mutex_lock(&(uring->lock));
+	while ((out = uc->queue_head) != NULL) {
+		uc->queue_head = out->next;
+		uring->sends--;
+		free(out->msg);
+		free(out);
+	}
+	pthread_mutex_unlock(&(uring->lock));
+	free(uc->in);
+	free(uc);
+	client->uring = NULL;
+}
+
+int japi_uring_readline(japi_client *client, char **line)
+{
+	japi_uring_client *uc;
+	char *start, *nl;
+	size_t len;
+
+	uc = client->uring;
+	*line = NULL;
+	if (uc->failed) {
+		return -1;
+	}
+
+	start = uc->in + uc->in_off;
+	nl = (uc->in_len > 0) ? (char *)memchr(start, '\n', uc->in_len) : NULL;
+	if (nl == NULL) {
+		if (!uc->eof) {
+			return -2;
+		}
+		if (uc->in_len == 0) {
+			return 0;
+		}
+		fprintf(stderr, "ERROR: Received EOF while line buffer is not empty\n");
+		return -1;
+	}
+
+	len = nl - start;
+	uc->in_off += len + 1;
+	uc->in_len -= len + 1;
+	if (uc->in_len == 0) {
+		uc->in_off = 0;
+	}
+
+	/* Ignore '\r' before '\n' like creadline_r() */
+	if (len > 0 && start[len - 1] == '\r') {
+		len--;
+	}
+	*line = (char *)malloc(len + 1);
+	if (*line == NULL) {
+		perror("ERROR: malloc() failed");
+		return -1;
+	}
+	memcpy(*line, start, len);
+	(*line)[len] = '\0';
+
+	return (int)len;
+}
+
+size_t japi_uring_buffered(japi_client *client)
+{
+	return client->uring->in_len;
+}
+
+bool japi_uring_stalled(japi_client *client)
+{
+	japi_uring_client *uc;
+
+	uc = client->uring;
+	uc->stalled = uc->queued >= JAPI_URING_MAX_QUEUED;
+
+	return uc->stalled;
+}
+
+int japi_uring_send(japi_uring *uring, japi_client *client, char *msg, size_t len)
+{
+	japi_uring_client *uc;
+	japi_uring_out *out;
+
+	uc = client->uring;
+	out = NULL;
+	if (!uc->failed && len <= UINT32_MAX) {
+		out = (japi_uring_out *)malloc(sizeof(japi_uring_out));
+	}
+	if (out == NULL) {
+		free(msg);
+		return -1;
+	}
+	out->msg = msg;
+	out->len = len;
+	out->socket = client->socket;
+	out->id = uc->id;
+	out->next = NULL;
+
+	pthread_mutex_lock(&(uring->lock));
+	if (uc->queue_tail != NULL) {
+		uc->queue_tail->next = out;
+	} else {
+		uc->queue_head = out;
+	}
+	uc->queue_tail = out;
+	uc->queued += len;
+	uring->sends++;
+	uring_mark_dirty(uring, uc);
+	pthread_mutex_unlock(&(uring->lock));
+
+	return 0;
+}
+
+int japi_uring_wait(japi_uring *uring, uint64_t timeout_us)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int to_submit;
+	int ret;
+
+	pthread_mutex_lock(&(uring->lock));
+	uring_flush_sends(uring);
+	__atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = uring->sq_local_tail - uring->sq_submitted;
+	pthread_mutex_unlock(&(uring->lock));
+
+	/* Submit and wait with a single call */
+	ts.tv_sec = timeout_us / 1000000;
+	ts.tv_nsec = (timeout_us % 1000000) * 1000;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+	ret = uring_enter(uring->fd, to_submit, 1,
+					  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN &&
+		errno != EBUSY) {
+		perror("ERROR: io_uring_enter() failed");
+		return -1;
+	}
+	if (ret > 0) {
+		pthread_mutex_lock(&(uring->lock));
+		uring->sq_submitted += ret;
+		pthread_mutex_unlock(&(uring->lock));
+	}
+
+	return 0;
+}
+
+void japi_uring_flush(japi_uring *uring, uint64_t timeout_us)
+{
+	japi_uring_event ev;
+	uint64_t waited_us;
+	size_t i;
+
+	for (i = 0; i < uring->num_servers; i++) {
+		uring_cancel_fd(uring, uring->servers[i].socket);
+	}
+
+	for (waited_us = 0; uring->sends > 0 && waited_us < timeout_us;
+		 waited_us += JAPI_URING_FLUSH_STEP_US) {
+		if (japi_uring_wait(uring, JAPI_URING_FLUSH_STEP_US) != 0) {
+			break;
+		}
+		while (japi_uring_next(uring, &ev)) {
+			if (ev.type == JAPI_URING_EV_ACCEPT && ev.res >= 0) {
+				/* Accepted before the cancellation */
+				close(ev.res);
+			}
+		}
+	}
+}
+
+bool japi_uring_next(japi_uring *uring, japi_uring_event *ev)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	bool found;
+
+	head = *(uring->cq_head);
+	while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &(uring->cqes[head & uring->cq_mask]);
+		switch (cqe->user_data & JAPI_URING_KIND_MASK) {
+		case JAPI_URING_ACCEPT:
+			found = uring_accepted(uring, cqe, ev);
+			break;
+		case JAPI_URING_RECV:
+			found = uring_received(uring, cqe, ev);
+			break;
+		case JAPI_URING_SEND:
+			found = uring_sent(uring, cqe, ev);
+			break;
+		default:
+			found = false;
+			break;
+		}
+		head++;
+		__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+		if (found) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#else
+
+int japi_uring_probe(void)
+{
+	return -1;
+}
+
+struct __japi_uring *japi_uring_create(void)
+{
+	fprintf(stderr, "ERROR: io_uring is not supported on this platform.\n");
+	return NULL;
+}
+
+void japi_uring_destroy(struct __japi_uring *uring)
+{
+}
+
+int japi_uring_add_server(struct __japi_uring *uring, int socket)
+{
+	return -1;
+}
+
+int japi_uring_rearm_servers(struct __japi_uring *uring)
+{
+	return -1;
+}
+
+int japi_uring_add_client(struct __japi_uring *uring, japi_client *client)
+{
+	return -1;
+}
+
+void japi_uring_remove_client(struct __japi_uring *uring, japi_client *client)
+{
+}
+
+int japi_uring_readline(japi_client *client, char **line)
+{
+	*line = NULL;
+	return -1;
+}
+
+size_t japi_uring_buffered(japi_client *client)
+{
+	return 0;
+}
+
+bool japi_uring_stalled(japi_client *client)
+{
+	return false;
+}
+
+int japi_uring_send(struct __japi_uring *uring, japi_client *client, char *msg, size_t len)
+{
+	free(msg);
+	return -1;
+}
+
+int japi_uring_wait(struct __japi_uring *uring, uint64_t timeout_us)
+{
+	return -1;
+}
+
+void japi_uring_flush(struct __japi_uring *uring, uint64_t timeout_us)
+{
+}
+
+bool japi_uring_next(struct __japi_uring *uring, japi_uring_event *ev)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,215 @@
+/*!
+ * \file
+ * \date 2026-10-18
+ * \version 0.1
+ *
+ * \brief io_uring backend of the JAPI server loop.
+ *
+ * \copyright
+ * Copyright (c) 2023 Fraunhofer IIS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __JAPI_URING_H__
+#define __JAPI_URING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "japi.h"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT)
+/*! Kernel headers provide everything the io_uring backend needs */
+#define JAPI_HAVE_IO_URING 1
+#endif
+#endif
+
+/*!
+ * \brief Kinds of events reported by japi_uring_next()
+ */
+typedef enum {
+	JAPI_URING_EV_ACCEPT, /*!< A server socket accepted a client or failed */
+	JAPI_URING_EV_CLIENT, /*!< A client received data, was closed or may continue */
+} japi_uring_event_type;
+
+/*!
+ * \brief Event of the io_uring backend
+ */
+typedef struct __japi_uring_event {
+	japi_uring_event_type type; /*!< Kind of event */
+	int socket; /*!< Server socket of an accept event */
+	int res; /*!< Accepted socket or negative error code of an accept event */
+	bool more; /*!< Flag marking that accepting continues without rearming */
+	japi_client *client; /*!< Client of a client event */
+} japi_uring_event;
+
+/*!
+ * \brief Check whether the kernel supports the io_uring backend
+ *
+ * \returns	Zero if supported, -1 otherwise.
+ */
+int japi_uring_probe(void);
+
+/*!
+ * \brief Create the io_uring instance of the server loop
+ *
+ * Sets up the submission and completion rings and registers the ring of
+ * provided buffers clients receive into.
+ *
+ * \returns	On success, the instance is returned. On error, NULL is returned.
+ */
+struct __japi_uring *japi_uring_create(void);
+
+/*!
+ * \brief Cancel all requests and free the io_uring instance
+ *
+ * Clients have to be removed with japi_uring_remove_client() before.
+ *
+ * \param uring	io_uring instance
+ */
+void japi_uring_destroy(struct __japi_uring *uring);
+
+/*!
+ * \brief Accept clients on a server socket with a multishot accept
+ *
+ * \param uring		io_uring instance
+ * \param socket	Non-blocking server socket
+ *
+ * \returns	On success, zero is returned. On error, -1 is returned.
+ */
+int japi_uring_add_server(struct __japi_uring *uring, int socket);
+
+/*!
+ * \brief Rearm the accepts of server sockets that stopped accepting
+ *
+ * \param uring	io_uring instance
+ *
+ * \returns	On success, zero is returned. On error, -1 is returned.
+ */
+int japi_uring_rearm_servers(struct __japi_uring *uring);
+
+/*!
+ * \brief Receive the requests of a client with a multishot receive
+ *
+ * \param uring		io_uring instance
+ * \param client	Client, its state is stored in client->uring
+ *
+ * \returns	On success, zero is returned. On error, -1 is returned.
+ */
+int japi_uring_add_client(struct __japi_uring *uring, japi_client *client);
+
+/*!
+ * \brief Cancel the requests of a client and free its state
+ *
+ * Responses still being sent are freed when their cancellation completes.
+ *
+ * \param uring		io_uring instance
+ * \param client	Client
+ */
+void japi_uring_remove_client(struct __japi_uring *uring, japi_client *client);
+
+/*!
+ * \brief Read the next complete request line of a client
+ *
+ * Non-blocking counterpart of creadline_r() for the data received by the
+ * io_uring backend. The line is allocated and has to be freed by the caller.
+ *
+ * \param client	Client
+ * \param line		Returns the line or NULL
+ *
+ * \returns	The length of the line, 0 for an empty line or EOF (line is NULL
+ * then), -1 on error and -2 if no complete line was received yet.
+ */
+int japi_uring_readline(japi_client *client, char **line);
+
+/*!
+ * \brief Get the number of received bytes not read as lines yet
+ *
+ * \param client	Client
+ *
+ * \returns	The number of bytes, which belong to an incomplete line after
+ * japi_uring_readline() returned -2.
+ */
+size_t japi_uring_buffered(japi_client *client);
+
+/*!
+ * \brief Check whether the responses queued for a client exceed the limit
+ *
+ * Requests of such a client are not read until its responses were sent.
+ *
+ * \param client	Client
+ *
+ * \returns	true if no further requests should be answered for now.
+ */
+bool japi_uring_stalled(japi_client *client);
+
+/*!
+ * \brief Queue a response for a client
+ *
+ * Responses are sent in order as chains of linked sends once the loop submits.
+ *
+ * \param uring		io_uring instance
+ * \param client	Client
+ * \param msg		Allocated response, freed once sent
+ * \param len		Length of the response
+ *
+ * \returns	On success, zero is returned. On error, -1 is returned and the
+ * response is freed.
+ */
+int japi_uring_send(struct __japi_uring *uring, japi_client *client, char *msg, size_t len);
+
+/*!
+ * \brief Submit queued requests and wait for completions
+ *
+ * \param uring			io_uring instance
+ * \param timeout_us	Time to wait at most in microseconds
+ *
+ * \returns	On success, zero is returned. On error, -1 is returned.
+ */
+int japi_uring_wait(struct __japi_uring *uring, uint64_t timeout_us);
+
+/*!
+ * \brief Send the queued responses before the server loop ends
+ *
+ * Stops accepting clients and waits until all responses were sent or the
+ * timeout passed.
+ *
+ * \param uring			io_uring instance
+ * \param timeout_us	Time to wait at most in microseconds
+ */
+void japi_uring_flush(struct __japi_uring *uring, uint64_t timeout_us);
+
+/*!
+ * \brief Handle the next completion
+ *
+ * Received data is appended to the line buffer of the client, provided buffers
+ * are recycled and ended receives rearmed.
+ *
+ * \param uring	io_uring instance
+ * \param ev	Returns the event
+ *
+ * \returns	true if an event was returned, false if all completions were handled.
+ */
+bool japi_uring_next(struct __japi_uring *uring, japi_uring_event *ev);
+
+#endif /* __JAPI_URING_H__ */
@@ -33,9 +33,11 @@
 
 #include <assert.h>
 #include <stdio.h> /* printf, fprintf */
+#include <stdlib.h> /* malloc, free */
 #include <string.h> /* strcasecmp */
 #include <json-c/json.h>
 
+#include "japi_intern.h"
 #include "japi_utils.h"
 
 
@@ -247,3 +249,67 @@ char* japi_get_jobj_as_ndstr(json_object *jobj)
 
 	return response;
 }
+
+
+/* Copy a JSON value with the keys of all objects sorted, so values differing
+ * only by key order have the same string representation */
+json_object *japi_canonical(json_object *jobj)
+{
+	json_object *jcopy;
+	const char **keys;
+	size_t num_keys, i, j;
+	const char *tmp;
+
+	if (json_object_is_type(jobj, json_type_array)) {
+		jcopy = json_object_new_array();
+		for (i = 0; i < (size_t)json_object_array_length(jobj); i++) {
+			json_object_array_add(jcopy,
+								  japi_canonical(json_object_array_get_idx(jobj, i)));
+		}
+		return jcopy;
+	}
+	if (!json_object_is_type(jobj, json_type_object)) {
+		return json_object_get(jobj);
+	}
+
+	num_keys = 0;
+	{
+		json_object_object_foreach(jobj, key, val)
+		{
+			(void)key;
+			(void)val;
+			num_keys++;
+		}
+	}
+	keys = (const char **)malloc((num_keys + 1) * sizeof(char *));
+	if (keys == NULL) {
+		return NULL;
+	}
+	i = 0;
+	{
+		json_object_object_foreach(jobj, key, val)
+		{
+			(void)val;
+			keys[i++] = key;
+		}
+	}
+
+	/* Insertion sort, arguments have few keys */
+	for (i = 1; i < num_keys; i++) {
+		tmp = keys[i];
+		for (j = i; j > 0 && strcmp(keys[j - 1], tmp) > 0; j--) {
+			keys[j] = keys[j - 1];
+		}
+		keys[j] = tmp;
+	}
+
+	jcopy = json_object_new_object();
+	for (i = 0; i < num_keys; i++) {
+		json_object *jval = NULL;
+		json_object_object_get_ex(jobj, keys[i], &jval);
+		json_object_object_add(jcopy, keys[i], japi_canonical(jval));
+	}
+	free(keys);
+
+	return jcopy;
+}
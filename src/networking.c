@@ -31,17 +31,22 @@
  * THE SOFTWARE.
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <unistd.h>
 
 #include "networking.h"
 
 /* taken from getaddrinfo manpage and slightly adapted */
-static int tcp_start_server_on_addr_family(const char* port, int ai_family)
+static int tcp_start_server_on_addr_family(const char* host, const char* port,
+                                           int ai_family)
 {
 	struct addrinfo hints;
 	struct addrinfo *result, *rp;
@@ -56,7 +61,7 @@ static int tcp_start_server_on_addr_family(const char* port, int ai_family)
 	hints.ai_addr = NULL;
 	hints.ai_next = NULL;
 	
-	s = getaddrinfo(NULL, port, &hints, &result);
+	s = getaddrinfo(host, port, &hints, &result);
 	if (s != 0) {
 	    fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(s));
 	    return -1;
@@ -85,6 +90,14 @@ static int tcp_start_server_on_addr_family(const char* port, int ai_family)
 			/* The programm can go on. */
 		};
 
+		/* An explicitly given IPv6 address must not occupy the port for
+		IPv4 as well, so separate IPv4 and IPv6 listeners can coexist. */
+		if (host != NULL && rp->ai_family == AF_INET6) {
+			int v6only = 1;
+			if (setsockopt(sfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) == -1)
+				perror("ERROR: setsockopt");
+		}
+
 		if (bind(sfd, rp->ai_addr, rp->ai_addrlen) == 0)
 			break;                  /* Success */
 	
@@ -103,16 +116,74 @@ static int tcp_start_server_on_addr_family(const char* port, int ai_family)
 
 int tcp_start_server(const char* port)
 {
-	return tcp_start_server_on_addr_family(port, AF_UNSPEC);
+	return tcp_start_server_on_addr_family(NULL, port, AF_UNSPEC);
 }
 
 int tcp4_start_server(const char* port)
 {
-	return tcp_start_server_on_addr_family(port, AF_INET);
+	return tcp_start_server_on_addr_family(NULL, port, AF_INET);
 }
 
 int tcp6_start_server(const char* port)
 {
-	return tcp_start_server_on_addr_family(port, AF_INET6);
+	return tcp_start_server_on_addr_family(NULL, port, AF_INET6);
 }
 
+int tcp_start_server_on_host(const char* host, const char* port)
+{
+	return tcp_start_server_on_addr_family(host, port, AF_UNSPEC);
+}
+
+int unix_start_server(const char* path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	socklen_t addrlen;
+	size_t len;
+	int sfd;
+
+	len = strlen(path);
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+
+	if (path[0] == '@') {
+#ifdef __linux__
+		/* The abstract namespace is selected by a leading null byte and has
+		no file system entry. The name isn't null terminated. */
+		if (len < 2 || len > sizeof(addr.sun_path)) {
+			fprintf(stderr, "ERROR: Invalid abstract socket name '%s'\n", path);
+			return -1;
+		}
+		memcpy(addr.sun_path + 1, path + 1, len - 1);
+		addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+#else
+		fprintf(stderr, "ERROR: Abstract Unix sockets are only supported on Linux\n");
+		return -1;
+#endif
+	} else {
+		if (len == 0 || len >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "ERROR: Invalid Unix socket path '%s'\n", path);
+			return -1;
+		}
+		memcpy(addr.sun_path, path, len);
+		addrlen = sizeof(struct sockaddr_un);
+
+		/* Remove the socket file left by a previous server */
+		if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(path);
+	}
+
+	sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sfd == -1) {
+		perror("ERROR: socket");
+		return -1;
+	}
+
+	if (bind(sfd, (struct sockaddr *)&addr, addrlen) != 0) {
+		perror("ERROR: bind");
+		close(sfd);
+		return -1;
+	}
+
+	return sfd;
+}
@@ -20,14 +20,29 @@ Copyright (c) 2023 Fraunhofer IIS
  * THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 extern "C" {
 #include "japi.h"
 #include "japi_intern.h"
 #include "japi_pushsrv.h"
 #include "japi_pushsrv_intern.h"
+#include "japi_shm.h"
+#include "japi_uring.h"
 #include "japi_utils.h"
 #include "rw_n.h"
 }
@@ -40,6 +55,101 @@ static void dummy_request_handler(japi_context *ctx, json_object *request,
 	json_object_object_add(response, "value", json_object_new_string("hello world"));
 }
 
+/* Handler counting its calls, returning the arguments */
+static int counting_request_calls;
+static void counting_request_handler(japi_context *ctx, json_object *request,
+									 json_object *response)
+{
+	counting_request_calls++;
+	json_object_object_add(response, "calls", json_object_new_int(counting_request_calls));
+	json_object_object_add(response, "args", json_object_get(request));
+}
+
+/* Handler returning the number of counting handler calls before it */
+static void urgent_request_handler(japi_context *ctx, json_object *request,
+								   json_object *response)
+{
+	json_object_object_add(response, "calls_before",
+						   json_object_new_int(counting_request_calls));
+}
+
+/* Periodic push service callback counting its calls */
+static void counting_pushsrv_callback(japi_pushsrv_context *psc)
+{
+	std::atomic<int> *counter = (std::atomic<int> *)psc->userptr;
+	(*counter)++;
+}
+
+/* Push service routine waiting for a long time between two messages */
+static void waiting_pushsrv_routine(japi_pushsrv_context *psc)
+{
+	while (japi_pushsrv_wait(psc, 10000)) {
+	}
+}
+
+/* Count the newline terminated messages readable from a socket */
+static int count_messages(int fd)
+{
+	char buf[4096];
+	ssize_t n;
+	int count;
+	int i;
+
+	count = 0;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			if (buf[i] == '\n') {
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Read all available push messages from a socket */
+static std::vector<std::string> read_messages(int fd)
+{
+	std::vector<std::string> msgs;
+	std::string data;
+	char buf[4096];
+	ssize_t n;
+	size_t pos;
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		data.append(buf, n);
+	}
+	while ((pos = data.find('\n')) != std::string::npos) {
+		msgs.push_back(data.substr(0, pos));
+		data.erase(0, pos + 1);
+	}
+
+	return msgs;
+}
+
+/* Subscribe socket to push service with extra arguments given as JSON string */
+static bool subscribe_with_args(japi_context *ctx, const char *service, int socket,
+								const char *args)
+{
+	json_object *jreq;
+	json_object *jresp;
+	bool bval;
+
+	jreq = json_tokener_parse(args);
+	jresp = json_object_new_object();
+	json_object_object_add(jreq, "service", json_object_new_string(service));
+	json_object_object_add(jreq, "socket", json_object_new_int(socket));
+	japi_pushsrv_subscribe(ctx, jreq, jresp);
+	bval = false;
+	japi_get_value_as_bool(jresp, "success", &bval);
+	json_object_put(jreq);
+	json_object_put(jresp);
+
+	return bval;
+}
+
 TEST(JAPI, Init)
 {
 	/* On success, a japi_context object is returned. On error, NULL is returned */
@@ -207,6 +317,214 @@ TEST(JAPI, Register)
 	japi_destroy(ctx);
 }
 
+TEST(JAPI, Call)
+{
+	japi_context *ctx;
+	json_object *jresp, *jval;
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_register_request(ctx, "dummy", &dummy_request_handler), 0);
+	jresp = json_object_new_object();
+
+	EXPECT_EQ(japi_call(NULL, "dummy", NULL, jresp), -1);
+	EXPECT_EQ(japi_call(ctx, NULL, NULL, jresp), -2);
+	EXPECT_EQ(japi_call(ctx, "dummy", NULL, NULL), -2);
+	EXPECT_EQ(japi_call(ctx, "unknown", NULL, jresp), -3);
+
+	/* Handlers are reached directly and case-insensitive like via sockets */
+	EXPECT_EQ(japi_call(ctx, "DUMMY", NULL, jresp), 0);
+	ASSERT_TRUE(json_object_object_get_ex(jresp, "value", &jval));
+	EXPECT_STREQ(json_object_get_string(jval), "hello world");
+	json_object_put(jresp);
+
+	/* Built-in requests as well */
+	jresp = json_object_new_object();
+	EXPECT_EQ(japi_call(ctx, "japi_cmd_list", NULL, jresp), 0);
+	EXPECT_TRUE(json_object_object_get_ex(jresp, "commands", &jval));
+	json_object_put(jresp);
+
+	japi_destroy(ctx);
+}
+
+TEST(JAPI, RequestCache)
+{
+	japi_context *ctx;
+	char *response;
+	char *cached;
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_register_request(ctx, "info", &counting_request_handler), 0);
+	counting_request_calls = 0;
+
+	EXPECT_EQ(japi_set_request_cache(NULL, "info", 1000), -1);
+	EXPECT_EQ(japi_set_request_cache(ctx, NULL, 1000), -2);
+	EXPECT_EQ(japi_set_request_cache(ctx, "unknown", 1000), -3);
+	EXPECT_EQ(japi_set_request_cache(ctx, "info", 10000), 0);
+	EXPECT_EQ(japi_cache_invalidate(NULL, NULL), -1);
+
+	/* Identical arguments in any key order are answered from the cache */
+	EXPECT_EQ(japi_process_message(
+				  ctx, "{'japi_request': 'info', 'args': {'a': 1, 'b': [2, {'d': 4, 'c': 3}]}}",
+				  &response, 0),
+			  0);
+	free(response);
+	EXPECT_EQ(japi_process_message(ctx,
+								   "{'japi_request': 'INFO', 'japi_request_no': 7, "
+								   "'args': {'b': [2, {'c': 3, 'd': 4}], 'a': 1}}",
+								   &cached, 0),
+			  0);
+	EXPECT_EQ(counting_request_calls, 1);
+	EXPECT_NE(strstr(cached, "\"japi_response\": \"INFO\""), (char *)NULL);
+	EXPECT_NE(strstr(cached, "\"japi_request_no\": 7"), (char *)NULL);
+
+	free(cached);
+
+	/* The cached response equals the one built by the handler */
+	EXPECT_EQ(japi_process_message(ctx,
+								   "{'japi_request': 'info', 'japi_request_no': 8, "
+								   "'args': {'a': 1, 'b': [2, {'d': 4, 'c': 3}]}}",
+								   &cached, 0),
+			  0);
+	EXPECT_EQ(japi_set_request_cache(ctx, "info", 0), 0);
+	counting_request_calls = 0;
+	EXPECT_EQ(japi_process_message(ctx,
+								   "{'japi_request': 'info', 'japi_request_no': 8, "
+								   "'args': {'a': 1, 'b': [2, {'d': 4, 'c': 3}]}}",
+								   &response, 0),
+			  0);
+	EXPECT_STREQ(response, cached);
+	free(response);
+	free(cached);
+
+	/* Different arguments, invalidation and expiry call the handler again */
+	EXPECT_EQ(japi_set_request_cache(ctx, "info", 50), 0);
+	counting_request_calls = 0;
+	japi_process_message(ctx, "{'japi_request': 'info', 'args': {'a': 1}}", &response, 0);
+	free(response);
+	japi_process_message(ctx, "{'japi_request': 'info', 'args': {'a': 2}}", &response, 0);
+	free(response);
+	japi_process_message(ctx, "{'japi_request': 'info', 'args': {'a': 2}}", &response, 0);
+	free(response);
+	EXPECT_EQ(counting_request_calls, 2);
+	EXPECT_EQ(japi_cache_invalidate(ctx, "info"), 0);
+	japi_process_message(ctx, "{'japi_request': 'info', 'args': {'a': 2}}", &response, 0);
+	free(response);
+	EXPECT_EQ(counting_request_calls, 3);
+	usleep(100000);
+	japi_process_message(ctx, "{'japi_request': 'info', 'args': {'a': 2}}", &response, 0);
+	free(response);
+	EXPECT_EQ(counting_request_calls, 4);
+
+	japi_destroy(ctx);
+}
+
+TEST(JAPI, RequestCoalesce)
+{
+	japi_context *ctx;
+	char *response;
+	int i;
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_register_request(ctx, "status", &counting_request_handler), 0);
+	counting_request_calls = 0;
+
+	EXPECT_EQ(japi_set_request_coalesce(NULL, "status", true), -1);
+	EXPECT_EQ(japi_set_request_coalesce(ctx, NULL, true), -2);
+	EXPECT_EQ(japi_set_request_coalesce(ctx, "unknown", true), -3);
+	EXPECT_EQ(japi_set_request_coalesce(ctx, "status", true), 0);
+
+	/* Identical requests of one server loop iteration call the handler once,
+	 * each response keeps its request number */
+	for (i = 0; i < 30; i++) {
+		std::string req = "{'japi_request': 'status', 'japi_request_no': " +
+						  std::to_string(i) + "}";
+		std::string no = "\"japi_request_no\": " + std::to_string(i) + ",";
+		ASSERT_EQ(japi_process_message(ctx, req.c_str(), &response, 0), 0);
+		EXPECT_NE(strstr(response, no.c_str()), (char *)NULL);
+		EXPECT_NE(strstr(response, "\"calls\": 1"), (char *)NULL);
+		free(response);
+	}
+	EXPECT_EQ(counting_request_calls, 1);
+
+	/* The next iteration calls the handler again */
+	ctx->cache_generation++;
+	japi_process_message(ctx, "{'japi_request': 'status'}", &response, 0);
+	EXPECT_NE(strstr(response, "\"calls\": 2"), (char *)NULL);
+	free(response);
+
+	/* Other requests in between may change the state, e.g. status; set; status
+	 * of a pipelining client */
+	japi_process_message(ctx, "{'japi_request': 'japi_cmd_list'}", &response, 0);
+	free(response);
+	japi_process_message(ctx, "{'japi_request': 'status'}", &response, 0);
+	EXPECT_NE(strstr(response, "\"calls\": 3"), (char *)NULL);
+	free(response);
+
+	/* Coalescing can be disabled */
+	EXPECT_EQ(japi_set_request_coalesce(ctx, "status", false), 0);
+	japi_process_message(ctx, "{'japi_request': 'status'}", &response, 0);
+	free(response);
+	EXPECT_EQ(counting_request_calls, 4);
+
+	japi_destroy(ctx);
+}
+
+TEST(JAPI, RequestRateLimit)
+{
+	japi_context *ctx;
+	char *response;
+	int i;
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_register_request(ctx, "expensive", &counting_request_handler), 0);
+	counting_request_calls = 0;
+
+	EXPECT_EQ(japi_set_request_rate_limit(NULL, "expensive", 10, 3), -1);
+	EXPECT_EQ(japi_set_request_rate_limit(ctx, NULL, 10, 3), -2);
+	EXPECT_EQ(japi_set_request_rate_limit(ctx, "unknown", 10, 3), -3);
+	EXPECT_EQ(japi_set_request_rate_limit(ctx, "expensive", -1, 3), -4);
+	EXPECT_EQ(japi_set_request_rate_limit(ctx, "expensive", 10, 0), -4);
+	EXPECT_EQ(japi_set_request_rate_limit(ctx, "expensive", 10, 3), 0);
+
+	/* A burst of three calls passes, further calls are rejected */
+	for (i = 0; i < 5; i++) {
+		ASSERT_EQ(japi_process_message(ctx, "{'japi_request': 'expensive'}", &response,
+									   0),
+				  0);
+		if (i < 3) {
+			EXPECT_EQ(strstr(response, "rate limit exceeded"), (char *)NULL);
+		} else {
+			EXPECT_NE(strstr(response, "\"error\": \"rate limit exceeded\""),
+					  (char *)NULL);
+			EXPECT_NE(strstr(response, "retry_after_ms"), (char *)NULL);
+		}
+		free(response);
+	}
+	EXPECT_EQ(counting_request_calls, 3);
+
+	/* Other requests are not limited, in-process calls neither */
+	japi_process_message(ctx, "{'japi_request': 'japi_cmd_list'}", &response, 0);
+	EXPECT_EQ(strstr(response, "rate limit exceeded"), (char *)NULL);
+	free(response);
+
+	/* The bucket refills with the configured rate */
+	usleep(150000);
+	japi_process_message(ctx, "{'japi_request': 'expensive'}", &response, 0);
+	EXPECT_EQ(strstr(response, "rate limit exceeded"), (char *)NULL);
+	free(response);
+	EXPECT_EQ(counting_request_calls, 4);
+
+	/* The limit can be disabled */
+	EXPECT_EQ(japi_set_request_rate_limit(ctx, "expensive", 0, 0), 0);
+	for (i = 0; i < 5; i++) {
+		japi_process_message(ctx, "{'japi_request': 'expensive'}", &response, 0);
+		free(response);
+	}
+	EXPECT_EQ(counting_request_calls, 9);
+
+	japi_destroy(ctx);
+}
+
 TEST(JAPI, ListCommands)
 {
 	japi_context *ctx;
@@ -263,6 +581,62 @@ TEST(JAPI_Push_Service, Register)
 	japi_destroy(ctx);
 }
 
+TEST(JAPI_Push_Service, IndexLookup)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc[300];
+	json_object *jreq;
+	json_object *jresp;
+	char name[32];
+	bool bval;
+	int i;
+
+	ctx = japi_init(NULL);
+
+	/* Register enough push services to force the index to grow */
+	for (i = 0; i < 300; i++) {
+		snprintf(name, sizeof(name), "sensor_%03d", i);
+		psc[i] = japi_pushsrv_register(ctx, name);
+		ASSERT_TRUE(psc[i] != NULL);
+	}
+	EXPECT_EQ(ctx->num_push_services, 300U);
+	EXPECT_GE(ctx->pushsrv_index_size, 300U);
+
+	/* Lookup is case-insensitive */
+	for (i = 0; i < 300; i += 7) {
+		snprintf(name, sizeof(name), "SENSOR_%03d", i);
+		jreq = json_object_new_object();
+		jresp = json_object_new_object();
+		json_object_object_add(jreq, "service", json_object_new_string(name));
+		json_object_object_add(jreq, "socket", json_object_new_int(42));
+		japi_pushsrv_subscribe(ctx, jreq, jresp);
+		EXPECT_EQ(japi_get_value_as_bool(jresp, "success", &bval), 0);
+		EXPECT_TRUE(bval);
+		EXPECT_EQ(psc[i]->clients->socket, 42);
+		json_object_put(jreq);
+		json_object_put(jresp);
+	}
+
+	/* Destroyed push services are removed from the index */
+	EXPECT_EQ(japi_pushsrv_destroy(ctx, psc[21]), 0);
+	jreq = json_object_new_object();
+	jresp = json_object_new_object();
+	json_object_object_add(jreq, "service", json_object_new_string("sensor_021"));
+	json_object_object_add(jreq, "socket", json_object_new_int(42));
+	japi_pushsrv_subscribe(ctx, jreq, jresp);
+	EXPECT_EQ(japi_get_value_as_bool(jresp, "success", &bval), 0);
+	EXPECT_FALSE(bval);
+	EXPECT_EQ(ctx->num_push_services, 299U);
+
+	/* Name can be registered again after destroying */
+	EXPECT_TRUE(japi_pushsrv_register(ctx, "sensor_021") != NULL);
+
+	/* Clean up */
+	json_object_put(jreq);
+	json_object_put(jresp);
+	japi_destroy(ctx);
+}
+
 TEST(JAPI_Push_Service, SubscribeAndUnsubscribe)
 {
 	int socket;
@@ -427,7 +801,7 @@ TEST(JAPI_Push_Service, AddRemoveClient)
 {
 	japi_context *ctx;
 	japi_pushsrv_context *psc;
-	japi_client *client;
+	japi_pushsrv_client *client;
 	json_object *jobj;
 	json_object *push_status_jreq;
 	json_object *push_temperature_jreq;
@@ -551,3 +925,1822 @@ TEST(JAPI_Push_Service, PushServiceRemoveEntryFromLInkedList)
 	EXPECT_STREQ(json_object_to_json_string(jobj),
 				 "{ \"services\": [ \"test04\", \"test03\" ] }");
 }
+
+TEST(JAPI_Push_Service, StartPeriodic)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc01, *psc02;
+	std::atomic<int> counter(0);
+	int calls;
+
+	ctx = japi_init(&counter);
+	psc01 = japi_pushsrv_register(ctx, "periodic01");
+	psc02 = japi_pushsrv_register(ctx, "periodic02");
+
+	/* Bad arguments */
+	EXPECT_EQ(japi_pushsrv_start_periodic(NULL, 10, &counting_pushsrv_callback), -1);
+	EXPECT_EQ(japi_pushsrv_start_periodic(psc01, 10, NULL), -2);
+	EXPECT_EQ(japi_pushsrv_start_periodic(psc01, 0, &counting_pushsrv_callback), -2);
+
+	/* Both push services share the scheduler */
+	EXPECT_EQ(japi_pushsrv_start_periodic(psc01, 10, &counting_pushsrv_callback), 0);
+	EXPECT_EQ(japi_pushsrv_start_periodic(psc01, 10, &counting_pushsrv_callback), -4);
+	EXPECT_EQ(japi_pushsrv_start_periodic(psc02, 20, &counting_pushsrv_callback), 0);
+
+	usleep(200000);
+
+	/* 20 + 10 calls expected, allow for scheduling jitter */
+	EXPECT_EQ(japi_pushsrv_stop(psc01), 0);
+	EXPECT_EQ(japi_pushsrv_stop(psc02), 0);
+	calls = counter;
+	EXPECT_GE(calls, 10);
+	EXPECT_LE(calls, 32);
+
+	/* No more calls after stopping */
+	usleep(50000);
+	EXPECT_EQ(counter, calls);
+	EXPECT_EQ(japi_pushsrv_stop(psc01), -2);
+
+	/* Restart after stopping */
+	EXPECT_EQ(japi_pushsrv_start_periodic(psc01, 5, &counting_pushsrv_callback), 0);
+	usleep(50000);
+	EXPECT_GT(counter, calls);
+
+	/* Clean up, stops the periodic push service */
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Push_Service, WaitAndStop)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	struct timespec start, end;
+	double elapsed;
+	char name[32];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "waiting");
+
+	/* Waiting without being started returns immediately */
+	EXPECT_FALSE(japi_pushsrv_wait(psc, 1000));
+	EXPECT_FALSE(japi_pushsrv_wait(NULL, 1000));
+
+	/* Stop doesn't wait for the timeout of the routine */
+	EXPECT_EQ(japi_pushsrv_start(psc, &waiting_pushsrv_routine), 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	EXPECT_EQ(japi_pushsrv_stop(psc), 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	EXPECT_LT(elapsed, 1.0);
+	EXPECT_EQ(japi_pushsrv_stop(psc), -2);
+
+	/* Destroying the context stops all push services at once */
+	for (i = 0; i < 10; i++) {
+		snprintf(name, sizeof(name), "waiting_%d", i);
+		psc = japi_pushsrv_register(ctx, name);
+		EXPECT_EQ(japi_pushsrv_start(psc, &waiting_pushsrv_routine), 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	EXPECT_EQ(japi_destroy(ctx), 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	EXPECT_LT(elapsed, 1.0);
+}
+
+TEST(JAPI_Push_Service, Conflate)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	json_object *jreq;
+	json_object *jresp;
+	json_object *jmsg;
+	json_object *jpush;
+	json_object *jdata;
+	char buf[4096];
+	int sv[2];
+	int sndbuf;
+	int i;
+	ssize_t n;
+	bool bval;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "state");
+
+	EXPECT_EQ(japi_pushsrv_set_conflate(NULL, true), -1);
+	EXPECT_EQ(japi_pushsrv_set_conflate(psc, true), 0);
+
+	/* Subscriber with a small socket buffer that is never read */
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	sndbuf = 4096;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	jreq = json_object_new_object();
+	jresp = json_object_new_object();
+	json_object_object_add(jreq, "service", json_object_new_string("state"));
+	json_object_object_add(jreq, "socket", json_object_new_int(sv[0]));
+	japi_pushsrv_subscribe(ctx, jreq, jresp);
+	EXPECT_EQ(japi_get_value_as_bool(jresp, "success", &bval), 0);
+	EXPECT_TRUE(bval);
+
+	/* Sending never blocks, at most one message is pending */
+	jmsg = json_object_new_object();
+	for (i = 0; i < 10000; i++) {
+		json_object_object_add(jmsg, "value", json_object_new_int(i));
+		EXPECT_GE(japi_pushsrv_sendmsg(psc, jmsg), 0);
+	}
+	EXPECT_EQ(ctx->pushsrv_pending, 1);
+	ASSERT_TRUE(psc->clients->pending != NULL);
+
+	/* Drain the socket, the pending message is the newest one */
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	while (read(sv[1], buf, sizeof(buf)) > 0) {
+	}
+	japi_pushsrv_flush(ctx);
+	EXPECT_EQ(ctx->pushsrv_pending, 0);
+	n = read(sv[1], buf, sizeof(buf) - 1);
+	ASSERT_GT(n, 0);
+	buf[n] = '\0';
+	jpush = json_tokener_parse(buf);
+	ASSERT_TRUE(json_object_object_get_ex(jpush, "data", &jdata));
+	EXPECT_EQ(japi_get_value_as_int(jdata, "value", &i), 0);
+	EXPECT_EQ(i, 9999);
+
+	/* Clean up */
+	json_object_put(jpush);
+	json_object_put(jmsg);
+	json_object_put(jreq);
+	json_object_put(jresp);
+	japi_destroy(ctx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+TEST(JAPI_Push_Service, DecimationAndRateLimit)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	json_object *jmsg;
+	int sv_all[2], sv_dec[2], sv_rate[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "fast");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_all), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_dec), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_rate), 0);
+
+	/* Invalid arguments are rejected */
+	EXPECT_FALSE(subscribe_with_args(ctx, "fast", sv_dec[0], "{'decimation': 0}"));
+	EXPECT_FALSE(subscribe_with_args(ctx, "fast", sv_dec[0], "{'decimation': 'x'}"));
+	EXPECT_FALSE(subscribe_with_args(ctx, "fast", sv_rate[0], "{'max_rate': -1}"));
+
+	EXPECT_TRUE(subscribe_with_args(ctx, "fast", sv_all[0], "{}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "fast", sv_dec[0], "{'decimation': 10}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "fast", sv_rate[0], "{'max_rate': 0.5}"));
+
+	jmsg = json_object_new_object();
+	for (i = 0; i < 100; i++) {
+		json_object_object_add(jmsg, "value", json_object_new_int(i));
+		japi_pushsrv_sendmsg(psc, jmsg);
+	}
+
+	EXPECT_EQ(count_messages(sv_all[1]), 100);
+	EXPECT_EQ(count_messages(sv_dec[1]), 10);
+	EXPECT_EQ(count_messages(sv_rate[1]), 1);
+
+	/* Clean up */
+	json_object_put(jmsg);
+	japi_destroy(ctx);
+	for (i = 0; i < 2; i++) {
+		close(sv_all[i]);
+		close(sv_dec[i]);
+		close(sv_rate[i]);
+	}
+}
+
+TEST(JAPI_Push_Service, FilterAndFields)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	json_object *jmsg;
+	json_object *jsensor;
+	json_object *jpush;
+	json_object *jdata;
+	json_object *jval;
+	char buf[256];
+	ssize_t n;
+	int sv_all[2], sv_chan[2], sv_proj[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "sensors");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_all), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_chan), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_proj), 0);
+
+	/* Invalid arguments are rejected */
+	EXPECT_FALSE(subscribe_with_args(ctx, "sensors", sv_chan[0], "{'filter': 1}"));
+	EXPECT_FALSE(subscribe_with_args(ctx, "sensors", sv_proj[0], "{'fields': [1]}"));
+
+	EXPECT_TRUE(subscribe_with_args(ctx, "sensors", sv_all[0], "{}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "sensors", sv_chan[0],
+									"{'filter': {'channel': 3}}"));
+	EXPECT_TRUE(subscribe_with_args(
+		ctx, "sensors", sv_proj[0],
+		"{'filter': {'channel': 3}, 'fields': ['sensor.value']}"));
+
+	for (i = 0; i < 10; i++) {
+		jmsg = json_object_new_object();
+		jsensor = json_object_new_object();
+		json_object_object_add(jsensor, "value", json_object_new_int(i));
+		json_object_object_add(jsensor, "unit", json_object_new_string("C"));
+		json_object_object_add(jmsg, "channel", json_object_new_int(i % 5));
+		json_object_object_add(jmsg, "sensor", jsensor);
+		japi_pushsrv_sendmsg(psc, jmsg);
+		json_object_put(jmsg);
+	}
+
+	EXPECT_EQ(count_messages(sv_all[1]), 10);
+	EXPECT_EQ(count_messages(sv_chan[1]), 2);
+
+	/* Only the projected field is delivered */
+	n = read(sv_proj[1], buf, sizeof(buf) - 1);
+	ASSERT_GT(n, 0);
+	buf[n] = '\0';
+	*strchr(buf, '\n') = '\0';
+	jpush = json_tokener_parse(buf);
+	ASSERT_TRUE(json_object_object_get_ex(jpush, "data", &jdata));
+	EXPECT_FALSE(json_object_object_get_ex(jdata, "channel", NULL));
+	ASSERT_TRUE(json_object_object_get_ex(jdata, "sensor", &jsensor));
+	EXPECT_FALSE(json_object_object_get_ex(jsensor, "unit", NULL));
+	ASSERT_TRUE(json_object_object_get_ex(jsensor, "value", &jval));
+	EXPECT_EQ(json_object_get_int(jval), 3);
+	json_object_put(jpush);
+
+	/* Clean up */
+	japi_destroy(ctx);
+	for (i = 0; i < 2; i++) {
+		close(sv_all[i]);
+		close(sv_chan[i]);
+		close(sv_proj[i]);
+	}
+}
+
+TEST(JAPI_Push_Service, FilterVariants)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	japi_pushsrv_client *client;
+	json_object *jmsg;
+	int sv[12][2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "sensors");
+	for (i = 0; i < 12; i++) {
+		ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]), 0);
+	}
+
+	/* Filters differing only by key order share their variant */
+	EXPECT_TRUE(subscribe_with_args(ctx, "sensors", sv[0][0],
+									"{'filter': {'channel': 1, 'unit': 'C'}}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "sensors", sv[1][0],
+									"{'filter': {'unit': 'C', 'channel': 1}}"));
+	ASSERT_NE(psc->clients, (japi_pushsrv_client *)NULL);
+	ASSERT_NE(psc->clients->next, (japi_pushsrv_client *)NULL);
+	EXPECT_STREQ(psc->clients->filter_key, psc->clients->next->filter_key);
+
+	/* More distinct filters than fit into local storage */
+	for (i = 2; i < 12; i++) {
+		std::string args = "{'filter': {'channel': " + std::to_string(i) + "}}";
+		EXPECT_TRUE(subscribe_with_args(ctx, "sensors", sv[i][0], args.c_str()));
+	}
+	for (client = psc->clients; client != NULL; client = client->next) {
+		EXPECT_NE(client->filter_key, (char *)NULL);
+	}
+
+	for (i = 0; i < 24; i++) {
+		jmsg = json_object_new_object();
+		json_object_object_add(jmsg, "channel", json_object_new_int(i % 12));
+		json_object_object_add(jmsg, "unit", json_object_new_string("C"));
+		EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg),
+				  (i % 12 == 0) ? 0 : (i % 12 == 1) ? 2 : 1);
+		json_object_put(jmsg);
+	}
+	for (i = 0; i < 12; i++) {
+		EXPECT_EQ(count_messages(sv[i][1]), 2);
+	}
+
+	japi_destroy(ctx);
+	for (i = 0; i < 12; i++) {
+		close(sv[i][0]);
+		close(sv[i][1]);
+	}
+}
+
+TEST(JAPI_Push_Service, WildcardSubscribe)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc_a, *psc_b, *psc_hum, *psc_c;
+	json_object *jmsg;
+	json_object *jreq;
+	json_object *jresp;
+	bool bval;
+	int sv_temp[2], sv_all[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc_a = japi_pushsrv_register(ctx, "sensor/a/temperature");
+	psc_b = japi_pushsrv_register(ctx, "sensor/b/temperature");
+	psc_hum = japi_pushsrv_register(ctx, "sensor/a/humidity");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_temp), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_all), 0);
+
+	/* '#' is only allowed as last segment */
+	EXPECT_FALSE(subscribe_with_args(ctx, "sensor/#/temperature", sv_all[0], "{}"));
+
+	EXPECT_TRUE(subscribe_with_args(ctx, "sensor/*/temperature", sv_temp[0], "{}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "sensor/#", sv_all[0], "{}"));
+
+	/* Newly registered matching services are picked up */
+	psc_c = japi_pushsrv_register(ctx, "sensor/c/temperature");
+
+	jmsg = json_object_new_object();
+	json_object_object_add(jmsg, "value", json_object_new_int(1));
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_a, jmsg), 2);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_b, jmsg), 2);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_hum, jmsg), 1);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_c, jmsg), 2);
+	EXPECT_EQ(count_messages(sv_temp[1]), 3);
+	EXPECT_EQ(count_messages(sv_all[1]), 4);
+
+	/* Unsubscribing the pattern removes all matching subscriptions */
+	jreq = json_object_new_object();
+	jresp = json_object_new_object();
+	json_object_object_add(jreq, "service", json_object_new_string("sensor/*/temperature"));
+	json_object_object_add(jreq, "socket", json_object_new_int(sv_temp[0]));
+	japi_pushsrv_unsubscribe(ctx, jreq, jresp);
+	bval = false;
+	japi_get_value_as_bool(jresp, "success", &bval);
+	EXPECT_TRUE(bval);
+	json_object_put(jreq);
+	json_object_put(jresp);
+
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_c, jmsg), 1);
+	EXPECT_EQ(count_messages(sv_temp[1]), 0);
+
+	/* Clean up */
+	json_object_put(jmsg);
+	japi_destroy(ctx);
+	for (i = 0; i < 2; i++) {
+		close(sv_temp[i]);
+		close(sv_all[i]);
+	}
+}
+
+/* Unsubscribe socket from a push service or pattern and return the response */
+static json_object *unsubscribe(japi_context *ctx, const char *service, int socket)
+{
+	json_object *jreq;
+	json_object *jresp;
+
+	jreq = json_object_new_object();
+	jresp = json_object_new_object();
+	json_object_object_add(jreq, "service", json_object_new_string(service));
+	json_object_object_add(jreq, "socket", json_object_new_int(socket));
+	japi_pushsrv_unsubscribe(ctx, jreq, jresp);
+	json_object_put(jreq);
+
+	return jresp;
+}
+
+TEST(JAPI_Push_Service, WildcardOwnership)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc_b, *psc_c;
+	json_object *jmsg;
+	json_object *jresp;
+	json_object *jservices;
+	bool bval;
+	int sv[2];
+
+	ctx = japi_init(NULL);
+	psc_b = japi_pushsrv_register(ctx, "a/b");
+	psc_c = japi_pushsrv_register(ctx, "a/c");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	jmsg = json_object_new_object();
+
+	EXPECT_TRUE(subscribe_with_args(ctx, "a/b", sv[0], "{}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "a/*", sv[0], "{}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "a/#", sv[0], "{}"));
+
+	/* Services still covered by another pattern are kept */
+	jresp = unsubscribe(ctx, "a/*", sv[0]);
+	ASSERT_TRUE(json_object_object_get_ex(jresp, "services", &jservices));
+	EXPECT_EQ(json_object_array_length(jservices), 0);
+	json_object_put(jresp);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_b, jmsg), 1);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_c, jmsg), 1);
+
+	/* Services subscribed by name are kept */
+	jresp = unsubscribe(ctx, "a/#", sv[0]);
+	ASSERT_TRUE(json_object_object_get_ex(jresp, "services", &jservices));
+	ASSERT_EQ(json_object_array_length(jservices), 1);
+	EXPECT_STREQ(json_object_get_string(json_object_array_get_idx(jservices, 0)), "a/c");
+	json_object_put(jresp);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_b, jmsg), 1);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_c, jmsg), 0);
+
+	/* Unsubscribing by name only removes subscriptions made by name */
+	EXPECT_TRUE(subscribe_with_args(ctx, "a/*", sv[0], "{}"));
+	jresp = unsubscribe(ctx, "a/c", sv[0]);
+	bval = true;
+	japi_get_value_as_bool(jresp, "success", &bval);
+	EXPECT_FALSE(bval);
+	json_object_put(jresp);
+	jresp = unsubscribe(ctx, "a/b", sv[0]);
+	bval = false;
+	japi_get_value_as_bool(jresp, "success", &bval);
+	EXPECT_TRUE(bval);
+	json_object_put(jresp);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_b, jmsg), 1);
+	json_object_put(unsubscribe(ctx, "a/*", sv[0]));
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_b, jmsg), 0);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_c, jmsg), 0);
+	EXPECT_EQ(count_messages(sv[1]), 4);
+
+	json_object_put(jmsg);
+	japi_destroy(ctx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+TEST(JAPI_Push_Service, WildcardNamesDifferingByCase)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc_upper, *psc_lower;
+	json_object *jmsg;
+	int sv[2], sv_late[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc_upper = japi_pushsrv_register(ctx, "Sensor/temp");
+	psc_lower = japi_pushsrv_register(ctx, "sensor/temp");
+	ASSERT_NE(psc_upper, (japi_pushsrv_context *)NULL);
+	ASSERT_NE(psc_lower, (japi_pushsrv_context *)NULL);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_late), 0);
+
+	/* Both services match */
+	EXPECT_TRUE(subscribe_with_args(ctx, "sensor/*", sv[0], "{}"));
+	jmsg = json_object_new_object();
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_upper, jmsg), 1);
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_lower, jmsg), 1);
+	EXPECT_EQ(count_messages(sv[1]), 2);
+
+	/* Destroying one keeps the other matchable */
+	EXPECT_EQ(japi_pushsrv_destroy(ctx, psc_lower), 0);
+	EXPECT_TRUE(subscribe_with_args(ctx, "SENSOR/#", sv_late[0], "{}"));
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc_upper, jmsg), 2);
+	EXPECT_EQ(count_messages(sv_late[1]), 1);
+
+	json_object_put(jmsg);
+	japi_destroy(ctx);
+	for (i = 0; i < 2; i++) {
+		close(sv[i]);
+		close(sv_late[i]);
+	}
+}
+
+TEST(JAPI_Push_Service, ReplaySinceSeq)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	json_object *jmsg;
+	json_object *jreq;
+	json_object *jresp;
+	json_object *jpush;
+	json_object *jval;
+	char buf[256];
+	ssize_t n;
+	bool bval;
+	int sv_gap[2], sv_old[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "replay");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_gap), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_old), 0);
+
+	EXPECT_EQ(japi_pushsrv_set_replay(NULL, 5), -1);
+	EXPECT_EQ(japi_pushsrv_set_replay(psc, 5), 0);
+	EXPECT_FALSE(subscribe_with_args(ctx, "replay", sv_gap[0], "{'since_seq': -1}"));
+
+	/* Messages are numbered even without subscribers */
+	jmsg = json_object_new_object();
+	for (i = 1; i <= 8; i++) {
+		json_object_object_add(jmsg, "value", json_object_new_int(i));
+		japi_pushsrv_sendmsg(psc, jmsg);
+	}
+
+	/* The gap after message 6 is replayed from memory */
+	jreq = json_tokener_parse("{'service': 'replay', 'since_seq': 6}");
+	json_object_object_add(jreq, "socket", json_object_new_int(sv_gap[0]));
+	jresp = json_object_new_object();
+	japi_pushsrv_subscribe(ctx, jreq, jresp);
+	bval = false;
+	japi_get_value_as_bool(jresp, "replay_complete", &bval);
+	EXPECT_TRUE(bval);
+	json_object_put(jreq);
+	json_object_put(jresp);
+
+	n = read(sv_gap[1], buf, sizeof(buf) - 1);
+	ASSERT_GT(n, 0);
+	buf[n] = '\0';
+	EXPECT_EQ(std::count(buf, buf + n, '\n'), 2);
+	*strchr(buf, '\n') = '\0';
+	jpush = json_tokener_parse(buf);
+	ASSERT_TRUE(json_object_object_get_ex(jpush, "japi_pushsrv_seq", &jval));
+	EXPECT_EQ(json_object_get_int(jval), 7);
+	json_object_put(jpush);
+
+	/* Messages 2 and 3 are not kept anymore */
+	jreq = json_tokener_parse("{'service': 'replay', 'since_seq': 1}");
+	json_object_object_add(jreq, "socket", json_object_new_int(sv_old[0]));
+	jresp = json_object_new_object();
+	japi_pushsrv_subscribe(ctx, jreq, jresp);
+	bval = true;
+	japi_get_value_as_bool(jresp, "replay_complete", &bval);
+	EXPECT_FALSE(bval);
+	json_object_put(jreq);
+	json_object_put(jresp);
+	EXPECT_EQ(count_messages(sv_old[1]), 5);
+
+	/* New messages continue the sequence */
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 2);
+	EXPECT_EQ(psc->seq, 9u);
+
+	/* Clean up */
+	json_object_put(jmsg);
+	japi_destroy(ctx);
+	for (i = 0; i < 2; i++) {
+		close(sv_gap[i]);
+		close(sv_old[i]);
+	}
+}
+
+TEST(JAPI_Push_Service, ReplayToFullSocket)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	json_object *jmsg;
+	std::string data, seq;
+	char buf[4096];
+	ssize_t len;
+	size_t pos;
+	int sv[2];
+	int i, n;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "replay");
+	EXPECT_EQ(japi_pushsrv_set_replay(psc, 100), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+	jmsg = json_object_new_object();
+	for (i = 1; i <= 100; i++) {
+		json_object_object_add(jmsg, "value", json_object_new_int(i));
+		japi_pushsrv_sendmsg(psc, jmsg);
+	}
+
+	/* Fill the socket buffer as a client that stopped reading */
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	n = 0;
+	while (write(sv[0], "\n", 1) == 1) {
+		n++;
+	}
+	fcntl(sv[0], F_SETFL, 0);
+
+	/* Subscribing doesn't block, the replay is queued */
+	EXPECT_TRUE(subscribe_with_args(ctx, "replay", sv[0], "{'since_seq': 0}"));
+	EXPECT_GT(ctx->pushsrv_pending, 0);
+
+	/* Once the client reads again, the server loop sends the rest in order,
+	 * followed by new messages */
+	for (i = 0; i < n; i++) {
+		ASSERT_EQ(read(sv[1], buf, 1), 1);
+	}
+	for (i = 0; i < 1000 && ctx->pushsrv_pending > 0; i++) {
+		japi_pushsrv_flush(ctx);
+		while ((len = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+			data.append(buf, len);
+		}
+	}
+	EXPECT_EQ(ctx->pushsrv_pending, 0);
+	japi_pushsrv_sendmsg(psc, jmsg);
+	while ((len = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		data.append(buf, len);
+	}
+
+	for (i = 1; i <= 101; i++) {
+		pos = data.find('\n');
+		ASSERT_NE(pos, std::string::npos);
+		seq = "\"japi_pushsrv_seq\": " + std::to_string(i) + ",";
+		EXPECT_NE(data.substr(0, pos).find(seq), std::string::npos);
+		data.erase(0, pos + 1);
+	}
+	EXPECT_TRUE(data.empty());
+
+	json_object_put(jmsg);
+	japi_destroy(ctx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+static int snapshot_callback(japi_pushsrv_context *psc, json_object *jdata)
+{
+	json_object_object_add(jdata, "state", json_object_new_int(42));
+	return 0;
+}
+
+static int empty_snapshot_callback(japi_pushsrv_context *psc, json_object *jdata)
+{
+	return -1;
+}
+
+TEST(JAPI_Push_Service, SnapshotOnSubscribe)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc_cache, *psc_cb;
+	json_object *jmsg;
+	json_object *jpush;
+	json_object *jdata;
+	json_object *jval;
+	char buf[256];
+	ssize_t n;
+	int sv[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc_cache = japi_pushsrv_register(ctx, "cached");
+	psc_cb = japi_pushsrv_register(ctx, "callback");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+	EXPECT_EQ(japi_pushsrv_set_snapshot_cache(NULL, true), -1);
+	EXPECT_EQ(japi_pushsrv_set_snapshot(NULL, snapshot_callback), -1);
+
+	/* The last sent message is delivered on subscribe */
+	EXPECT_EQ(japi_pushsrv_set_snapshot_cache(psc_cache, true), 0);
+	jmsg = json_object_new_object();
+	for (i = 1; i <= 3; i++) {
+		json_object_object_add(jmsg, "value", json_object_new_int(i));
+		japi_pushsrv_sendmsg(psc_cache, jmsg);
+	}
+	json_object_put(jmsg);
+	EXPECT_TRUE(subscribe_with_args(ctx, "cached", sv[0], "{}"));
+
+	n = read(sv[1], buf, sizeof(buf) - 1);
+	ASSERT_GT(n, 0);
+	buf[n] = '\0';
+	EXPECT_EQ(std::count(buf, buf + n, '\n'), 1);
+	jpush = json_tokener_parse(buf);
+	ASSERT_TRUE(json_object_object_get_ex(jpush, "data", &jdata));
+	ASSERT_TRUE(json_object_object_get_ex(jdata, "value", &jval));
+	EXPECT_EQ(json_object_get_int(jval), 3);
+	json_object_put(jpush);
+
+	/* The snapshot callback provides the current state */
+	EXPECT_EQ(japi_pushsrv_set_snapshot(psc_cb, snapshot_callback), 0);
+	EXPECT_TRUE(subscribe_with_args(ctx, "callback", sv[0], "{}"));
+	n = read(sv[1], buf, sizeof(buf) - 1);
+	ASSERT_GT(n, 0);
+	buf[n] = '\0';
+	jpush = json_tokener_parse(buf);
+	ASSERT_TRUE(json_object_object_get_ex(jpush, "data", &jdata));
+	ASSERT_TRUE(json_object_object_get_ex(jdata, "state", &jval));
+	EXPECT_EQ(json_object_get_int(jval), 42);
+	json_object_put(jpush);
+
+	/* Nothing is sent if the callback has no state */
+	EXPECT_EQ(japi_pushsrv_set_snapshot(psc_cb, empty_snapshot_callback), 0);
+	EXPECT_TRUE(subscribe_with_args(ctx, "callback", sv[0], "{}"));
+	EXPECT_EQ(count_messages(sv[1]), 0);
+
+	/* Clean up */
+	japi_destroy(ctx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+TEST(JAPI_Push_Service, Delta)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	std::vector<std::string> msgs;
+	json_object *jmsg;
+	json_object *jsub;
+	json_object *jpush;
+	json_object *jdelta;
+	int sv_all[2], sv_dec[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "state");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_all), 0);
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv_dec), 0);
+
+	EXPECT_EQ(japi_pushsrv_set_delta(NULL, 3), -1);
+	EXPECT_EQ(japi_pushsrv_set_delta(psc, 3), 0);
+
+	jmsg = json_object_new_object();
+	jsub = json_object_new_object();
+	json_object_object_add(jmsg, "unchanged", json_object_new_string("large value"));
+	json_object_object_add(jmsg, "sub", jsub);
+
+	/* No delta base is kept without subscribers */
+	japi_pushsrv_sendmsg(psc, jmsg);
+	EXPECT_EQ(psc->delta_prev, nullptr);
+
+	EXPECT_TRUE(subscribe_with_args(ctx, "state", sv_all[0], "{}"));
+	EXPECT_TRUE(subscribe_with_args(ctx, "state", sv_dec[0], "{'decimation': 2}"));
+	for (i = 1; i <= 4; i++) {
+		json_object_object_add(jsub, "value", json_object_new_int(i));
+		japi_pushsrv_sendmsg(psc, jmsg);
+	}
+	json_object_put(jmsg);
+	EXPECT_NE(psc->delta_prev, nullptr);
+
+	/* Keyframe, two deltas, keyframe */
+	msgs = read_messages(sv_all[1]);
+	ASSERT_EQ(msgs.size(), 4u);
+	for (i = 0; i < 4; i++) {
+		jpush = json_tokener_parse(msgs[i].c_str());
+		EXPECT_EQ(json_object_object_get_ex(jpush, "delta", &jdelta), i == 1 || i == 2);
+		if (i == 1) {
+			EXPECT_STREQ(json_object_to_json_string_ext(jdelta, JSON_C_TO_STRING_PLAIN),
+						 "{\"sub\":{\"value\":2}}");
+		}
+		json_object_put(jpush);
+	}
+
+	/* Subscribers that skipped the previous message get full messages */
+	msgs = read_messages(sv_dec[1]);
+	ASSERT_EQ(msgs.size(), 2u);
+	for (i = 0; i < 2; i++) {
+		jpush = json_tokener_parse(msgs[i].c_str());
+		EXPECT_TRUE(json_object_object_get_ex(jpush, "data", NULL));
+		json_object_put(jpush);
+	}
+
+	/* Clean up */
+	japi_destroy(ctx);
+	for (i = 0; i < 2; i++) {
+		close(sv_all[i]);
+		close(sv_dec[i]);
+	}
+}
+
+TEST(JAPI_Push_Service, Coalesce)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	json_object *jmsg;
+	char buf[4096];
+	ssize_t n;
+	int sv[2];
+	int i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "ticks");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	EXPECT_TRUE(subscribe_with_args(ctx, "ticks", sv[0], "{}"));
+
+	EXPECT_EQ(japi_pushsrv_set_coalesce(NULL, 1000), -1);
+	EXPECT_EQ(japi_pushsrv_set_coalesce(psc, 100000), 0);
+	EXPECT_EQ(ctx->pushsrv_coalesce_us, 100000u);
+
+	/* Messages within the window are queued */
+	jmsg = json_object_new_object();
+	for (i = 0; i < 5; i++) {
+		json_object_object_add(jmsg, "value", json_object_new_int(i));
+		EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 1);
+	}
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	EXPECT_LT(read(sv[1], buf, sizeof(buf)), 0);
+	EXPECT_EQ(ctx->pushsrv_pending, 1);
+
+	/* The server loop sends them with a single write once the window passed */
+	usleep(110000);
+	japi_pushsrv_flush(ctx);
+	EXPECT_EQ(ctx->pushsrv_pending, 0);
+	n = read(sv[1], buf, sizeof(buf));
+	ASSERT_GT(n, 0);
+	EXPECT_EQ(std::count(buf, buf + n, '\n'), 5);
+
+	/* Disabling coalescing sends queued messages */
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 1);
+	EXPECT_EQ(japi_pushsrv_set_coalesce(psc, 0), 0);
+	EXPECT_EQ(count_messages(sv[1]), 1);
+	EXPECT_EQ(ctx->pushsrv_coalesce_us, 0u);
+
+	/* Clean up */
+	json_object_put(jmsg);
+	japi_destroy(ctx);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+/* Send a request line and read the response line */
+static std::string send_request(int fd, const char *request)
+{
+	std::string response;
+	char c;
+
+	if (write(fd, request, strlen(request)) < 0 || write(fd, "\n", 1) < 0) {
+		return "";
+	}
+	while (read(fd, &c, 1) == 1 && c != '\n') {
+		response += c;
+	}
+
+	return response;
+}
+
+/* Connect to a Unix domain socket. A leading '@' selects the abstract namespace. */
+static int connect_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	addrlen = sizeof(addr);
+	if (path[0] == '@') {
+		addr.sun_path[0] = '\0';
+		addrlen = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+	}
+
+	/* Retry until the server thread listens */
+	for (int i = 0; i < 100; i++) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&addr, addrlen) == 0) {
+			return fd;
+		}
+		close(fd);
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+#ifdef __linux__
+/* Receive the line announcing a shared memory ring and its file descriptor */
+static int recv_shm_fd(int socket, std::string &line)
+{
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	char buf[256];
+	ssize_t n;
+	int fd;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	n = recvmsg(socket, &mh, 0);
+	if (n <= 0) {
+		return -1;
+	}
+	line.assign(buf, n);
+
+	fd = -1;
+	cmsg = CMSG_FIRSTHDR(&mh);
+	if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS) {
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	return fd;
+}
+
+TEST(JAPI_Push_Service, SharedMemory)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	japi_shm_ring *ring;
+	json_object *jmsg;
+	std::string line;
+	char buf[256];
+	int sv[2];
+	int tcp_fd, fd, len, i;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "samples");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+	/* Invalid sizes, wildcards and TCP sockets are rejected */
+	EXPECT_FALSE(subscribe_with_args(ctx, "samples", sv[0], "{'shm': 16}"));
+	EXPECT_FALSE(subscribe_with_args(ctx, "sam*", sv[0], "{'shm': 65536}"));
+	tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+	EXPECT_FALSE(subscribe_with_args(ctx, "samples", tcp_fd, "{'shm': 65536}"));
+	close(tcp_fd);
+
+	/* The ring is announced on the socket */
+	EXPECT_TRUE(subscribe_with_args(ctx, "samples", sv[0], "{'shm': 5000}"));
+	fd = recv_shm_fd(sv[1], line);
+	ASSERT_GE(fd, 0);
+	EXPECT_NE(line.find("\"japi_pushsrv_shm\""), std::string::npos);
+	EXPECT_NE(line.find("8192"), std::string::npos);
+	ring = japi_shm_attach(fd);
+	close(fd);
+	ASSERT_NE(ring, (japi_shm_ring *)NULL);
+	EXPECT_EQ(ring->size, 8192u);
+	EXPECT_EQ(japi_shm_read(ring, buf, sizeof(buf)), 0);
+
+	/* Messages are written to the ring instead of the socket */
+	jmsg = json_object_new_object();
+	for (i = 1; i <= 3; i++) {
+		json_object_object_add(jmsg, "value", json_object_new_int(i));
+		EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 1);
+	}
+	EXPECT_EQ(count_messages(sv[1]), 0);
+	for (i = 1; i <= 3; i++) {
+		len = japi_shm_read(ring, buf, sizeof(buf) - 1);
+		ASSERT_GT(len, 0);
+		buf[len] = '\0';
+		EXPECT_EQ(buf[len - 1], '\n');
+		EXPECT_NE(strstr(buf, ("\"value\": " + std::to_string(i)).c_str()), (char *)NULL);
+		EXPECT_NE(strstr(buf, ("\"japi_pushsrv_seq\": " + std::to_string(i)).c_str()),
+				  (char *)NULL);
+	}
+	EXPECT_EQ(japi_shm_read(ring, buf, sizeof(buf)), 0);
+
+	/* A full ring drops messages instead of blocking the producer */
+	for (i = 0; i < 1000; i++) {
+		japi_pushsrv_sendmsg(psc, jmsg);
+	}
+	EXPECT_GT(ring->dropped, 0u);
+	EXPECT_EQ(japi_shm_read(ring, buf, 4), -1);
+	EXPECT_GT(japi_shm_read(ring, buf, sizeof(buf)), 0);
+	json_object_put(jmsg);
+
+	japi_shm_detach(ring);
+	close(sv[0]);
+	close(sv[1]);
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Push_Service, SharedMemoryCorruptHeader)
+{
+	japi_context *ctx;
+	japi_pushsrv_context *psc;
+	japi_shm_ring *ring;
+	json_object *jmsg;
+	std::string line;
+	uint64_t head, dropped;
+	char buf[256];
+	int sv[2];
+	int fd;
+
+	ctx = japi_init(NULL);
+	psc = japi_pushsrv_register(ctx, "samples");
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	EXPECT_TRUE(subscribe_with_args(ctx, "samples", sv[0], "{'shm': 4096}"));
+	fd = recv_shm_fd(sv[1], line);
+	ASSERT_GE(fd, 0);
+	ring = japi_shm_attach(fd);
+	close(fd);
+	ASSERT_NE(ring, (japi_shm_ring *)NULL);
+
+	jmsg = json_object_new_object();
+	json_object_object_add(jmsg, "value", json_object_new_int(1));
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 1);
+	head = ring->head;
+
+	/* The layout and head in the header are ignored by the server */
+	ring->size = UINT64_MAX;
+	ring->data_offset = UINT32_MAX;
+	ring->head = 1ULL << 40;
+
+	/* A tail ahead of head or too far behind drops messages */
+	ring->tail = head + 4096;
+	dropped = ring->dropped;
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 1);
+	EXPECT_EQ(ring->dropped, dropped + 1);
+	ring->tail = head - 4096 - 1;
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 1);
+	EXPECT_EQ(ring->dropped, dropped + 2);
+
+	/* A valid tail lets messages through again */
+	ring->tail = head;
+	EXPECT_EQ(japi_pushsrv_sendmsg(psc, jmsg), 1);
+	EXPECT_EQ(ring->dropped, dropped + 2);
+	json_object_put(jmsg);
+
+	/* The server unmaps what it mapped */
+	close(sv[0]);
+	close(sv[1]);
+	japi_destroy(ctx);
+
+	/* The message follows the first one */
+	ring->size = 4096;
+	ring->data_offset = sizeof(japi_shm_ring);
+	memset(buf, 0, sizeof(buf));
+	EXPECT_GT(japi_shm_read(ring, buf, sizeof(buf) - 1), 0);
+	EXPECT_NE(strstr(buf, "\"japi_pushsrv_seq\": 4"), (char *)NULL);
+	japi_shm_detach(ring);
+}
+#endif
+
+TEST(JAPI_Server, UnixListener)
+{
+	japi_context *ctx;
+	std::string path;
+	std::string response;
+	int fd;
+
+	ctx = japi_init(NULL);
+	path = "/tmp/japi_test_" + std::to_string(getpid()) + ".sock";
+
+	EXPECT_EQ(japi_add_unix_listener(NULL, path.c_str()), -1);
+	EXPECT_EQ(japi_add_unix_listener(ctx, ""), -2);
+	EXPECT_EQ(japi_add_unix_listener(ctx, "/nonexisting/dir/japi.sock"), -3);
+	ASSERT_EQ(japi_add_unix_listener(ctx, path.c_str()), 0);
+#ifdef __linux__
+	ASSERT_EQ(japi_add_unix_listener(ctx, "@japi_test_abstract"), 0);
+#endif
+
+	/* Serve the Unix sockets only */
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	fd = connect_unix(path.c_str());
+	ASSERT_GE(fd, 0);
+	response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	close(fd);
+
+#ifdef __linux__
+	fd = connect_unix("@japi_test_abstract");
+	ASSERT_GE(fd, 0);
+	response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	close(fd);
+#endif
+
+	japi_shutdown(ctx);
+	server.join();
+
+	/* The socket file is removed */
+	japi_destroy(ctx);
+	EXPECT_NE(access(path.c_str(), F_OK), 0);
+}
+
+/* Port a listener of the context is bound to */
+static int listener_port(japi_listener *listener)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	addrlen = sizeof(addr);
+	if (getsockname(listener->socket, (struct sockaddr *)&addr, &addrlen) != 0) {
+		return -1;
+	}
+	if (addr.ss_family == AF_INET6) {
+		return ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+	}
+	return ntohs(((struct sockaddr_in *)&addr)->sin_port);
+}
+
+/* Connect to a TCP port on the loopback address of the given family */
+static int connect_tcp(int family, int port)
+{
+	struct sockaddr_in addr4;
+	struct sockaddr_in6 addr6;
+	int fd;
+
+	memset(&addr4, 0, sizeof(addr4));
+	addr4.sin_family = AF_INET;
+	addr4.sin_port = htons(port);
+	addr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	memset(&addr6, 0, sizeof(addr6));
+	addr6.sin6_family = AF_INET6;
+	addr6.sin6_port = htons(port);
+	addr6.sin6_addr = in6addr_loopback;
+
+	/* Retry until the server thread listens */
+	for (int i = 0; i < 100; i++) {
+		fd = socket(family, SOCK_STREAM, 0);
+		if (fd < 0 || (family == AF_INET6
+						   ? connect(fd, (struct sockaddr *)&addr6, sizeof(addr6))
+						   : connect(fd, (struct sockaddr *)&addr4, sizeof(addr4))) == 0) {
+			return fd;
+		}
+		close(fd);
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+TEST(JAPI_Server, TcpListeners)
+{
+	japi_context *ctx;
+	std::string response;
+	int port4, port6;
+	int fd;
+
+	ctx = japi_init(NULL);
+
+	EXPECT_EQ(japi_set_listen_backlog(NULL, 64), -1);
+	EXPECT_EQ(japi_set_listen_backlog(ctx, 0), -2);
+	EXPECT_EQ(japi_set_listen_backlog(ctx, 64), 0);
+	EXPECT_EQ(ctx->listen_backlog, 64);
+
+	EXPECT_EQ(japi_add_tcp_listener(NULL, "127.0.0.1", "0"), -1);
+	EXPECT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", NULL), -2);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port4 = listener_port(ctx->listeners);
+
+	/* IPv6 may not be available on the test host */
+	port6 = -1;
+	if (japi_add_tcp_listener(ctx, "::1", "0") == 0) {
+		port6 = listener_port(ctx->listeners);
+	}
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	/* All endpoints are served by the same loop */
+	fd = connect_tcp(AF_INET, port4);
+	ASSERT_GE(fd, 0);
+	response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	close(fd);
+
+	if (port6 >= 0) {
+		fd = connect_tcp(AF_INET6, port6);
+		ASSERT_GE(fd, 0);
+		response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+		EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+		close(fd);
+	}
+
+	japi_shutdown(ctx);
+	server.join();
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, SocketOptions)
+{
+	japi_context *ctx;
+	japi_socket_options opts;
+	std::string response;
+	socklen_t len;
+	int port, fd, value;
+
+	ctx = japi_init(NULL);
+
+	memset(&opts, 0, sizeof(opts));
+	EXPECT_EQ(japi_set_socket_options(NULL, &opts), -1);
+	EXPECT_EQ(japi_set_socket_options(ctx, NULL), -1);
+	opts.sndbuf = -1;
+	EXPECT_EQ(japi_set_socket_options(ctx, &opts), -2);
+
+	opts.sndbuf = 0;
+	opts.tcp_nodelay = true;
+	opts.keepalive = true;
+	opts.keepalive_idle = 30;
+	EXPECT_EQ(japi_set_socket_options(ctx, &opts), 0);
+
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(fd, 0);
+	/* The client is registered once its request was answered */
+	response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+	ASSERT_NE(ctx->clients, (japi_client *)NULL);
+
+	value = 0;
+	len = sizeof(value);
+	EXPECT_EQ(getsockopt(ctx->clients->socket, IPPROTO_TCP, TCP_NODELAY, &value, &len), 0);
+	EXPECT_NE(value, 0);
+	value = 0;
+	len = sizeof(value);
+	EXPECT_EQ(getsockopt(ctx->clients->socket, SOL_SOCKET, SO_KEEPALIVE, &value, &len), 0);
+	EXPECT_NE(value, 0);
+
+	close(fd);
+	japi_shutdown(ctx);
+	server.join();
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, Timeouts)
+{
+	japi_context *ctx;
+	struct timeval tv;
+	struct timespec start, end;
+	std::string response;
+	const char *line;
+	double elapsed;
+	size_t sent;
+	char c;
+	int port, idle_fd, stalled_fd, fd;
+
+	ctx = japi_init(NULL);
+
+	EXPECT_EQ(japi_set_idle_timeout(NULL, 100), -1);
+	EXPECT_EQ(japi_set_request_timeout(NULL, 100), -1);
+	EXPECT_EQ(japi_set_idle_timeout(ctx, 300), 0);
+	EXPECT_EQ(japi_set_request_timeout(ctx, 100), 0);
+
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	/* Don't let a missing disconnect hang the test */
+	tv.tv_sec = 3;
+	tv.tv_usec = 0;
+
+	/* A client stalling within a request line is dropped */
+	stalled_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(stalled_fd, 0);
+	setsockopt(stalled_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	ASSERT_EQ(write(stalled_fd, "{'japi_request'", 15), 15);
+	EXPECT_EQ(read(stalled_fd, &c, 1), 0);
+	close(stalled_fd);
+
+	/* A client trickling a line byte by byte is dropped as well, meanwhile other
+	 * clients are answered without waiting for the rest of its line */
+	line = "{'japi_request': 'japi_cmd_list'}\n";
+	sent = 0;
+	stalled_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(stalled_fd, 0);
+	std::thread trickle([&]() {
+		while (line[sent] != '\0' && send(stalled_fd, &line[sent], 1, MSG_NOSIGNAL) == 1) {
+			sent++;
+			usleep(90000);
+		}
+	});
+	usleep(50000);
+	fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(fd, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	EXPECT_LT(elapsed, 0.05);
+	close(fd);
+	trickle.join();
+	EXPECT_LT(sent, strlen(line));
+	close(stalled_fd);
+
+	/* A silent client is dropped after the idle timeout */
+	idle_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(idle_fd, 0);
+	setsockopt(idle_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	response = send_request(idle_fd, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	EXPECT_EQ(read(idle_fd, &c, 1), 0);
+	close(idle_fd);
+
+	/* Active clients stay connected */
+	fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(fd, 0);
+	for (int i = 0; i < 5; i++) {
+		response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+		EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+		usleep(100000);
+	}
+	close(fd);
+
+	japi_shutdown(ctx);
+	server.join();
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, AcceptBurstAndOverload)
+{
+	japi_context *ctx;
+	struct timeval tv;
+	std::string response;
+	std::vector<int> fds;
+	char buf[128];
+	ssize_t n;
+	int port, fd;
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+	EXPECT_EQ(japi_set_max_allowed_clients(ctx, 8), 0);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	/* Connect more clients at once than allowed */
+	for (int i = 0; i < 12; i++) {
+		fd = connect_tcp(AF_INET, port);
+		ASSERT_GE(fd, 0);
+		tv.tv_sec = 3;
+		tv.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		fds.push_back(fd);
+	}
+
+	/* The first clients are served, the rest is told to back off */
+	for (size_t i = 0; i < fds.size(); i++) {
+		if (i < 8) {
+			response = send_request(fds[i], "{'japi_request': 'japi_cmd_list'}");
+			EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+		} else {
+			n = read(fds[i], buf, sizeof(buf) - 1);
+			ASSERT_GT(n, 0);
+			buf[n] = '\0';
+			EXPECT_STREQ(buf, "{ \"error\": \"too many clients\" }\n");
+			EXPECT_EQ(read(fds[i], buf, sizeof(buf)), 0);
+		}
+	}
+
+	for (size_t i = 0; i < fds.size(); i++) {
+		close(fds[i]);
+	}
+	japi_shutdown(ctx);
+	server.join();
+	japi_destroy(ctx);
+}
+
+/* Connect a client while the process is out of file descriptors */
+static void accept_out_of_descriptors(japi_backend backend)
+{
+	japi_context *ctx;
+	struct sockaddr_in addr;
+	struct rlimit rlim, low;
+	std::string response;
+	std::vector<int> fds;
+	int port, served, waiting, fd;
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_set_backend(ctx, backend), 0);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+	served = connect_tcp(AF_INET, port);
+	ASSERT_GE(served, 0);
+	/* Make sure the server accepted it before running out of descriptors */
+	response = send_request(served, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	waiting = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_GE(waiting, 0);
+
+	/* Use up all descriptors before the next client connects */
+	ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &rlim), 0);
+	low = rlim;
+	low.rlim_cur = 256;
+	ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &low), 0);
+	while ((fd = dup(served)) >= 0) {
+		fds.push_back(fd);
+	}
+	EXPECT_EQ(errno, EMFILE);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ(connect(waiting, (struct sockaddr *)&addr, sizeof(addr)), 0);
+	usleep(50000);
+
+	/* The server keeps serving connected clients */
+	response = send_request(served, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+
+	/* and accepts the waiting client once descriptors are available again */
+	for (size_t i = 0; i < fds.size(); i++) {
+		close(fds[i]);
+	}
+	ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &rlim), 0);
+	response = send_request(waiting, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+
+	close(served);
+	close(waiting);
+	japi_shutdown(ctx);
+	server.join();
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, AcceptOutOfDescriptors)
+{
+	accept_out_of_descriptors(JAPI_BACKEND_SELECT);
+#ifdef __linux__
+	accept_out_of_descriptors(JAPI_BACKEND_EPOLL);
+	if (japi_uring_probe() == 0) {
+		accept_out_of_descriptors(JAPI_BACKEND_IO_URING);
+	}
+#endif
+}
+
+#ifdef __linux__
+TEST(JAPI_Server, EpollBackend)
+{
+	japi_context *ctx;
+	std::string response;
+	std::vector<int> fds;
+	struct timeval tv;
+	char c;
+	int port, fd;
+
+	ctx = japi_init(NULL);
+	EXPECT_EQ(japi_set_backend(NULL, JAPI_BACKEND_EPOLL), -1);
+	EXPECT_EQ(japi_set_backend(ctx, (japi_backend)42), -2);
+	EXPECT_EQ(japi_set_backend(ctx, JAPI_BACKEND_EPOLL), 0);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	/* Several clients with pipelined requests */
+	for (int i = 0; i < 16; i++) {
+		fd = connect_tcp(AF_INET, port);
+		ASSERT_GE(fd, 0);
+		fds.push_back(fd);
+	}
+	for (size_t i = 0; i < fds.size(); i++) {
+		ASSERT_EQ(write(fds[i], "{'japi_request': 'japi_cmd_list'}\n", 34), 34);
+	}
+	for (size_t i = 0; i < fds.size(); i++) {
+		response = send_request(fds[i], "{'japi_request': 'japi_pushsrv_list'}");
+		EXPECT_NE(response.find("japi_cmd_list"), std::string::npos);
+		response.clear();
+		while (read(fds[i], &c, 1) == 1 && c != '\n') {
+			response += c;
+		}
+		EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	}
+	EXPECT_GE(ctx->epoll_fd, 0);
+
+	/* Idle clients are dropped by the epoll loop as well */
+	EXPECT_EQ(japi_set_idle_timeout(ctx, 100), 0);
+	tv.tv_sec = 3;
+	tv.tv_usec = 0;
+	setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	EXPECT_EQ(read(fds[0], &c, 1), 0);
+
+	for (size_t i = 0; i < fds.size(); i++) {
+		close(fds[i]);
+	}
+	japi_shutdown(ctx);
+	server.join();
+	EXPECT_EQ(ctx->epoll_fd, -1);
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, IoUringBackend)
+{
+	japi_context *ctx;
+	std::string response, burst;
+	std::vector<int> fds;
+	struct timeval tv;
+	size_t lines;
+	char buf[4096];
+	ssize_t n;
+	char c;
+	int port, fd;
+
+	ctx = japi_init(NULL);
+	if (japi_set_backend(ctx, JAPI_BACKEND_IO_URING) != 0) {
+		/* Kernel without io_uring or with io_uring disabled */
+		EXPECT_NE(japi_uring_probe(), 0);
+		japi_destroy(ctx);
+		return;
+	}
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	/* Several clients with pipelined requests */
+	for (int i = 0; i < 16; i++) {
+		fd = connect_tcp(AF_INET, port);
+		ASSERT_GE(fd, 0);
+		fds.push_back(fd);
+	}
+	for (size_t i = 0; i < fds.size(); i++) {
+		ASSERT_EQ(write(fds[i], "{'japi_request': 'japi_cmd_list'}\n", 34), 34);
+	}
+	for (size_t i = 0; i < fds.size(); i++) {
+		response = send_request(fds[i], "{'japi_request': 'japi_pushsrv_list'}");
+		EXPECT_NE(response.find("japi_cmd_list"), std::string::npos);
+		response.clear();
+		while (read(fds[i], &c, 1) == 1 && c != '\n') {
+			response += c;
+		}
+		EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	}
+	EXPECT_NE(ctx->uring, nullptr);
+
+	/* A line split across writes is answered once complete */
+	ASSERT_EQ(write(fds[1], "{'japi_request': ", 17), 17);
+	usleep(20000);
+	response = send_request(fds[1], "'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+
+	/* More responses than sent by one chain of linked sends arrive in order */
+	for (int i = 0; i < 200; i++) {
+		burst += "{'japi_request': 'japi_cmd_list'}\n";
+	}
+	ASSERT_EQ(write(fds[2], burst.c_str(), burst.size()), (ssize_t)burst.size());
+	lines = 0;
+	while (lines < 200 && (n = read(fds[2], buf, sizeof(buf))) > 0) {
+		lines += std::count(buf, buf + n, '\n');
+	}
+	EXPECT_EQ(lines, 200u);
+
+	/* Clients stalling within a line and idle clients are dropped by the
+	 * io_uring loop as well */
+	tv.tv_sec = 3;
+	tv.tv_usec = 0;
+	EXPECT_EQ(japi_set_request_timeout(ctx, 100), 0);
+	setsockopt(fds[3], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	ASSERT_EQ(write(fds[3], "{'japi_request'", 15), 15);
+	EXPECT_EQ(read(fds[3], &c, 1), 0);
+	EXPECT_EQ(japi_set_idle_timeout(ctx, 100), 0);
+	setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	EXPECT_EQ(read(fds[0], &c, 1), 0);
+
+	for (size_t i = 0; i < fds.size(); i++) {
+		close(fds[i]);
+	}
+	japi_shutdown(ctx);
+	server.join();
+	EXPECT_EQ(ctx->uring, nullptr);
+	japi_destroy(ctx);
+}
+#endif
+
+#ifdef __linux__
+TEST(JAPI_Server, ProcessEvents)
+{
+	japi_context *ctx;
+	struct pollfd pfd;
+	std::string response;
+	char buf[256];
+	ssize_t n;
+	int port, fd, client_fd;
+
+	EXPECT_EQ(japi_get_fd(NULL), -1);
+	EXPECT_EQ(japi_get_timeout(NULL), -1);
+	EXPECT_EQ(japi_process_events(NULL, 0), -1);
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	/* Driven from the test's own loop, without a server thread */
+	fd = japi_get_fd(ctx);
+	ASSERT_GE(fd, 0);
+	EXPECT_EQ(japi_get_fd(ctx), fd);
+	EXPECT_GT(japi_get_timeout(ctx), 0);
+	EXPECT_EQ(japi_process_events(ctx, 0), 0);
+
+	client_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(client_fd, 0);
+	ASSERT_EQ(write(client_fd, "{'japi_request': 'japi_cmd_list'}\n", 34), 34);
+
+	for (int i = 0; i < 100 && response.find('\n') == std::string::npos; i++) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, japi_get_timeout(ctx)) > 0) {
+			EXPECT_EQ(japi_process_events(ctx, 0), 0);
+		}
+		n = recv(client_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n > 0) {
+			response.append(buf, n);
+		}
+	}
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+	EXPECT_EQ(ctx->num_clients, 1);
+
+	/* Disconnects are handled as well */
+	close(client_fd);
+	for (int i = 0; i < 100 && ctx->num_clients > 0; i++) {
+		EXPECT_EQ(japi_process_events(ctx, 10), 0);
+	}
+	EXPECT_EQ(ctx->num_clients, 0);
+
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, ClientRateLimit)
+{
+	japi_context *ctx;
+	std::string response;
+	int port, fd, other_fd, limited;
+
+	ctx = japi_init(NULL);
+
+	EXPECT_EQ(japi_set_client_rate_limit(NULL, 10, 2), -1);
+	EXPECT_EQ(japi_set_client_rate_limit(ctx, -1, 2), -2);
+	EXPECT_EQ(japi_set_client_rate_limit(ctx, 10, 0), -2);
+	EXPECT_EQ(japi_set_client_rate_limit(ctx, 1, 2), 0);
+
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	/* A client exceeding its burst is limited */
+	fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(fd, 0);
+	limited = 0;
+	for (int i = 0; i < 4; i++) {
+		response = send_request(fd, "{'japi_request': 'japi_cmd_list'}");
+		if (response.find("rate limit exceeded") != std::string::npos) {
+			limited++;
+		}
+	}
+	EXPECT_EQ(limited, 2);
+
+	/* Other clients have their own bucket */
+	other_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(other_fd, 0);
+	response = send_request(other_fd, "{'japi_request': 'japi_cmd_list'}");
+	EXPECT_NE(response.find("japi_pushsrv_list"), std::string::npos);
+
+	close(other_fd);
+	close(fd);
+
+	japi_shutdown(ctx);
+	server.join();
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, ClientBudget)
+{
+	japi_context *ctx;
+	std::string bulk, response;
+	char buf[256];
+	ssize_t n;
+	int port, bulk_fd, fd;
+
+	EXPECT_EQ(japi_set_client_budget(NULL, 5), -1);
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_register_request(ctx, "bulk", &counting_request_handler), 0);
+	counting_request_calls = 0;
+	EXPECT_EQ(japi_set_client_budget(ctx, 5), 0);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+	ASSERT_GE(japi_get_fd(ctx), 0);
+
+	bulk_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(bulk_fd, 0);
+	fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(fd, 0);
+	for (int i = 0; i < 100 && ctx->num_clients < 2; i++) {
+		EXPECT_EQ(japi_process_events(ctx, 10), 0);
+	}
+	ASSERT_EQ(ctx->num_clients, 2);
+
+	/* A client pipelining many requests doesn't delay the other client */
+	for (int i = 0; i < 50; i++) {
+		bulk += "{'japi_request': 'bulk'}\n";
+	}
+	ASSERT_EQ(write(bulk_fd, bulk.c_str(), bulk.size()), (ssize_t)bulk.size());
+	ASSERT_EQ(write(fd, "{'japi_request': 'japi_cmd_list'}\n", 34), 34);
+	usleep(10000);
+
+	EXPECT_EQ(japi_process_events(ctx, 100), 0);
+	EXPECT_EQ(counting_request_calls, 5);
+	n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+	ASSERT_GT(n, 0);
+	buf[n] = '\0';
+	EXPECT_NE(strstr(buf, "japi_pushsrv_list"), (char *)NULL);
+
+	/* Leftover lines are resumed without waiting */
+	EXPECT_EQ(japi_get_timeout(ctx), 0);
+	for (int i = 0; i < 100 && counting_request_calls < 50; i++) {
+		EXPECT_EQ(japi_process_events(ctx, 0), 0);
+	}
+	EXPECT_EQ(counting_request_calls, 50);
+	EXPECT_EQ(count_messages(bulk_fd), 50);
+	close(fd);
+	close(bulk_fd);
+	japi_destroy(ctx);
+
+	/* The select() server loop resumes leftover lines as well */
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_register_request(ctx, "bulk", &counting_request_handler), 0);
+	counting_request_calls = 0;
+	EXPECT_EQ(japi_set_client_budget(ctx, 1), 0);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+
+	std::thread server([ctx]() { japi_start_server(ctx, NULL); });
+
+	bulk_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(bulk_fd, 0);
+	ASSERT_EQ(write(bulk_fd, bulk.c_str(), bulk.size()), (ssize_t)bulk.size());
+	for (int i = 0; i < 100 && std::count(response.begin(), response.end(), '\n') < 50;
+		 i++) {
+		usleep(10000);
+		n = recv(bulk_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n > 0) {
+			response.append(buf, n);
+		}
+	}
+	EXPECT_EQ(std::count(response.begin(), response.end(), '\n'), 50);
+	close(bulk_fd);
+
+	japi_shutdown(ctx);
+	server.join();
+	japi_destroy(ctx);
+}
+
+TEST(JAPI_Server, RequestPriority)
+{
+	japi_context *ctx;
+	japi_socket_options opts;
+	std::string bulk;
+	std::vector<std::string> responses;
+	int port, bulk_fd, fd;
+
+	ctx = japi_init(NULL);
+	ASSERT_EQ(japi_register_request(ctx, "bulk", &counting_request_handler), 0);
+	ASSERT_EQ(japi_register_request(ctx, "stop", &urgent_request_handler), 0);
+	counting_request_calls = 0;
+
+	EXPECT_EQ(japi_set_request_priority(NULL, "stop", JAPI_PRIORITY_HIGH), -1);
+	EXPECT_EQ(japi_set_request_priority(ctx, NULL, JAPI_PRIORITY_HIGH), -2);
+	EXPECT_EQ(japi_set_request_priority(ctx, "unknown", JAPI_PRIORITY_HIGH), -3);
+	EXPECT_EQ(japi_set_request_priority(ctx, "stop", (japi_priority)7), -4);
+	EXPECT_EQ(japi_set_request_priority(ctx, "stop", JAPI_PRIORITY_HIGH), 0);
+	EXPECT_EQ(japi_set_request_priority(ctx, "stop", JAPI_PRIORITY_HIGH), 0);
+	EXPECT_EQ(ctx->num_high_priority, 1);
+
+	/* Responses are read right after each iteration */
+	memset(&opts, 0, sizeof(opts));
+	opts.tcp_nodelay = true;
+	ASSERT_EQ(japi_set_socket_options(ctx, &opts), 0);
+	ASSERT_EQ(japi_add_tcp_listener(ctx, "127.0.0.1", "0"), 0);
+	port = listener_port(ctx->listeners);
+	ASSERT_GE(japi_get_fd(ctx), 0);
+
+	bulk_fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(bulk_fd, 0);
+	fd = connect_tcp(AF_INET, port);
+	ASSERT_GE(fd, 0);
+	for (int i = 0; i < 100 && ctx->num_clients < 2; i++) {
+		EXPECT_EQ(japi_process_events(ctx, 10), 0);
+	}
+	ASSERT_EQ(ctx->num_clients, 2);
+
+	/* High priority requests overtake bulk requests of other clients, but not
+	 * earlier requests of the same client */
+	for (int i = 0; i < 10; i++) {
+		bulk += "{'japi_request': 'bulk'}\n";
+	}
+	bulk += "{'japi_request': 'stop', 'japi_request_no': 1}\n";
+	ASSERT_EQ(write(bulk_fd, bulk.c_str(), bulk.size()), (ssize_t)bulk.size());
+	ASSERT_EQ(write(fd, "{'japi_request': 'stop'}\n", 25), 25);
+	usleep(10000);
+
+	EXPECT_EQ(japi_process_events(ctx, 100), 0);
+	EXPECT_EQ(counting_request_calls, 10);
+	responses = read_messages(fd);
+	ASSERT_EQ(responses.size(), 1U);
+	EXPECT_NE(responses[0].find("\"calls_before\": 0"), std::string::npos);
+	responses = read_messages(bulk_fd);
+	ASSERT_EQ(responses.size(), 11U);
+	EXPECT_NE(responses[0].find("\"calls\": 1"), std::string::npos);
+	EXPECT_NE(responses[9].find("\"calls\": 10"), std::string::npos);
+	EXPECT_NE(responses[10].find("\"japi_request_no\": 1"), std::string::npos);
+	EXPECT_NE(responses[10].find("\"calls_before\": 10"), std::string::npos);
+
+	/* Without high priority requests the order of arrival is kept */
+	EXPECT_EQ(japi_set_request_priority(ctx, "stop", JAPI_PRIORITY_NORMAL), 0);
+	EXPECT_EQ(ctx->num_high_priority, 0);
+	ASSERT_EQ(write(bulk_fd, bulk.c_str(), bulk.size()), (ssize_t)bulk.size());
+	usleep(10000);
+	EXPECT_EQ(japi_process_events(ctx, 100), 0);
+	responses = read_messages(bulk_fd);
+	ASSERT_EQ(responses.size(), 11U);
+	EXPECT_NE(responses[10].find("\"calls_before\": 20"), std::string::npos);
+
+	close(fd);
+	close(bulk_fd);
+	japi_destroy(ctx);
+}
+#endif